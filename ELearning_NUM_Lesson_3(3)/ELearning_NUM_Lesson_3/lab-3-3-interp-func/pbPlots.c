@@ -2,22 +2,64 @@
 
 #include "pbPlots.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <errno.h>
+#endif
+
 // -----------------
 
-typedef struct Memory{
-	void *mem;
+/* Chunked bump arena. Small allocations are carved out of ARENA_CHUNK_SIZE chunks
+ * by advancing a pointer; allocations larger than a quarter chunk get a block of
+ * their own so that DeleteImage and friends can hand them back immediately.
+ * Every allocation is preceded by a 16-byte header holding its size and kind. */
+
+#ifndef ARENA_CHUNK_SIZE
+#define ARENA_CHUNK_SIZE (1 << 20)
+#endif
+#define ARENA_ALIGN 16
+#define ARENA_HEADER 16
+#define ArenaAlignUp(n) (((n) + (ARENA_ALIGN - 1)) & ~(int64_t)(ARENA_ALIGN - 1))
+
+typedef struct ArenaChunk{
+	struct ArenaChunk *next;
+	int64_t size;
+	int64_t used;
+	int64_t index; /* Position in the chunk list, 1 for the oldest chunk */
+} ArenaChunk;
+
+typedef struct LargeBlock{
+	struct LargeBlock *prev;
+	struct LargeBlock *next;
+	int64_t serial;
+	int64_t size;
+} LargeBlock;
+
+typedef struct BlockHeader{
 	int64_t size;
-	struct Memory *next;
-	_Bool freed;
-} Memory;
+	int64_t large;
+} BlockHeader;
 
 typedef struct AllocatorData{
-	Memory *memoryStart;
-	Memory *memory;
+	ArenaChunk *chunk;
+	LargeBlock *large;
+	int64_t serial;
 	int64_t maximum;
 	int64_t current;
+	int64_t reserved;
+	int64_t allocations;
 } AllocatorData;
 
+static void InitAllocatorData(AllocatorData *ad){
+	ad->chunk = NULL;
+	ad->large = NULL;
+	ad->serial = 0;
+	ad->maximum = 0;
+	ad->current = 0;
+	ad->reserved = 0;
+	ad->allocations = 0;
+}
+
 #ifdef THREAD_SAFE_PTHREADS
 
 #include <pthread.h>
@@ -34,8 +76,7 @@ static AllocatorData *GetAllocatorData(){
 	ad = pthread_getspecific(key);
   if (ad == NULL) {
 		ad = malloc(sizeof(AllocatorData));
-		ad->memoryStart = NULL;
-		ad->memory = NULL;
+		InitAllocatorData(ad);
 		(void) pthread_setspecific(key, ad);
   }
 	ad = (AllocatorData *)pthread_getspecific(key);
@@ -48,8 +89,7 @@ static AllocatorData *GetAllocatorData(){
 	static AllocatorData ad;
 	static _Bool first = true;
 	if(first){
-		ad.memoryStart = NULL;
-		ad.memory = NULL;
+		InitAllocatorData(&ad);
 		first = false;
 	}
 	return &ad;
@@ -59,61 +99,172 @@ static AllocatorData *GetAllocatorData(){
 
 void StartArenaAllocator(){
 	AllocatorData *ad = GetAllocatorData();
-	ad->memoryStart = NULL;
-	ad->memory = NULL;
-	ad->maximum = 0;
-	ad->current = 0;
+	InitAllocatorData(ad);
+}
+
+static void *AllocateLarge(AllocatorData *ad, int64_t size){
+	LargeBlock *block;
+	BlockHeader *header;
+
+	block = malloc(sizeof(LargeBlock) + ARENA_HEADER + size);
+	if(block == NULL){
+		return NULL;
+	}
+	block->prev = NULL;
+	block->next = ad->large;
+	block->serial = ++ad->serial;
+	block->size = sizeof(LargeBlock) + ARENA_HEADER + size;
+	if(ad->large != NULL){
+		ad->large->prev = block;
+	}
+	ad->large = block;
+
+	header = (BlockHeader*)(block + 1);
+	header->size = size;
+	header->large = 1;
+
+	ad->current += block->size;
+	ad->reserved += block->size;
+	if(ad->current > ad->maximum){
+		ad->maximum = ad->current;
+	}
+
+	return (uint8_t*)header + ARENA_HEADER;
+}
+
+static void FreeLarge(AllocatorData *ad, LargeBlock *block){
+	if(block->prev != NULL){
+		block->prev->next = block->next;
+	}else{
+		ad->large = block->next;
+	}
+	if(block->next != NULL){
+		block->next->prev = block->prev;
+	}
+	ad->current -= block->size;
+	ad->reserved -= block->size;
+	free(block);
 }
 
 void *Allocate(int64_t size, int64_t e){
-	uint8_t *addr;
-	Memory** base;
+	ArenaChunk *chunk;
+	BlockHeader *header;
+	int64_t need, chunkSize;
 
 	AllocatorData *ad = GetAllocatorData();
+	ad->allocations++;
 
-	if(ad->memoryStart == NULL){
-		ad->memoryStart = malloc(sizeof(Memory));
-		ad->memory = ad->memoryStart;
-	}else{
-		ad->memory->next = malloc(sizeof(Memory));
-		ad->memory = ad->memory->next;
+	if(size > ARENA_CHUNK_SIZE/4){
+		return AllocateLarge(ad, size);
+	}
+
+	need = ARENA_HEADER + ArenaAlignUp(size);
+	chunk = ad->chunk;
+	if(chunk == NULL || chunk->used + need > chunk->size){
+		chunkSize = ARENA_CHUNK_SIZE;
+		chunk = malloc(sizeof(ArenaChunk) + chunkSize);
+		if(chunk == NULL){
+			return NULL;
+		}
+		chunk->next = ad->chunk;
+		chunk->size = chunkSize;
+		chunk->used = 0;
+		chunk->index = ad->chunk != NULL ? ad->chunk->index + 1 : 1;
+		ad->chunk = chunk;
+		ad->reserved += sizeof(ArenaChunk) + chunkSize;
 	}
 
-	ad->memory->next = NULL;
-	addr = malloc(8+size);
-	base = (Memory**)addr;
-	*base = ad->memory;
-	addr = addr + 8;
-	ad->memory->size = size;
-	ad->memory->mem = addr;
-	ad->memory->freed = false;
+	header = (BlockHeader*)((uint8_t*)(chunk + 1) + chunk->used);
+	header->size = size;
+	header->large = 0;
+	chunk->used += need;
 
-	ad->current += size;
-	ad->maximum = fmax(ad->maximum, ad->current);
+	ad->current += need;
+	if(ad->current > ad->maximum){
+		ad->maximum = ad->current;
+	}
 
-	return (void*)addr;
+	return (uint8_t*)header + ARENA_HEADER;
 }
 
-void FreeAllocations(){
-	Memory *cur, *prev;
-	int64_t total;
-	uint8_t *base;
+/* Rewinds the arena to the state recorded by BeginArenaScope. Everything allocated
+ * since then is released at once; chunks that become empty are returned to malloc.
+ * The scope remembers the index of the newest chunk rather than its address, which
+ * malloc may hand out again for a chunk allocated inside the scope. */
+void EndArenaScope(ArenaScope scope){
+	ArenaChunk *chunk;
 
 	AllocatorData *ad = GetAllocatorData();
 
-	total = 0;
-	cur = ad->memoryStart;
-
-	while(cur != NULL){
-		base = cur->mem;
-		base = base - 8;
-		if(!cur->freed){
-			free(base);
-			total += cur->size;
-		}
-		prev = cur;
-		cur = cur->next;
-		free(prev);
+	while(ad->chunk != NULL && ad->chunk->index > scope.chunks){
+		chunk = ad->chunk;
+		ad->chunk = chunk->next;
+		ad->current -= chunk->used;
+		ad->reserved -= sizeof(ArenaChunk) + chunk->size;
+		free(chunk);
+	}
+	if(ad->chunk != NULL && ad->chunk->index == scope.chunks && ad->chunk->used > scope.used){
+		ad->current -= ad->chunk->used - scope.used;
+		ad->chunk->used = scope.used;
+	}
+
+	while(ad->large != NULL && ad->large->serial > scope.serial){
+		FreeLarge(ad, ad->large);
+	}
+}
+
+ArenaScope BeginArenaScope(){
+	ArenaScope scope;
+
+	AllocatorData *ad = GetAllocatorData();
+	scope.chunks = ad->chunk != NULL ? ad->chunk->index : 0;
+	scope.used = ad->chunk != NULL ? ad->chunk->used : 0;
+	scope.serial = ad->serial;
+
+	return scope;
+}
+
+/* Releases all allocations but keeps the newest chunk for reuse. */
+void ResetAllocations(){
+	ArenaChunk *chunk;
+	ArenaScope scope;
+
+	AllocatorData *ad = GetAllocatorData();
+
+	while(ad->chunk != NULL && ad->chunk->next != NULL){
+		chunk = ad->chunk->next;
+		ad->chunk->next = chunk->next;
+		ad->current -= chunk->used;
+		ad->reserved -= sizeof(ArenaChunk) + chunk->size;
+		free(chunk);
+	}
+
+	if(ad->chunk != NULL){
+		ad->chunk->index = 1;
+	}
+	scope.chunks = ad->chunk != NULL ? 1 : 0;
+	scope.used = 0;
+	scope.serial = 0;
+	EndArenaScope(scope);
+}
+
+void GetArenaStatistics(ArenaStatistics *stats){
+	AllocatorData *ad = GetAllocatorData();
+
+	stats->current = ad->current;
+	stats->maximum = ad->maximum;
+	stats->reserved = ad->reserved;
+	stats->allocations = ad->allocations;
+}
+
+void FreeAllocations(){
+	AllocatorData *ad = GetAllocatorData();
+
+	ResetAllocations();
+	if(ad->chunk != NULL){
+		ad->reserved -= sizeof(ArenaChunk) + ad->chunk->size;
+		free(ad->chunk);
+		ad->chunk = NULL;
 	}
 
 	#ifdef THREAD_SAFE_PTHREADS
@@ -121,26 +272,33 @@ void FreeAllocations(){
 	ad = NULL;
 	(void) pthread_setspecific(key, ad);
 	#endif
-
-	//printf("Freed %ld kB\n", total/1024);
-	//printf("Maximum %ld kB\n", ad->maximum/1024);
-	//printf("Current %ld\n", ad->current/1024/1024);
 }
 
+/* Large blocks are returned to malloc. Small blocks can only be reclaimed when they
+ * are the most recent allocation of the current chunk; otherwise they stay until
+ * the enclosing scope ends or FreeAllocations is called. */
 void Free(void *addr){
-	uint8_t *base;
-	Memory **mem;
+	BlockHeader *header;
+	ArenaChunk *chunk;
+	int64_t need;
 
-	base = addr;
-	base = base - 8;
-
-	mem = (Memory**)base;
+	if(addr == NULL){
+		return;
+	}
 
 	AllocatorData *ad = GetAllocatorData();
-	ad->current -= (*mem)->size;
+	header = (BlockHeader*)((uint8_t*)addr - ARENA_HEADER);
 
-	(*mem)->freed = true;
-	free(base);
+	if(header->large){
+		FreeLarge(ad, (LargeBlock*)header - 1);
+	}else{
+		need = ARENA_HEADER + ArenaAlignUp(header->size);
+		chunk = ad->chunk;
+		if(chunk != NULL && (uint8_t*)header + need == (uint8_t*)(chunk + 1) + chunk->used){
+			chunk->used -= need;
+			ad->current -= need;
+		}
+	}
 }
 // -----------------
 
@@ -939,6 +1097,8 @@ ScatterPlotSeries *GetDefaultScatterPlotSeriesSettings(){
   series->lineType = L"solid";
   series->lineTypeLength = wcslen(series->lineType);
   series->lineThickness = 1.0;
+  series->decimation = L"auto";
+  series->decimationLength = wcslen(series->decimation);
   series->xs = (double*)Allocate(sizeof(double) * (0.0), 1);
   series->xsLength = 0.0;
   series->ys = (double*)Allocate(sizeof(double) * (0.0), 1);
@@ -969,29 +1129,321 @@ _Bool DrawScatterPlot(RGBABitmapImageReference *canvasReference, double width, d
 
   return success;
 }
+void DrawScatterPlotSeriesOnImage(RGBABitmapImage *canvas, ScatterPlotSeries *sp, double xMin, double xMax, double yMin, double yMax, double xPixelMin, double xPixelMax, double yPixelMin, double yPixelMax, NumberReference *patternOffset){
+  double i, x, y, xPrev, yPrev, px, py, pxPrev, pyPrev, yaxis;
+  NumberReference *x1Ref, *y1Ref, *x2Ref, *y2Ref;
+  _Bool prevSet, cropped;
+  double *xs, *ys;
+  size_t xsLength, ysLength;
+  _Bool linearInterpolation;
+  _Bool *linePattern;
+  size_t linePatternLength;
+  double *decimatedXs, *decimatedYs;
+  size_t decimatedLength;
+
+
+  xs = sp->xs;
+  xsLength = sp->xsLength;
+  ys = sp->ys;
+  ysLength = sp->ysLength;
+  linearInterpolation = sp->linearInterpolation;
+
+  decimatedLength = DecimateScatterPlotSeries(sp, xMin, xMax, yMin, yMax, xPixelMin, xPixelMax, yPixelMin, yPixelMax, &decimatedXs, &decimatedYs);
+  if(decimatedLength > 0){
+    xs = decimatedXs;
+    ys = decimatedYs;
+    xsLength = decimatedLength;
+    ysLength = decimatedLength;
+  }
+
+  x1Ref = (NumberReference *)Allocate(sizeof(NumberReference), 1);
+  y1Ref = (NumberReference *)Allocate(sizeof(NumberReference), 1);
+  x2Ref = (NumberReference *)Allocate(sizeof(NumberReference), 1);
+  y2Ref = (NumberReference *)Allocate(sizeof(NumberReference), 1);
+  if(linearInterpolation){
+    prevSet = false;
+    xPrev = 0.0;
+    yPrev = 0.0;
+    for(i = 0.0; i < (double)xsLength; i = i + 1.0){
+      x = xs[(int)(i)];
+      y = ys[(int)(i)];
+
+      if(prevSet){
+        x1Ref->numberValue = xPrev;
+        y1Ref->numberValue = yPrev;
+        x2Ref->numberValue = x;
+        y2Ref->numberValue = y;
+
+        cropped = CropLineWithinBoundary(x1Ref, y1Ref, x2Ref, y2Ref, xMin, xMax, yMin, yMax);
+
+        if(cropped){
+          pxPrev = floor(MapXCoordinate(x1Ref->numberValue, xMin, xMax, xPixelMin, xPixelMax));
+          pyPrev = floor(MapYCoordinate(y1Ref->numberValue, yMin, yMax, yPixelMin, yPixelMax));
+          px = floor(MapXCoordinate(x2Ref->numberValue, xMin, xMax, xPixelMin, xPixelMax));
+          py = floor(MapYCoordinate(y2Ref->numberValue, yMin, yMax, yPixelMin, yPixelMax));
+
+          if(aStringsEqual(sp->lineType, sp->lineTypeLength, strparam(L"solid")) && sp->lineThickness == 1.0){
+            DrawLine1px(canvas, pxPrev, pyPrev, px, py, sp->color);
+          }else if(aStringsEqual(sp->lineType, sp->lineTypeLength, strparam(L"solid"))){
+            DrawLine(canvas, pxPrev, pyPrev, px, py, sp->lineThickness, sp->color);
+          }else if(aStringsEqual(sp->lineType, sp->lineTypeLength, strparam(L"dashed"))){
+            linePattern = GetLinePattern1(&linePatternLength);
+            DrawLineBresenhamsAlgorithmThickPatterned(canvas, pxPrev, pyPrev, px, py, sp->lineThickness, linePattern, linePatternLength, patternOffset, sp->color);
+          }else if(aStringsEqual(sp->lineType, sp->lineTypeLength, strparam(L"dotted"))){
+            linePattern = GetLinePattern2(&linePatternLength);
+            DrawLineBresenhamsAlgorithmThickPatterned(canvas, pxPrev, pyPrev, px, py, sp->lineThickness, linePattern, linePatternLength, patternOffset, sp->color);
+          }else if(aStringsEqual(sp->lineType, sp->lineTypeLength, strparam(L"dotdash"))){
+            linePattern = GetLinePattern3(&linePatternLength);
+            DrawLineBresenhamsAlgorithmThickPatterned(canvas, pxPrev, pyPrev, px, py, sp->lineThickness, linePattern, linePatternLength, patternOffset, sp->color);
+          }else if(aStringsEqual(sp->lineType, sp->lineTypeLength, strparam(L"longdash"))){
+            linePattern = GetLinePattern4(&linePatternLength);
+            DrawLineBresenhamsAlgorithmThickPatterned(canvas, pxPrev, pyPrev, px, py, sp->lineThickness, linePattern, linePatternLength, patternOffset, sp->color);
+          }else if(aStringsEqual(sp->lineType, sp->lineTypeLength, strparam(L"twodash"))){
+            linePattern = GetLinePattern5(&linePatternLength);
+            DrawLineBresenhamsAlgorithmThickPatterned(canvas, pxPrev, pyPrev, px, py, sp->lineThickness, linePattern, linePatternLength, patternOffset, sp->color);
+          }
+        }
+      }
+
+      prevSet = true;
+      xPrev = x;
+      yPrev = y;
+    }
+  }else{
+    for(i = 0.0; i < (double)xsLength; i = i + 1.0){
+      x = xs[(int)(i)];
+      y = ys[(int)(i)];
+
+      if(x > xMin && x < xMax && y > yMin && y < yMax){
+
+        x = floor(MapXCoordinate(x, xMin, xMax, xPixelMin, xPixelMax));
+        y = floor(MapYCoordinate(y, yMin, yMax, yPixelMin, yPixelMax));
+
+        if(aStringsEqual(sp->pointType, sp->pointTypeLength, strparam(L"crosses"))){
+          DrawPixel(canvas, x, y, sp->color);
+          DrawPixel(canvas, x + 1.0, y, sp->color);
+          DrawPixel(canvas, x + 2.0, y, sp->color);
+          DrawPixel(canvas, x - 1.0, y, sp->color);
+          DrawPixel(canvas, x - 2.0, y, sp->color);
+          DrawPixel(canvas, x, y + 1.0, sp->color);
+          DrawPixel(canvas, x, y + 2.0, sp->color);
+          DrawPixel(canvas, x, y - 1.0, sp->color);
+          DrawPixel(canvas, x, y - 2.0, sp->color);
+        }else if(aStringsEqual(sp->pointType, sp->pointTypeLength, strparam(L"circles"))){
+          DrawCircle(canvas, x, y, 3.0, sp->color);
+        }else if(aStringsEqual(sp->pointType, sp->pointTypeLength, strparam(L"dots"))){
+          DrawFilledCircle(canvas, x, y, 3.0, sp->color);
+        }else if(aStringsEqual(sp->pointType, sp->pointTypeLength, strparam(L"triangles"))){
+          DrawTriangle(canvas, x, y, 3.0, sp->color);
+        }else if(aStringsEqual(sp->pointType, sp->pointTypeLength, strparam(L"filled triangles"))){
+          DrawFilledTriangle(canvas, x, y, 3.0, sp->color);
+        }else if(aStringsEqual(sp->pointType, sp->pointTypeLength, strparam(L"pixels"))){
+          DrawPixel(canvas, x, y, sp->color);
+        }else if(aStringsEqual(sp->pointType, sp->pointTypeLength, strparam(L"dotlinetoxaxis"))){
+          DrawFilledCircle(canvas, x, y, 3.0, sp->color);
+          yaxis = floor(MapYCoordinate(0.0, yMin, yMax, yPixelMin, yPixelMax));
+          yaxis = fmin(fmax(yaxis, yPixelMin), yPixelMax);
+          DrawLine(canvas, x, y, x, yaxis, sp->lineThickness, sp->color);
+        }
+      }
+    }
+  }
+
+  if(decimatedLength > 0){
+    Free(decimatedYs);
+    Free(decimatedXs);
+  }
+}
+/* Series are rasterized in parallel into transparent layers, which are then composited
+ * onto the canvas in drawing order with DrawImageOnImage, i.e. with AlphaBlend. Long
+ * series are split into pieces of at least PLOT_SPLIT_POINTS points (lines share the
+ * end point of the previous piece), so a single large series also spreads over the
+ * threads. Opaque colours give the same image as drawing directly; anti-aliased and
+ * translucent pixels can differ by a level or two, since the layers store 8 bits. Patterned lines carry
+ * their dash phase from one segment to the next and are always drawn in sequence.
+ * Every layer costs a full canvas to clear and composite, so plots with fewer than
+ * PLOT_PARALLEL_POINTS points in all series together are drawn directly as well. */
+#define PLOT_SPLIT_POINTS 65536
+#define PLOT_PARALLEL_POINTS 65536
+
+static int plotThreads = 0;
+
+typedef struct PlotLayerJob{
+	ScatterPlotSeries *pieces;
+	RGBABitmapImage **layers;
+	size_t first;
+	size_t count;
+	size_t next;
+	double xMin, xMax, yMin, yMax;
+	double xPixelMin, xPixelMax, yPixelMin, yPixelMax;
+#ifdef THREAD_SAFE_PTHREADS
+	pthread_mutex_t lock;
+#endif
+} PlotLayerJob;
+
+static void PlotLayerWorker(PlotLayerJob *job){
+	NumberReference offset;
+	ScatterPlotSeries *piece;
+	RGBA color;
+	size_t k;
+
+	for(;;){
+#ifdef THREAD_SAFE_PTHREADS
+		pthread_mutex_lock(&job->lock);
+#endif
+		k = job->next++;
+#ifdef THREAD_SAFE_PTHREADS
+		pthread_mutex_unlock(&job->lock);
+#endif
+		if(k >= job->count){
+			break;
+		}
+		/* The line drawing routines modify the colour while they draw; give each piece its own. */
+		piece = &job->pieces[job->first + k];
+		color = *piece->color;
+		piece->color = &color;
+		offset.numberValue = 0.0;
+		DrawScatterPlotSeriesOnImage(job->layers[k], piece, job->xMin, job->xMax, job->yMin, job->yMax, job->xPixelMin, job->xPixelMax, job->yPixelMin, job->yPixelMax, &offset);
+	}
+}
+
+#ifdef THREAD_SAFE_PTHREADS
+static void *PlotLayerThread(void *arg){
+	PlotLayerWorker((PlotLayerJob*)arg);
+	FreeAllocations();
+	return NULL;
+}
+#endif
+
+/* Sets the number of threads used to rasterize scatter plot series; 0 means one per CPU. */
+void SetPlotThreads(double threads){
+	plotThreads = threads;
+}
+
+void DrawScatterPlotSeriesLayers(RGBABitmapImage *canvas, ScatterPlotSettings *settings, double xMin, double xMax, double yMin, double yMax, double xPixelMin, double xPixelMax, double yPixelMin, double yPixelMax, NumberReference *patternOffset){
+	PlotLayerJob job;
+	ScatterPlotSeries *sp;
+	size_t s, k, n, parts, count, start, end, threads, total;
+	_Bool parallel;
+	int t, started;
+
+	threads = 1;
+#ifdef THREAD_SAFE_PTHREADS
+	threads = plotThreads > 0 ? plotThreads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	parallel = threads > 1;
+	count = 0;
+	total = 0;
+	for(s = 0; s < settings->scatterPlotSeriesLength; s++){
+		sp = settings->scatterPlotSeries[s];
+		n = sp->xsLength < sp->ysLength ? sp->xsLength : sp->ysLength;
+		total += n;
+		if(sp->linearInterpolation && !aStringsEqual(sp->lineType, sp->lineTypeLength, strparam(L"solid"))){
+			parallel = false;
+		}
+		parts = (n + PLOT_SPLIT_POINTS - 1)/PLOT_SPLIT_POINTS;
+		count += parts < 1 ? 1 : parts < threads ? parts : threads;
+	}
+
+	if(!parallel || count < 2 || total < PLOT_PARALLEL_POINTS){
+		for(s = 0; s < settings->scatterPlotSeriesLength; s++){
+			DrawScatterPlotSeriesOnImage(canvas, settings->scatterPlotSeries[s], xMin, xMax, yMin, yMax, xPixelMin, xPixelMax, yPixelMin, yPixelMax, patternOffset);
+		}
+		return;
+	}
+
+	job.pieces = (ScatterPlotSeries *)Allocate(sizeof(ScatterPlotSeries) * count, 1);
+	k = 0;
+	for(s = 0; s < settings->scatterPlotSeriesLength; s++){
+		sp = settings->scatterPlotSeries[s];
+		n = sp->xsLength < sp->ysLength ? sp->xsLength : sp->ysLength;
+		parts = (n + PLOT_SPLIT_POINTS - 1)/PLOT_SPLIT_POINTS;
+		parts = parts < 1 ? 1 : parts < threads ? parts : threads;
+		for(t = 0; t < (int)parts; t++){
+			start = n*t/parts;
+			end = n*(t + 1)/parts;
+			if(sp->linearInterpolation && start > 0){
+				start--;
+			}
+			job.pieces[k] = *sp;
+			job.pieces[k].xs = sp->xs + start;
+			job.pieces[k].ys = sp->ys + start;
+			job.pieces[k].xsLength = end - start;
+			job.pieces[k].ysLength = end - start;
+			k++;
+		}
+	}
+
+	if(threads > count){
+		threads = count;
+	}
+	if(threads > 64){
+		threads = 64;
+	}
+	job.layers = (RGBABitmapImage **)Allocate(sizeof(RGBABitmapImage*) * threads, 1);
+	for(k = 0; k < threads; k++){
+		job.layers[k] = CreateImage(ImageWidth(canvas), ImageHeight(canvas), GetTransparent());
+	}
+	job.xMin = xMin;
+	job.xMax = xMax;
+	job.yMin = yMin;
+	job.yMax = yMax;
+	job.xPixelMin = xPixelMin;
+	job.xPixelMax = xPixelMax;
+	job.yPixelMin = yPixelMin;
+	job.yPixelMax = yPixelMax;
+
+	for(job.first = 0; job.first < count; job.first += threads){
+		job.count = count - job.first < threads ? count - job.first : threads;
+		job.next = 0;
+		started = 1;
+#ifdef THREAD_SAFE_PTHREADS
+		pthread_t workers[64];
+
+		pthread_mutex_init(&job.lock, NULL);
+		for(started = 1; started < (int)job.count; started++){
+			if(pthread_create(&workers[started], NULL, PlotLayerThread, &job) != 0){
+				break;
+			}
+		}
+#endif
+		PlotLayerWorker(&job);
+#ifdef THREAD_SAFE_PTHREADS
+		for(t = 1; t < started; t++){
+			pthread_join(workers[t], NULL);
+		}
+		pthread_mutex_destroy(&job.lock);
+#endif
+		(void)started;
+
+		for(k = 0; k < job.count; k++){
+			DrawImageOnImage(canvas, job.layers[k], 0.0, 0.0);
+			FillImagePacked(job.layers[k], 0);
+		}
+	}
+
+	for(k = threads; k > 0; k--){
+		DeleteImage(job.layers[k - 1]);
+	}
+}
 _Bool DrawScatterPlotFromSettings(RGBABitmapImageReference *canvasReference, ScatterPlotSettings *settings, StringReference *errorMessage){
-  double xMin, xMax, yMin, yMax, xLength, yLength, i, x, y, xPrev, yPrev, px, py, pxPrev, pyPrev, originX, originY, p, l, plot;
+  double xMin, xMax, yMin, yMax, xLength, yLength, i, x, y, px, py, originX, originY, p, l;
   Rectangle *boundaries;
   double xPadding, yPadding, originXPixels, originYPixels;
   double xPixelMin, yPixelMin, xPixelMax, yPixelMax, xLengthPixels, yLengthPixels, axisLabelPadding;
-  NumberReference *nextRectangle, *x1Ref, *y1Ref, *x2Ref, *y2Ref, *patternOffset;
-  _Bool prevSet, success;
+  NumberReference *nextRectangle, *patternOffset;
+  _Bool success;
   RGBA *gridLabelColor;
   RGBABitmapImage *canvas;
-  double *xs, *ys;
-  size_t xsLength, ysLength;
-  _Bool linearInterpolation;
-  ScatterPlotSeries *sp;
   double *xGridPositions, *yGridPositions;
   size_t xGridPositionsLength, yGridPositionsLength;
   StringArrayReference *xLabels, *yLabels;
   NumberArrayReference *xLabelPriorities, *yLabelPriorities;
   Rectangle **occupied;
   size_t occupiedLength;
-  _Bool *linePattern;
-  size_t linePatternLength;
   _Bool originXInside, originYInside, textOnLeft, textOnBottom;
-  double originTextX, originTextY, originTextXPixels, originTextYPixels, side, yaxis;
+  double originTextX, originTextY, originTextXPixels, originTextYPixels, side;
 
   canvas = CreateImage(settings->width, settings->height, GetWhite());
   patternOffset = CreateNumberReference(0.0);
@@ -1197,114 +1649,191 @@ if(settings->yAxisLeft){
     }
 
     /* Draw points */
-    for(plot = 0.0; plot < (double)settings->scatterPlotSeriesLength; plot = plot + 1.0){
-      sp = settings->scatterPlotSeries[(int)(plot)];
-
-      xs = sp->xs;
-      xsLength = sp->xsLength;
-      ys = sp->ys;
-      ysLength = sp->ysLength;
-      linearInterpolation = sp->linearInterpolation;
-
-      x1Ref = (NumberReference *)Allocate(sizeof(NumberReference), 1);
-      y1Ref = (NumberReference *)Allocate(sizeof(NumberReference), 1);
-      x2Ref = (NumberReference *)Allocate(sizeof(NumberReference), 1);
-      y2Ref = (NumberReference *)Allocate(sizeof(NumberReference), 1);
-      if(linearInterpolation){
-        prevSet = false;
-        xPrev = 0.0;
-        yPrev = 0.0;
-        for(i = 0.0; i < (double)xsLength; i = i + 1.0){
-          x = xs[(int)(i)];
-          y = ys[(int)(i)];
-
-          if(prevSet){
-            x1Ref->numberValue = xPrev;
-            y1Ref->numberValue = yPrev;
-            x2Ref->numberValue = x;
-            y2Ref->numberValue = y;
-
-            success = CropLineWithinBoundary(x1Ref, y1Ref, x2Ref, y2Ref, xMin, xMax, yMin, yMax);
-
-            if(success){
-              pxPrev = floor(MapXCoordinate(x1Ref->numberValue, xMin, xMax, xPixelMin, xPixelMax));
-              pyPrev = floor(MapYCoordinate(y1Ref->numberValue, yMin, yMax, yPixelMin, yPixelMax));
-              px = floor(MapXCoordinate(x2Ref->numberValue, xMin, xMax, xPixelMin, xPixelMax));
-              py = floor(MapYCoordinate(y2Ref->numberValue, yMin, yMax, yPixelMin, yPixelMax));
-
-              if(aStringsEqual(sp->lineType, sp->lineTypeLength, strparam(L"solid")) && sp->lineThickness == 1.0){
-                DrawLine1px(canvas, pxPrev, pyPrev, px, py, sp->color);
-              }else if(aStringsEqual(sp->lineType, sp->lineTypeLength, strparam(L"solid"))){
-                DrawLine(canvas, pxPrev, pyPrev, px, py, sp->lineThickness, sp->color);
-              }else if(aStringsEqual(sp->lineType, sp->lineTypeLength, strparam(L"dashed"))){
-                linePattern = GetLinePattern1(&linePatternLength);
-                DrawLineBresenhamsAlgorithmThickPatterned(canvas, pxPrev, pyPrev, px, py, sp->lineThickness, linePattern, linePatternLength, patternOffset, sp->color);
-              }else if(aStringsEqual(sp->lineType, sp->lineTypeLength, strparam(L"dotted"))){
-                linePattern = GetLinePattern2(&linePatternLength);
-                DrawLineBresenhamsAlgorithmThickPatterned(canvas, pxPrev, pyPrev, px, py, sp->lineThickness, linePattern, linePatternLength, patternOffset, sp->color);
-              }else if(aStringsEqual(sp->lineType, sp->lineTypeLength, strparam(L"dotdash"))){
-                linePattern = GetLinePattern3(&linePatternLength);
-                DrawLineBresenhamsAlgorithmThickPatterned(canvas, pxPrev, pyPrev, px, py, sp->lineThickness, linePattern, linePatternLength, patternOffset, sp->color);
-              }else if(aStringsEqual(sp->lineType, sp->lineTypeLength, strparam(L"longdash"))){
-                linePattern = GetLinePattern4(&linePatternLength);
-                DrawLineBresenhamsAlgorithmThickPatterned(canvas, pxPrev, pyPrev, px, py, sp->lineThickness, linePattern, linePatternLength, patternOffset, sp->color);
-              }else if(aStringsEqual(sp->lineType, sp->lineTypeLength, strparam(L"twodash"))){
-                linePattern = GetLinePattern5(&linePatternLength);
-                DrawLineBresenhamsAlgorithmThickPatterned(canvas, pxPrev, pyPrev, px, py, sp->lineThickness, linePattern, linePatternLength, patternOffset, sp->color);
-              }
-            }
-          }
-
-          prevSet = true;
-          xPrev = x;
-          yPrev = y;
-        }
-      }else{
-        for(i = 0.0; i < (double)xsLength; i = i + 1.0){
-          x = xs[(int)(i)];
-          y = ys[(int)(i)];
-
-          if(x > xMin && x < xMax && y > yMin && y < yMax){
-
-            x = floor(MapXCoordinate(x, xMin, xMax, xPixelMin, xPixelMax));
-            y = floor(MapYCoordinate(y, yMin, yMax, yPixelMin, yPixelMax));
-
-            if(aStringsEqual(sp->pointType, sp->pointTypeLength, strparam(L"crosses"))){
-              DrawPixel(canvas, x, y, sp->color);
-              DrawPixel(canvas, x + 1.0, y, sp->color);
-              DrawPixel(canvas, x + 2.0, y, sp->color);
-              DrawPixel(canvas, x - 1.0, y, sp->color);
-              DrawPixel(canvas, x - 2.0, y, sp->color);
-              DrawPixel(canvas, x, y + 1.0, sp->color);
-              DrawPixel(canvas, x, y + 2.0, sp->color);
-              DrawPixel(canvas, x, y - 1.0, sp->color);
-              DrawPixel(canvas, x, y - 2.0, sp->color);
-            }else if(aStringsEqual(sp->pointType, sp->pointTypeLength, strparam(L"circles"))){
-              DrawCircle(canvas, x, y, 3.0, sp->color);
-            }else if(aStringsEqual(sp->pointType, sp->pointTypeLength, strparam(L"dots"))){
-              DrawFilledCircle(canvas, x, y, 3.0, sp->color);
-            }else if(aStringsEqual(sp->pointType, sp->pointTypeLength, strparam(L"triangles"))){
-              DrawTriangle(canvas, x, y, 3.0, sp->color);
-            }else if(aStringsEqual(sp->pointType, sp->pointTypeLength, strparam(L"filled triangles"))){
-              DrawFilledTriangle(canvas, x, y, 3.0, sp->color);
-            }else if(aStringsEqual(sp->pointType, sp->pointTypeLength, strparam(L"pixels"))){
-              DrawPixel(canvas, x, y, sp->color);
-            }else if(aStringsEqual(sp->pointType, sp->pointTypeLength, strparam(L"dotlinetoxaxis"))){
-              DrawFilledCircle(canvas, x, y, 3.0, sp->color);
-              yaxis = floor(MapYCoordinate(0.0, yMin, yMax, yPixelMin, yPixelMax));
-              yaxis = fmin(fmax(yaxis, yPixelMin), yPixelMax);
-              DrawLine(canvas, x, y, x, yaxis, sp->lineThickness, sp->color);
-            }
-          }
-        }
-      }
-    }
+    DrawScatterPlotSeriesLayers(canvas, settings, xMin, xMax, yMin, yMax, xPixelMin, xPixelMax, yPixelMin, yPixelMax, patternOffset);
 
     canvasReference->image = canvas;
   }
 
   return success;
 }
+/* Decimation of long series before rasterization. For lines with nondecreasing x,
+ * "minmax" keeps the first, lowest, highest and last point of every pixel column (M4
+ * aggregation), which reproduces the polyline's footprint at the plot's resolution.
+ * "lttb" keeps two points per pixel column chosen by largest-triangle-three-buckets,
+ * which preserves the shape also for non-monotone x. Opaque point series keep one point
+ * per pixel, since later points on the same pixel draw the same marker again.
+ * "auto" picks minmax for solid lines and the pixel filter for opaque points, and leaves
+ * everything else as is. Series with at most two points per pixel column are never touched. */
+size_t DecimateMinMax(double *xs, double *ys, size_t n, double xMin, double xMax, double xPixelMin, double xPixelMax, double *xsOut, double *ysOut){
+	size_t i, start, lo, hi, m, k, idx[4], t, j;
+	double column;
+
+	m = 0;
+	for(start = 0; start < n; start = i){
+		column = floor(MapXCoordinate(xs[start], xMin, xMax, xPixelMin, xPixelMax));
+		lo = start;
+		hi = start;
+		for(i = start + 1; i < n && floor(MapXCoordinate(xs[i], xMin, xMax, xPixelMin, xPixelMax)) == column; i++){
+			if(ys[i] < ys[lo]){
+				lo = i;
+			}
+			if(ys[i] > ys[hi]){
+				hi = i;
+			}
+		}
+
+		/* First, min, max and last in index order, without duplicates. */
+		idx[0] = start;
+		idx[1] = lo < hi ? lo : hi;
+		idx[2] = lo < hi ? hi : lo;
+		idx[3] = i - 1;
+		for(k = 0; k < 4; k++){
+			t = idx[k];
+			for(j = 0; j < k && idx[j] != t; j++);
+			if(j == k){
+				if(xsOut != NULL){
+					xsOut[m] = xs[t];
+					ysOut[m] = ys[t];
+				}
+				m++;
+			}
+		}
+	}
+
+	return m;
+}
+size_t DecimateLTTB(double *xs, double *ys, size_t n, size_t threshold, double *xsOut, double *ysOut){
+	size_t i, j, a, m, from, to, nextFrom, nextTo, best;
+	double every, avgX, avgY, area, maxArea;
+
+	if(threshold >= n || threshold < 3){
+		memcpy(xsOut, xs, sizeof(double) * n);
+		memcpy(ysOut, ys, sizeof(double) * n);
+		return n;
+	}
+
+	every = (double)(n - 2)/(threshold - 2);
+	a = 0;
+	m = 0;
+	xsOut[m] = xs[0];
+	ysOut[m++] = ys[0];
+
+	for(i = 0; i < threshold - 2; i++){
+		/* Average of the next bucket (the last point for the final bucket). */
+		nextFrom = (size_t)((i + 1)*every) + 1;
+		nextTo = (size_t)((i + 2)*every) + 1;
+		if(nextTo > n){
+			nextTo = n;
+		}
+		avgX = 0.0;
+		avgY = 0.0;
+		for(j = nextFrom; j < nextTo; j++){
+			avgX += xs[j];
+			avgY += ys[j];
+		}
+		if(nextTo > nextFrom){
+			avgX /= nextTo - nextFrom;
+			avgY /= nextTo - nextFrom;
+		}else{
+			avgX = xs[n - 1];
+			avgY = ys[n - 1];
+		}
+
+		/* Point of this bucket spanning the largest triangle with a and the average. */
+		from = (size_t)(i*every) + 1;
+		to = (size_t)((i + 1)*every) + 1;
+		best = from;
+		maxArea = -1.0;
+		for(j = from; j < to; j++){
+			area = fabs((xs[a] - avgX)*(ys[j] - ys[a]) - (xs[a] - xs[j])*(avgY - ys[a]));
+			if(area > maxArea){
+				maxArea = area;
+				best = j;
+			}
+		}
+		xsOut[m] = xs[best];
+		ysOut[m++] = ys[best];
+		a = best;
+	}
+
+	xsOut[m] = xs[n - 1];
+	ysOut[m++] = ys[n - 1];
+
+	return m;
+}
+size_t DecimateScatterPlotSeries(ScatterPlotSeries *sp, double xMin, double xMax, double yMin, double yMax, double xPixelMin, double xPixelMax, double yPixelMin, double yPixelMax, double **xsOut, double **ysOut){
+	size_t n, i, m, columns, w, h, px, py;
+	_Bool monotone, minmax, lttb, pixels;
+	uint8_t *seen;
+	double x, y;
+
+	n = sp->xsLength < sp->ysLength ? sp->xsLength : sp->ysLength;
+	columns = fabs(xPixelMax - xPixelMin) + 1;
+	if(n <= 2*columns){
+		return 0;
+	}
+
+	monotone = true;
+	for(i = 1; i < n && monotone; i++){
+		monotone = sp->xs[i] >= sp->xs[i - 1];
+	}
+
+	minmax = false;
+	lttb = false;
+	pixels = false;
+	if(aStringsEqual(sp->decimation, sp->decimationLength, strparam(L"auto"))){
+		minmax = sp->linearInterpolation && monotone && aStringsEqual(sp->lineType, sp->lineTypeLength, strparam(L"solid"));
+		pixels = !sp->linearInterpolation && sp->color->a == 1.0;
+	}else if(aStringsEqual(sp->decimation, sp->decimationLength, strparam(L"minmax"))){
+		minmax = sp->linearInterpolation && monotone;
+	}else if(aStringsEqual(sp->decimation, sp->decimationLength, strparam(L"lttb"))){
+		lttb = true;
+	}
+
+	m = 0;
+	if(minmax){
+		m = DecimateMinMax(sp->xs, sp->ys, n, xMin, xMax, xPixelMin, xPixelMax, NULL, NULL);
+		if(m < n){
+			*xsOut = (double*)Allocate(sizeof(double) * m, 1);
+			*ysOut = (double*)Allocate(sizeof(double) * m, 1);
+			DecimateMinMax(sp->xs, sp->ys, n, xMin, xMax, xPixelMin, xPixelMax, *xsOut, *ysOut);
+		}else{
+			m = 0;
+		}
+	}else if(lttb){
+		*xsOut = (double*)Allocate(sizeof(double) * 2*columns, 1);
+		*ysOut = (double*)Allocate(sizeof(double) * 2*columns, 1);
+		m = DecimateLTTB(sp->xs, sp->ys, n, 2*columns, *xsOut, *ysOut);
+	}else if(pixels){
+		/* Same inside test and pixel mapping as the point drawing loop. */
+		w = xPixelMax + 1;
+		h = yPixelMax + 1;
+		*xsOut = (double*)Allocate(sizeof(double) * n, 1);
+		*ysOut = (double*)Allocate(sizeof(double) * n, 1);
+		seen = (uint8_t*)Allocate(w*h, 1);
+		memset(seen, 0, w*h);
+		for(i = 0; i < n; i++){
+			x = sp->xs[i];
+			y = sp->ys[i];
+			if(x > xMin && x < xMax && y > yMin && y < yMax){
+				px = floor(MapXCoordinate(x, xMin, xMax, xPixelMin, xPixelMax));
+				py = floor(MapYCoordinate(y, yMin, yMax, yPixelMin, yPixelMax));
+				if(px < w && py < h && !seen[py*w + px]){
+					seen[py*w + px] = 1;
+					(*xsOut)[m] = x;
+					(*ysOut)[m++] = y;
+				}
+			}
+		}
+		Free(seen);
+		if(m == 0){
+			Free(*ysOut);
+			Free(*xsOut);
+		}
+	}
+
+	return m;
+}
 void ComputeBoundariesBasedOnSettings(ScatterPlotSettings *settings, Rectangle *boundaries){
   ScatterPlotSeries *sp;
   double plot, xMin, xMax, yMin, yMax;
@@ -2388,20 +2917,53 @@ RGBA *CreateRGBAColor(double r, double g, double b, double a){
 }
 RGBABitmapImage *CreateImage(double w, double h, RGBA *color){
   RGBABitmapImage *image;
-  double i, j;
 
   image = (RGBABitmapImage *)Allocate(sizeof(RGBABitmapImage), 1);
   image->pixels = (uint32_t*)Allocate(sizeof(uint32_t) * w * h, 1);
   image->xLength = w;
   image->yLength = h;
-  for(i = 0.0; i < w; i = i + 1.0){
-    for(j = 0.0; j < h; j = j + 1.0){
-      SetPixel(image, i, j, color);
-    }
-  }
+  FillImagePacked(image, PackRGBA(color));
 
   return image;
 }
+void FillImagePacked(RGBABitmapImage *image, uint32_t color){
+	size_t y, w, h;
+	uint32_t *row;
+
+	w = image->xLength;
+	h = image->yLength;
+
+	/* All four bytes equal (white, black, transparent): a single memset. */
+	if((color >> 8) == (color & 0xFFFFFF)){
+		memset(image->pixels, color & 0xFF, sizeof(uint32_t) * w * h);
+	}else if(w > 0 && h > 0){
+		FillRectanglePacked(image, 0, 0, w, 1, color);
+		row = ImageRow(image, 0);
+		for(y = 1; y < h; y++){
+			memcpy(ImageRow(image, y), row, sizeof(uint32_t) * w);
+		}
+	}
+}
+void FillRectanglePacked(RGBABitmapImage *image, int64_t x, int64_t y, int64_t w, int64_t h, uint32_t color){
+	int64_t x0, y0, x1, y1, i, j;
+	uint32_t *row;
+
+	/* Clip to the image. */
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	x1 = x + w > (int64_t)image->xLength ? (int64_t)image->xLength : x + w;
+	y1 = y + h > (int64_t)image->yLength ? (int64_t)image->yLength : y + h;
+
+	for(j = y0; j < y1; j++){
+		row = ImageRow(image, j);
+		for(i = x0; i < x1; i++){
+			row[i] = color;
+		}
+	}
+}
+void ClearImage(RGBABitmapImage *image, RGBA *color){
+	FillImagePacked(image, PackRGBA(color));
+}
 void DeleteImage(RGBABitmapImage *image){
   Free(image->pixels);
   Free(image);
@@ -2422,13 +2984,7 @@ double ImageHeight(RGBABitmapImage *image){
 }
 void SetPixel(RGBABitmapImage *image, double x, double y, RGBA *color){
   if(x >= 0.0 && x < ImageWidth(image) && y >= 0.0 && y < ImageHeight(image)){
-    int pixel = x + y * ImageWidth(image);
-    int r = Round(color->r * 255);
-    int g = Round(color->g * 255);
-    int b = Round(color->b * 255);
-    int a = Round(color->a * 255);
-
-    image->pixels[pixel] = (r << 24) | (g << 16) | (b << 8) | a;
+    SetPixelPacked(image, x, y, PackRGBA(color));
   }
 }
 void DrawPixel(RGBABitmapImage *image, double x, double y, RGBA *color){
@@ -2494,12 +3050,19 @@ void DrawRectangle1px(RGBABitmapImage *image, double x, double y, double width,
 }
 void DrawImageOnImage(RGBABitmapImage *dst, RGBABitmapImage *src, double topx, double topy){
   double y, x;
+  uint32_t p;
 
   for(y = 0.0; y < ImageHeight(src); y = y + 1.0){
     for(x = 0.0; x < ImageWidth(src); x = x + 1.0){
       if(topx + x >= 0.0 && topx + x < ImageWidth(dst) && topy + y >= 0.0 && topy + y < ImageHeight(dst)){
-				RGBA o = GetImagePixelStruct(src, x, y);
-        DrawPixel(dst, topx + x, topy + y, &o);
+        /* Opaque pixels replace, transparent ones leave dst as it is. */
+        p = GetPixelPacked(src, x, y);
+        if((p & 0xFF) == 0xFF){
+          SetPixelPacked(dst, topx + x, topy + y, p);
+        }else if((p & 0xFF) != 0){
+          RGBA o = UnpackRGBA(p);
+          DrawPixel(dst, topx + x, topy + y, &o);
+        }
       }
     }
   }
@@ -2660,96 +3223,56 @@ void CubicBezierPoint(double x0, double y0, double c0x, double c0y, double c1x,
 }
 RGBABitmapImage *CopyImage(RGBABitmapImage *image){
   RGBABitmapImage *copy;
-  double i, j;
 
-  copy = CreateImage(ImageWidth(image), ImageHeight(image), GetTransparent());
+  copy = (RGBABitmapImage *)Allocate(sizeof(RGBABitmapImage), 1);
+  copy->pixels = (uint32_t*)Allocate(sizeof(uint32_t) * image->xLength * image->yLength, 1);
+  copy->xLength = image->xLength;
+  copy->yLength = image->yLength;
 
-  memcpy(copy->pixels, image->pixels, image->xLength * image->yLength);
+  memcpy(copy->pixels, image->pixels, sizeof(uint32_t) * image->xLength * image->yLength);
 
   return copy;
 }
 RGBA* GetImagePixel(RGBABitmapImage *image, double x, double y){
 	RGBA *rgba;
-	int pixel;
-	uint32_t color;
 
 	rgba = (RGBA *)Allocate(sizeof(RGBA), 1);
-
-	pixel = x + y * ImageWidth(image);
-
-	color	= image->pixels[pixel];
-
-	rgba->r = ((color >> 24) & 0xFF) / 255.0;
-	rgba->g = ((color >> 16) & 0xFF) / 255.0;
-	rgba->b = ((color >> 8) & 0xFF) / 255.0;
-	rgba->a = ((color >> 0) & 0xFF) / 255.0;
+	*rgba = UnpackRGBA(GetPixelPacked(image, x, y));
 
   return rgba;
 }
 RGBA GetImagePixelStruct(RGBABitmapImage *image, double x, double y){
-	RGBA rgba;
-	int pixel;
-	uint32_t color;
-
-	pixel = x + y * ImageWidth(image);
-
-	color	= image->pixels[pixel];
-
-	rgba.r = ((color >> 24) & 0xFF) / 255.0;
-	rgba.g = ((color >> 16) & 0xFF) / 255.0;
-	rgba.b = ((color >> 8) & 0xFF) / 255.0;
-	rgba.a = ((color >> 0) & 0xFF) / 255.0;
-
-  return rgba;
+  return UnpackRGBA(GetPixelPacked(image, x, y));
 }
 void HorizontalFlip(RGBABitmapImage *img){
-  double y, x;
-  double tmp;
-  RGBA c1, c2;
-
-  for(y = 0.0; y < ImageHeight(img); y = y + 1.0){
-    for(x = 0.0; x < ImageWidth(img)/2.0; x = x + 1.0){
-      c1 = GetImagePixelStruct(img, x, y);
-      c2 = GetImagePixelStruct(img, ImageWidth(img) - 1.0 - x, y);
-
-      tmp = c1.a;
-      c1.a = c2.a;
-      c2.a = tmp;
-
-      tmp = c1.r;
-      c1.r = c2.r;
-      c2.r = tmp;
-
-      tmp = c1.g;
-      c1.g = c2.g;
-      c2.g = tmp;
-
-      tmp = c1.b;
-      c1.b = c2.b;
-      c2.b = tmp;
-    }
-  }
+	size_t y, x, w;
+	uint32_t *row, tmp;
+
+	w = img->xLength;
+	for(y = 0; y < img->yLength; y++){
+		row = ImageRow(img, y);
+		for(x = 0; x < w/2; x++){
+			tmp = row[x];
+			row[x] = row[w - 1 - x];
+			row[w - 1 - x] = tmp;
+		}
+	}
 }
 void DrawFilledRectangle(RGBABitmapImage *image, double x, double y, double w, double h, RGBA *color){
-  double i, j;
-
-  for(i = 0.0; i < w; i = i + 1.0){
-    for(j = 0.0; j < h; j = j + 1.0){
-      SetPixel(image, x + i, y + j, color);
-    }
-  }
+	FillRectanglePacked(image, floor(x), floor(y), ceil(w), ceil(h), PackRGBA(color));
 }
 RGBABitmapImage *RotateAntiClockwise90Degrees(RGBABitmapImage *image){
   RGBABitmapImage *rotated;
-  double x, y;
+  size_t x, y, w;
 
   rotated = CreateImage(ImageHeight(image), ImageWidth(image), GetBlack());
 
-  for(y = 0.0; y < ImageHeight(image); y = y + 1.0){
-    for(x = 0.0; x < ImageWidth(image); x = x + 1.0){
-      SetPixel(rotated, y, ImageWidth(image) - 1.0 - x, GetImagePixel(image, x, y));
-    }
-  }
+  w = image->xLength;
+	for(y = 0; y < image->yLength; y++){
+		for(x = 0; x < w; x++){
+			SetPixelPacked(rotated, y, w - 1 - x, GetPixelPacked(image, x, y));
+		}
+	}
 
   return rotated;
 }
@@ -3187,87 +3710,265 @@ _Bool *GetLinePattern1(size_t *returnArrayLength){
   *returnArrayLength = patternLength;
   return pattern;
 }
-/*RGBABitmapImage *Blur(RGBABitmapImage *src, double pixels){
-  RGBABitmapImage *dst;
-  double x, y, w, h;
+/* Box blur with running sums. As before, the colour of an output pixel is the average
+ * colour of the non-transparent pixels in the (2r+1)x(2r+1) window clipped to the image,
+ * and the alpha is the average alpha of the window. The window sums are separable: each
+ * row is summed horizontally with a sliding window, and a band of rows keeps per-column
+ * accumulators that add the row entering the window and subtract the one leaving it.
+ * The cost per pixel is independent of the radius. Bands are blurred in parallel. */
+#define BLUR_BAND_ROWS 64
+
+static int blurThreads = 0;
+
+typedef struct BlurJob{
+	RGBABitmapImage *src;
+	RGBABitmapImage *dst;
+	size_t radius;
+	size_t bandRows;
+	size_t bands;
+	size_t next;
+	_Bool failed;
+#ifdef THREAD_SAFE_PTHREADS
+	pthread_mutex_t lock;
+#endif
+} BlurJob;
+
+/* Window sums of one row into five planes of length w: r, g and b of the coloured
+ * pixels, the number of coloured pixels and the alpha. */
+static void BlurRowSums(const uint32_t *row, size_t w, size_t r, uint32_t *sums){
+	uint32_t t[5], p;
+	size_t x, i;
+
+	memset(t, 0, sizeof(t));
+	for(i = 0; i <= r && i < w; i++){
+		p = row[i];
+		if(p & 0xFF){
+			t[0] += p >> 24;
+			t[1] += (p >> 16) & 0xFF;
+			t[2] += (p >> 8) & 0xFF;
+			t[3]++;
+		}
+		t[4] += p & 0xFF;
+	}
+	for(x = 0; x < w; x++){
+		sums[x] = t[0];
+		sums[w + x] = t[1];
+		sums[2*w + x] = t[2];
+		sums[3*w + x] = t[3];
+		sums[4*w + x] = t[4];
+		if(x + r + 1 < w){
+			p = row[x + r + 1];
+			if(p & 0xFF){
+				t[0] += p >> 24;
+				t[1] += (p >> 16) & 0xFF;
+				t[2] += (p >> 8) & 0xFF;
+				t[3]++;
+			}
+			t[4] += p & 0xFF;
+		}
+		if(x >= r){
+			p = row[x - r];
+			if(p & 0xFF){
+				t[0] -= p >> 24;
+				t[1] -= (p >> 16) & 0xFF;
+				t[2] -= (p >> 8) & 0xFF;
+				t[3]--;
+			}
+			t[4] -= p & 0xFF;
+		}
+	}
+}
 
-  w = ImageWidth(src);
-  h = ImageHeight(src);
-  dst = CreateImage(w, h, GetTransparent());
+/* Plain loops over the planes, which the compiler vectorizes. */
+static void BlurAccumulate(uint64_t *acc, const uint32_t *sums, size_t n){
+	size_t i;
 
-  for(x = 0.0; x < w; x = x + 1.0){
-    for(y = 0.0; y < h; y = y + 1.0){
-      SetPixel(dst, x, y, CreateBlurForPoint(src, x, y, pixels));
-    }
-  }
+	for(i = 0; i < n; i++){
+		acc[i] += sums[i];
+	}
+}
+static void BlurDeaccumulate(uint64_t *acc, const uint32_t *sums, size_t n){
+	size_t i;
 
-  return dst;
+	for(i = 0; i < n; i++){
+		acc[i] -= sums[i];
+	}
 }
-RGBA *CreateBlurForPoint(RGBABitmapImage *src, double x, double y, double pixels){
-  RGBA *rgba;
-  double i, j, countColor, countTransparent;
-  double fromx, tox, fromy, toy;
-  double w, h;
-  double alpha;
-
-  w = (double)src->xLength;
-  h = (double)src->x[0]->yLength;
-
-  rgba = (RGBA *)Allocate(sizeof(RGBA), 1);
-  rgba->r = 0.0;
-  rgba->g = 0.0;
-  rgba->b = 0.0;
-  rgba->a = 0.0;
-
-  fromx = x - pixels;
-  fromx = fmax(fromx, 0.0);
-
-  tox = x + pixels;
-  tox = fmin(tox, w - 1.0);
-
-  fromy = y - pixels;
-  fromy = fmax(fromy, 0.0);
-
-  toy = y + pixels;
-  toy = fmin(toy, h - 1.0);
-
-  countColor = 0.0;
-  countTransparent = 0.0;
-  for(i = fromx; i < tox; i = i + 1.0){
-    for(j = fromy; j < toy; j = j + 1.0){
-      alpha = src->x[(int)(i)]->y[(int)(j)]->a;
-      if(alpha > 0.0){
-        rgba->r = rgba->r + src->x[(int)(i)]->y[(int)(j)]->r;
-        rgba->g = rgba->g + src->x[(int)(i)]->y[(int)(j)]->g;
-        rgba->b = rgba->b + src->x[(int)(i)]->y[(int)(j)]->b;
-        countColor = countColor + 1.0;
-      }
-      rgba->a = rgba->a + alpha;
-      countTransparent = countTransparent + 1.0;
-    }
-  }
 
-  if(countColor > 0.0){
-    rgba->r = rgba->r/countColor;
-    rgba->g = rgba->g/countColor;
-    rgba->b = rgba->b/countColor;
-  }else{
-    rgba->r = 0.0;
-    rgba->g = 0.0;
-    rgba->b = 0.0;
-  }
+static void BlurBand(BlurJob *job, size_t y0, size_t y1, uint64_t *acc, uint32_t *sums){
+	size_t w, h, r, x, y, yy, rows, columns, count, colored;
+	uint32_t *out;
 
-  if(countTransparent > 0.0){
-    rgba->a = rgba->a/countTransparent;
-  }else{
-    rgba->a = 0.0;
-  }
+	w = job->src->xLength;
+	h = job->src->yLength;
+	r = job->radius;
 
-  return rgba;
-}*/
-wchar_t *CreateStringScientificNotationDecimalFromNumber(size_t *returnArrayLength, double decimal){
-  StringReference *mantissaReference, *exponentReference;
-  double multiplier, inc;
+	memset(acc, 0, sizeof(uint64_t) * 5 * w);
+	for(yy = y0 > r ? y0 - r : 0; yy <= y0 + r && yy < h; yy++){
+		BlurRowSums(ImageRow(job->src, yy), w, r, sums);
+		BlurAccumulate(acc, sums, 5*w);
+	}
+
+	for(y = y0; y < y1; y++){
+		rows = (y + r < h ? y + r : h - 1) - (y > r ? y - r : 0) + 1;
+		out = ImageRow(job->dst, y);
+		for(x = 0; x < w; x++){
+			columns = (x + r < w ? x + r : w - 1) - (x > r ? x - r : 0) + 1;
+			count = rows*columns;
+			colored = acc[3*w + x];
+			if(colored > 0){
+				out[x] = (uint32_t)((acc[x] + colored/2)/colored) << 24
+				       | (uint32_t)((acc[w + x] + colored/2)/colored) << 16
+				       | (uint32_t)((acc[2*w + x] + colored/2)/colored) << 8;
+			}else{
+				out[x] = 0;
+			}
+			out[x] |= (uint32_t)((acc[4*w + x] + count/2)/count);
+		}
+
+		if(y + 1 < y1){
+			if(y + r + 1 < h){
+				BlurRowSums(ImageRow(job->src, y + r + 1), w, r, sums);
+				BlurAccumulate(acc, sums, 5*w);
+			}
+			if(y >= r){
+				BlurRowSums(ImageRow(job->src, y - r), w, r, sums);
+				BlurDeaccumulate(acc, sums, 5*w);
+			}
+		}
+	}
+}
+
+static void *BlurWorker(void *arg){
+	BlurJob *job;
+	uint64_t *acc;
+	uint32_t *sums;
+	size_t band, y0, y1, w;
+
+	job = (BlurJob*)arg;
+	w = job->src->xLength;
+	acc = malloc(sizeof(uint64_t) * 5 * w);
+	sums = malloc(sizeof(uint32_t) * 5 * w);
+	if(acc == NULL || sums == NULL){
+		free(acc);
+		free(sums);
+		job->failed = true;
+		return NULL;
+	}
+	for(;;){
+#ifdef THREAD_SAFE_PTHREADS
+		pthread_mutex_lock(&job->lock);
+#endif
+		band = job->next++;
+#ifdef THREAD_SAFE_PTHREADS
+		pthread_mutex_unlock(&job->lock);
+#endif
+		if(band >= job->bands){
+			break;
+		}
+		y0 = band*job->bandRows;
+		y1 = y0 + job->bandRows < job->src->yLength ? y0 + job->bandRows : job->src->yLength;
+		BlurBand(job, y0, y1, acc, sums);
+	}
+	free(acc);
+	free(sums);
+	return NULL;
+}
+
+/* Sets the number of threads used by Blur and BlurGaussian; 0 means one per CPU. */
+void SetBlurThreads(double threads){
+	blurThreads = threads;
+}
+
+/* Blurs src with a box of radius floor(pixels) into a new image. Returns NULL if the
+ * scratch buffers cannot be allocated. */
+RGBABitmapImage *Blur(RGBABitmapImage *src, double pixels){
+	RGBABitmapImage *dst;
+	BlurJob job;
+	int threads, t;
+
+	dst = CreateImage(ImageWidth(src), ImageHeight(src), GetTransparent());
+	if(src->xLength == 0 || src->yLength == 0){
+		return dst;
+	}
+
+	job.src = src;
+	job.dst = dst;
+	job.radius = pixels > 0.0 ? (size_t)fmin(pixels, src->xLength + src->yLength) : 0;
+	/* Each band first sums the 2r+1 rows around its top row; tall bands keep that small. */
+	job.bandRows = 4*(2*job.radius + 1) > BLUR_BAND_ROWS ? 4*(2*job.radius + 1) : BLUR_BAND_ROWS;
+	job.bands = (src->yLength + job.bandRows - 1)/job.bandRows;
+	job.next = 0;
+	job.failed = false;
+
+	threads = 1;
+#ifdef THREAD_SAFE_PTHREADS
+	threads = blurThreads > 0 ? blurThreads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if(threads > 1 && job.bands > 1){
+#ifdef THREAD_SAFE_PTHREADS
+		pthread_t workers[64];
+
+		if(threads > 64){
+			threads = 64;
+		}
+		if((size_t)threads > job.bands){
+			threads = job.bands;
+		}
+		pthread_mutex_init(&job.lock, NULL);
+		for(t = 1; t < threads; t++){
+			if(pthread_create(&workers[t], NULL, BlurWorker, &job) != 0){
+				break;
+			}
+		}
+		threads = t;
+		BlurWorker(&job);
+		for(t = 1; t < threads; t++){
+			pthread_join(workers[t], NULL);
+		}
+		pthread_mutex_destroy(&job.lock);
+#endif
+	}else{
+		(void)t;
+		BlurWorker(&job);
+	}
+
+	if(job.failed){
+		DeleteImage(dst);
+		dst = NULL;
+	}
+
+	return dst;
+}
+
+/* Approximates a Gaussian blur with standard deviation sigma by three box blurs whose
+ * widths are chosen so that the variances add up to sigma^2. */
+RGBABitmapImage *BlurGaussian(RGBABitmapImage *src, double sigma){
+	RGBABitmapImage *a, *b;
+	double wIdeal, wl, m;
+	int i;
+
+	wIdeal = sqrt(12.0*sigma*sigma/3.0 + 1.0);
+	wl = floor(wIdeal);
+	if(fmod(wl, 2.0) == 0.0){
+		wl = wl - 1.0;
+	}
+	m = floor((12.0*sigma*sigma - 3.0*wl*wl - 12.0*wl - 9.0)/(-4.0*wl - 4.0) + 0.5);
+
+	a = src;
+	for(i = 0; i < 3 && a != NULL; i++){
+		b = Blur(a, ((i < m ? wl : wl + 2.0) - 1.0)/2.0);
+		if(a != src){
+			DeleteImage(a);
+		}
+		a = b;
+	}
+
+	return a;
+}
+wchar_t *CreateStringScientificNotationDecimalFromNumber(size_t *returnArrayLength, double decimal){
+  StringReference *mantissaReference, *exponentReference;
+  double multiplier, inc;
   double exponent;
   _Bool done, isPositive;
   wchar_t *result;
@@ -3346,6 +4047,65 @@ wchar_t *CreateStringDecimalFromNumber(size_t *returnArrayLength, double decimal
   *returnArrayLength = stringReference->stringLength;
   return stringReference->string;
 }
+/* Base 10 formatting of CreateStringFromNumberWithCheck with integer digit extraction
+ * into a stack buffer. The digits are those of the generic loop: the number is scaled to
+ * a 15 digit integer the same way, and the digits are then peeled off exactly. Returns 0
+ * for numbers so small that the scaling overflows; those take the generic loop. */
+static size_t FormatDecimal(double decimal, wchar_t *buffer){
+	uint64_t n, p, d;
+	double digitPosition, scaled;
+	_Bool hasPrintedPoint;
+	size_t length;
+	int i, k;
+
+	length = 0;
+	if(decimal < 0.0){
+		buffer[length++] = '-';
+		decimal = -decimal;
+	}
+
+	digitPosition = GetFirstDigitPosition(decimal, 10.0);
+	scaled = round(decimal*pow(10.0, 15.0 - digitPosition - 1.0));
+	if(!(scaled <= 1e15)){
+		return 0;
+	}
+	n = scaled;
+	hasPrintedPoint = false;
+
+	if(digitPosition < 0.0){
+		buffer[length++] = '0';
+		buffer[length++] = '.';
+		hasPrintedPoint = true;
+		for(k = 0; k < -digitPosition - 1.0; k++){
+			buffer[length++] = '0';
+		}
+	}
+
+	p = 100000000000000ULL;
+	for(i = 0; i < 15; i++){
+		d = n/p;
+		if(d > 9){
+			d = 9;
+		}
+		if(!hasPrintedPoint && digitPosition - i + 1.0 == 0.0){
+			if(n != 0){
+				buffer[length++] = '.';
+			}
+			hasPrintedPoint = true;
+		}
+		if(n != 0 || !hasPrintedPoint){
+			buffer[length++] = '0' + d;
+		}
+		n = n - d*p;
+		p = p/10;
+	}
+
+	for(k = 0; k < digitPosition - 15.0 + 1.0; k++){
+		buffer[length++] = '0';
+	}
+
+	return length;
+}
 _Bool CreateStringFromNumberWithCheck(double decimal, double base, StringReference *stringReference){
   DynamicArrayCharacters *string;
   double maximumDigits;
@@ -3355,6 +4115,19 @@ _Bool CreateStringFromNumberWithCheck(double decimal, double base, StringReferen
   _Bool success;
   CharacterReference *characterReference;
   wchar_t c;
+  wchar_t buffer[400];
+  size_t length;
+
+  length = 0;
+  if(base == 10.0 && decimal != 0.0 && isfinite(decimal)){
+    length = FormatDecimal(decimal, buffer);
+  }
+  if(length > 0){
+    stringReference->string = (wchar_t*)Allocate(sizeof(wchar_t) * length, 1);
+    stringReference->stringLength = length;
+    memcpy(stringReference->string, buffer, sizeof(wchar_t) * length);
+    return true;
+  }
 
   string = CreateDynamicArrayCharacters();
   isPositive = true;
@@ -4894,26 +5667,86 @@ wchar_t *GetPixelFontData(size_t *returnArrayLength){
   *returnArrayLength = wcslen(L"00000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000011000000110000000000000000000000110000001100000011000000110000001100000011000000110000000000000000000000000000000000000000000000000000000000000000000000000000110110001101100011011000110110000000000000000000000000001100110011001101111111101100110011001101111111101100110011001100000000000000000000000000000000000011000011111101111111111011000111110000111111000011111000110111111111101111110000110000000000000000000011100001101100011011011011101100000110000011000001100000110111011011011000110110000111000000000000000001111111001100011111100110001101100001110000011100001101100110011001100110011011000011100000000000000000000000000000000000000000000000000000000000000000000000000000110000011100000110000011100000000000000000000001100000001100000001100000011000000110000001100000011000000110000001100000110000011000000000000000000000000110000011000001100000011000000110000001100000011000000110000001100000001100000001100000000000000000000000000000000001001100101011010001111001111111100111100010110101001100100000000000000000000000000000000000000000001100000011000000110001111111111111111000110000001100000011000000000000000000000000000000000000000110000011000001110000011100000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000111111111111111100000000000000000000000000000000000000000000000000000000000000000001110000011100000000000000000000000000000000000000000000000000000000000000000000000000000001100000011000001100000011000001100000011000001100000011000001100000011000001100000011000000000000000000000000111100011001101100001111000111110011111101101111110011111000111100001101100110001111000000000000000000011111100001100000011000000110000001100000011000000110000001100000011110000111000001100000000000000000001111111100000011000000110000011000001100000110000011000001100000110000001110011101111110000000000000000001111110111001111100000011000000111000000111111011100000110000001100000011100111011111100000000000000000001100000011000000110000001100000011000011111111001100110011011000111100001110000011000000000000000000000111111011100111110000001100000011100000011111110000001100000011000000110000001111111111000000000000000001111110111001111100001111000011111000110111111100000011000000110000001111100111011111100000000000000000000011000000110000001100000011000001100000110000011000001100000011000000110000001111111100000000000000000111111011100111110000111100001111100111011111101110011111000011110000111110011101111110000000000000000001111110111001111100000011000000110000001111111011100111110000111100001111100111011111100000000000000000000000000001110000011100000000000000000000011100000111000000000000000000000000000000000000000000000000000000110000011000001110000011100000000000000000000011100000111000000000000000000000000000000000000000000001100000001100000001100000001100000001100000001100000110000011000001100000110000011000000000000000000000000000000000000011111111111111110000000011111111111111110000000000000000000000000000000000000000000000000000011000001100000110000011000001100000110000000110000000110000000110000000110000000110000000000000000000011000000000000000000000011000000110000011000001100000110000001100001111000011011111100000000000000000111111000000011011110011110110111100101110111011110000110111111000000000000000000000000000000000000000001100001111000011110000111100001111111111110000111100001111000011011001100011110000011000000000000000000001111111111000111100001111000011111000110111111111100011110000111100001111100011011111110000000000000000011111101110011100000011000000110000001100000011000000110000001100000011111001110111111000000000000000000011111101110011111000111100001111000011110000111100001111000011111000110111001100111111000000000000000011111111000000110000001100000011000000110011111100000011000000110000001100000011111111110000000000000000000000110000001100000011000000110000001100000011001111110000001100000011000000111111111100000000000000000111111011100111110000111100001111110011000000110000001100000011000000111110011101111110000000000000000011000011110000111100001111000011110000111111111111000011110000111100001111000011110000110000000000000000011111100001100000011000000110000001100000011000000110000001100000011000000110000111111000000000000000000011111001110111011000110110000001100000011000000110000001100000011000000110000001100000000000000000000011000011011000110011001100011011000011110000011100001111000110110011001101100011110000110000000000000000111111110000001100000011000000110000001100000011000000110000001100000011000000110000001100000000000000001100001111000011110000111100001111000011110000111101101111111111111111111110011111000011000000000000000011100011111000111111001111110011111110111101101111011111110011111100111111000111110001110000000000000000011111101110011111000011110000111100001111000011110000111100001111000011111001110111111000000000000000000000001100000011000000110000001100000011011111111110001111000011110000111110001101111111000000000000000011111100011101101111101111011011110000111100001111000011110000111100001101100110001111000000000000000000110000110110001100110011000110110000111101111111111000111100001111000011111000110111111100000000000000000111111011100111110000001100000011100000011111100000011100000011000000111110011101111110000000000000000000011000000110000001100000011000000110000001100000011000000110000001100000011000111111110000000000000000011111101110011111000011110000111100001111000011110000111100001111000011110000111100001100000000000000000001100000111100001111000110011001100110110000111100001111000011110000111100001111000011000000000000000011000011111001111111111111111111110110111101101111000011110000111100001111000011110000110000000000000000110000110110011001100110001111000011110000011000001111000011110001100110011001101100001100000000000000000001100000011000000110000001100000011000000110000011110000111100011001100110011011000011000000000000000011111111000000110000001100000110000011000111111000110000011000001100000011000000111111110000000000000000001111000000110000001100000011000000110000001100000011000000110000001100000011000011110000000000110000001100000001100000011000000011000000110000000110000001100000001100000011000000011000000110000000000000000000111100001100000011000000110000001100000011000000110000001100000011000000110000001111000000000000000000000000000000000000000000000000000000000000000000000000001100001101100110001111000001100011111111111111110000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000110000001110000001100000011100000000000000000111111101100001111000011111111101100000011000011011111100000000000000000000000000000000000000000000000000111111111000011110000111100001111000011011111110000001100000011000000110000001100000011000000000000000001111110110000110000001100000011000000111100001101111110000000000000000000000000000000000000000000000000111111101100001111000011110000111100001111111110110000001100000011000000110000001100000000000000000000001111111000000011000000110111111111000011110000110111111000000000000000000000000000000000000000000000000000001100000011000000110000001100000011000011111100001100000011000000110011001100011110000111111011000011110000001100000011111110110000111100001111000011011111100000000000000000000000000000000000000000000000001100001111000011110000111100001111000011110000110111111100000011000000110000001100000011000000000000000000011000000110000001100000011000000110000001100000011000000000000000000000011000000000000001110000110110001100000011000000110000001100000011000000110000001100000000000000000000001100000000000000000000000000000110001100110011000111110000111100011011001100110110001100000011000000110000001100000011000000000000000001111110000110000001100000011000000110000001100000011000000110000001100000011000000111100000000000000000110110111101101111011011110110111101101111011011011111110000000000000000000000000000000000000000000000000110001101100011011000110110001101100011011000110011111100000000000000000000000000000000000000000000000000111110011000110110001101100011011000110110001100111110000000000000000000000000000000000000001100000011000000110111111111000011110000111100001111000011011111110000000000000000000000000000000011000000110000001100000011111110110000111100001111000011110000111111111000000000000000000000000000000000000000000000000000000011000000110000001100000011000000110000011101111111000000000000000000000000000000000000000000000000011111111100000011000000011111100000001100000011111111100000000000000000000000000000000000000000000000000011100001101100000011000000110000001100000011000011111100001100000011000000110000000000000000000000000001111110011000110110001101100011011000110110001101100011000000000000000000000000000000000000000000000000000110000011110000111100011001100110011011000011110000110000000000000000000000000000000000000000000000001100001111100111111111111101101111000011110000111100001100000000000000000000000000000000000000000000000011000011011001100011110000011000001111000110011011000011000000000000000000000000000000000000001100000110000001100000110000011000001111000110011001100110110000110000000000000000000000000000000000000000000000001111111100000110000011000001100000110000011000001111111100000000000000000000000000000000000000000000000011110000000110000001100000011000000111000000111100011100000110000001100000011000111100000001100000011000000110000001100000011000000110000001100000011000000110000001100000011000000110000001100000000000000000000000111100011000000110000001100000111000111100000011100000011000000110000001100000001111");
   return L"00000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000011000000110000000000000000000000110000001100000011000000110000001100000011000000110000000000000000000000000000000000000000000000000000000000000000000000000000110110001101100011011000110110000000000000000000000000001100110011001101111111101100110011001101111111101100110011001100000000000000000000000000000000000011000011111101111111111011000111110000111111000011111000110111111111101111110000110000000000000000000011100001101100011011011011101100000110000011000001100000110111011011011000110110000111000000000000000001111111001100011111100110001101100001110000011100001101100110011001100110011011000011100000000000000000000000000000000000000000000000000000000000000000000000000000110000011100000110000011100000000000000000000001100000001100000001100000011000000110000001100000011000000110000001100000110000011000000000000000000000000110000011000001100000011000000110000001100000011000000110000001100000001100000001100000000000000000000000000000000001001100101011010001111001111111100111100010110101001100100000000000000000000000000000000000000000001100000011000000110001111111111111111000110000001100000011000000000000000000000000000000000000000110000011000001110000011100000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000111111111111111100000000000000000000000000000000000000000000000000000000000000000001110000011100000000000000000000000000000000000000000000000000000000000000000000000000000001100000011000001100000011000001100000011000001100000011000001100000011000001100000011000000000000000000000000111100011001101100001111000111110011111101101111110011111000111100001101100110001111000000000000000000011111100001100000011000000110000001100000011000000110000001100000011110000111000001100000000000000000001111111100000011000000110000011000001100000110000011000001100000110000001110011101111110000000000000000001111110111001111100000011000000111000000111111011100000110000001100000011100111011111100000000000000000001100000011000000110000001100000011000011111111001100110011011000111100001110000011000000000000000000000111111011100111110000001100000011100000011111110000001100000011000000110000001111111111000000000000000001111110111001111100001111000011111000110111111100000011000000110000001111100111011111100000000000000000000011000000110000001100000011000001100000110000011000001100000011000000110000001111111100000000000000000111111011100111110000111100001111100111011111101110011111000011110000111110011101111110000000000000000001111110111001111100000011000000110000001111111011100111110000111100001111100111011111100000000000000000000000000001110000011100000000000000000000011100000111000000000000000000000000000000000000000000000000000000110000011000001110000011100000000000000000000011100000111000000000000000000000000000000000000000000001100000001100000001100000001100000001100000001100000110000011000001100000110000011000000000000000000000000000000000000011111111111111110000000011111111111111110000000000000000000000000000000000000000000000000000011000001100000110000011000001100000110000000110000000110000000110000000110000000110000000000000000000011000000000000000000000011000000110000011000001100000110000001100001111000011011111100000000000000000111111000000011011110011110110111100101110111011110000110111111000000000000000000000000000000000000000001100001111000011110000111100001111111111110000111100001111000011011001100011110000011000000000000000000001111111111000111100001111000011111000110111111111100011110000111100001111100011011111110000000000000000011111101110011100000011000000110000001100000011000000110000001100000011111001110111111000000000000000000011111101110011111000111100001111000011110000111100001111000011111000110111001100111111000000000000000011111111000000110000001100000011000000110011111100000011000000110000001100000011111111110000000000000000000000110000001100000011000000110000001100000011001111110000001100000011000000111111111100000000000000000111111011100111110000111100001111110011000000110000001100000011000000111110011101111110000000000000000011000011110000111100001111000011110000111111111111000011110000111100001111000011110000110000000000000000011111100001100000011000000110000001100000011000000110000001100000011000000110000111111000000000000000000011111001110111011000110110000001100000011000000110000001100000011000000110000001100000000000000000000011000011011000110011001100011011000011110000011100001111000110110011001101100011110000110000000000000000111111110000001100000011000000110000001100000011000000110000001100000011000000110000001100000000000000001100001111000011110000111100001111000011110000111101101111111111111111111110011111000011000000000000000011100011111000111111001111110011111110111101101111011111110011111100111111000111110001110000000000000000011111101110011111000011110000111100001111000011110000111100001111000011111001110111111000000000000000000000001100000011000000110000001100000011011111111110001111000011110000111110001101111111000000000000000011111100011101101111101111011011110000111100001111000011110000111100001101100110001111000000000000000000110000110110001100110011000110110000111101111111111000111100001111000011111000110111111100000000000000000111111011100111110000001100000011100000011111100000011100000011000000111110011101111110000000000000000000011000000110000001100000011000000110000001100000011000000110000001100000011000111111110000000000000000011111101110011111000011110000111100001111000011110000111100001111000011110000111100001100000000000000000001100000111100001111000110011001100110110000111100001111000011110000111100001111000011000000000000000011000011111001111111111111111111110110111101101111000011110000111100001111000011110000110000000000000000110000110110011001100110001111000011110000011000001111000011110001100110011001101100001100000000000000000001100000011000000110000001100000011000000110000011110000111100011001100110011011000011000000000000000011111111000000110000001100000110000011000111111000110000011000001100000011000000111111110000000000000000001111000000110000001100000011000000110000001100000011000000110000001100000011000011110000000000110000001100000001100000011000000011000000110000000110000001100000001100000011000000011000000110000000000000000000111100001100000011000000110000001100000011000000110000001100000011000000110000001111000000000000000000000000000000000000000000000000000000000000000000000000001100001101100110001111000001100011111111111111110000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000110000001110000001100000011100000000000000000111111101100001111000011111111101100000011000011011111100000000000000000000000000000000000000000000000000111111111000011110000111100001111000011011111110000001100000011000000110000001100000011000000000000000001111110110000110000001100000011000000111100001101111110000000000000000000000000000000000000000000000000111111101100001111000011110000111100001111111110110000001100000011000000110000001100000000000000000000001111111000000011000000110111111111000011110000110111111000000000000000000000000000000000000000000000000000001100000011000000110000001100000011000011111100001100000011000000110011001100011110000111111011000011110000001100000011111110110000111100001111000011011111100000000000000000000000000000000000000000000000001100001111000011110000111100001111000011110000110111111100000011000000110000001100000011000000000000000000011000000110000001100000011000000110000001100000011000000000000000000000011000000000000001110000110110001100000011000000110000001100000011000000110000001100000000000000000000001100000000000000000000000000000110001100110011000111110000111100011011001100110110001100000011000000110000001100000011000000000000000001111110000110000001100000011000000110000001100000011000000110000001100000011000000111100000000000000000110110111101101111011011110110111101101111011011011111110000000000000000000000000000000000000000000000000110001101100011011000110110001101100011011000110011111100000000000000000000000000000000000000000000000000111110011000110110001101100011011000110110001100111110000000000000000000000000000000000000001100000011000000110111111111000011110000111100001111000011011111110000000000000000000000000000000011000000110000001100000011111110110000111100001111000011110000111111111000000000000000000000000000000000000000000000000000000011000000110000001100000011000000110000011101111111000000000000000000000000000000000000000000000000011111111100000011000000011111100000001100000011111111100000000000000000000000000000000000000000000000000011100001101100000011000000110000001100000011000011111100001100000011000000110000000000000000000000000001111110011000110110001101100011011000110110001101100011000000000000000000000000000000000000000000000000000110000011110000111100011001100110011011000011110000110000000000000000000000000000000000000000000000001100001111100111111111111101101111000011110000111100001100000000000000000000000000000000000000000000000011000011011001100011110000011000001111000110011011000011000000000000000000000000000000000000001100000110000001100000110000011000001111000110011001100110110000110000000000000000000000000000000000000000000000001111111100000110000011000001100000110000011000001111111100000000000000000000000000000000000000000000000011110000000110000001100000011000000111000000111100011100000110000001100000011000111100000001100000011000000110000001100000011000000110000001100000011000000110000001100000011000000110000001100000000000000000000000111100011000000110000001100000111000111100000011100000011000000110000001100000001111";
 }
+/* The font decoded once into one byte per glyph row, bit c set for column c, with the
+ * rows already flipped the way DrawAsciiCharacter draws them. */
+#define FONT_GLYPHS 94
+#define FONT_WIDTH 8
+#define FONT_HEIGHT 13
+
+static uint8_t fontAtlas[FONT_GLYPHS][FONT_HEIGHT];
+
+static void MakeFontAtlas(){
+	wchar_t *data;
+	size_t length, g, x, y;
+	uint8_t mask;
+
+	data = GetPixelFontData(&length);
+	for(g = 0; g < FONT_GLYPHS && (g + 1)*FONT_WIDTH*FONT_HEIGHT <= length; g++){
+		for(y = 0; y < FONT_HEIGHT; y++){
+			mask = 0;
+			for(x = 0; x < FONT_WIDTH; x++){
+				if(data[(g*FONT_HEIGHT + y)*FONT_WIDTH + x] == '1'){
+					mask |= 1 << (FONT_WIDTH - 1 - x);
+				}
+			}
+			fontAtlas[g][FONT_HEIGHT - 1 - y] = mask;
+		}
+	}
+}
+
+#ifdef THREAD_SAFE_PTHREADS
+static pthread_once_t fontAtlasOnce = PTHREAD_ONCE_INIT;
+static void InitFontAtlas(){
+	(void) pthread_once(&fontAtlasOnce, MakeFontAtlas);
+}
+#else
+static void InitFontAtlas(){
+	static _Bool done = false;
+	if(!done){
+		MakeFontAtlas();
+		done = true;
+	}
+}
+#endif
+
 void DrawAsciiCharacter(RGBABitmapImage *image, double topx, double topy, wchar_t a, RGBA *color){
-  double index, x, y, pixel, basis, ybasis;
-  wchar_t *allCharData;
-  size_t allCharDataLength;
-
-  index = a;
-  index = index - 32.0;
-  allCharData = GetPixelFontData(&allCharDataLength);
-
-  basis = index*8.0*13.0;
-
-  for(y = 0.0; y < 13.0; y = y + 1.0){
-    ybasis = basis + y*8.0;
-    for(x = 0.0; x < 8.0; x = x + 1.0){
-      pixel = allCharData[(int)(ybasis + x)];
-      if(pixel == '1'){
-        DrawPixel(image, topx + 8.0 - 1.0 - x, topy + 13.0 - 1.0 - y, color);
-      }
-    }
-  }
+	size_t g, x, y, px, py;
+	uint32_t packed, *row;
+	uint8_t mask;
+
+	if(a < 32 || a >= 32 + FONT_GLYPHS){
+		return;
+	}
+	g = a - 32;
+	InitFontAtlas();
+
+	if(color->a == 1.0 && topx == floor(topx) && topy == floor(topy)){
+		/* Opaque on whole pixels: blending reduces to a store, a glyph row at a time. */
+		packed = PackRGBA(color);
+		for(y = 0; y < FONT_HEIGHT; y++){
+			mask = fontAtlas[g][y];
+			if(mask == 0 || topy + y < 0.0 || topy + y >= image->yLength){
+				continue;
+			}
+			py = topy + y;
+			row = ImageRow(image, py);
+			for(x = 0; x < FONT_WIDTH; x++){
+				if((mask >> x) & 1 && topx + x >= 0.0 && topx + x < image->xLength){
+					px = topx + x;
+					row[px] = packed;
+				}
+			}
+		}
+	}else{
+		for(y = 0; y < FONT_HEIGHT; y++){
+			mask = fontAtlas[g][y];
+			for(x = 0; x < FONT_WIDTH; x++){
+				if((mask >> x) & 1){
+					DrawPixel(image, topx + x, topy + y, color);
+				}
+			}
+		}
+	}
 }
 double GetTextWidth(wchar_t *text, size_t textLength){
   double charWidth, spacing, width;
@@ -4995,11 +5828,216 @@ void AssertStringArraysEqual(StringReference **a, size_t aLength, StringReferenc
     failures->numberValue = failures->numberValue + 1.0;
   }
 }
+/* Adaptive row filtering: every row is filtered with each of the five PNG filters and
+ * the one with the smallest sum of absolute values (bytes taken as signed) is kept, the
+ * heuristic recommended by the PNG specification. prev is the unfiltered previous row,
+ * all zero for the first row; out receives the filter type byte and the filtered row. */
+static uint8_t PNGPaeth(uint8_t a, uint8_t b, uint8_t c){
+	int p, pa, pb, pc;
+
+	p = a + b - c;
+	pa = abs(p - a);
+	pb = abs(p - b);
+	pc = abs(p - c);
+	if(pa <= pb && pa <= pc){
+		return a;
+	}else if(pb <= pc){
+		return b;
+	}else{
+		return c;
+	}
+}
+
+static void PNGFilterRow(uint8_t *out, const uint8_t *row, const uint8_t *prev, size_t length, size_t bpp, uint8_t *scratch){
+	size_t i, cost, bestCost;
+	int type;
+	uint8_t a, c, v;
+
+	bestCost = SIZE_MAX;
+	for(type = 0; type < 5; type++){
+		cost = 0;
+		for(i = 0; i < length && cost < bestCost; i++){
+			a = i >= bpp ? row[i - bpp] : 0;
+			c = i >= bpp ? prev[i - bpp] : 0;
+			switch(type){
+			case 0: v = row[i]; break;
+			case 1: v = row[i] - a; break;
+			case 2: v = row[i] - prev[i]; break;
+			case 3: v = row[i] - ((a + prev[i]) >> 1); break;
+			default: v = row[i] - PNGPaeth(a, prev[i], c); break;
+			}
+			scratch[i] = v;
+			cost += v < 128 ? v : 256 - v;
+		}
+		if(i == length && cost < bestCost){
+			bestCost = cost;
+			out[0] = type;
+			memcpy(out + 1, scratch, length);
+		}
+	}
+}
+
+/* Colour table for palette output: at most 256 packed colours, looked up through a
+ * small open-addressing hash. Colours with alpha below 255 are moved to the front so
+ * the tRNS chunk stays short. */
+#define PNG_PALETTE_SLOTS 1024
+
+typedef struct PNGPalette{
+	uint32_t colors[256];
+	size_t length;
+	uint32_t keys[PNG_PALETTE_SLOTS];
+	int16_t slots[PNG_PALETTE_SLOTS];
+} PNGPalette;
+
+static size_t PNGPaletteSlot(PNGPalette *palette, uint32_t color){
+	size_t slot;
+
+	slot = (color*2654435761u) >> 22;
+	while(palette->slots[slot] >= 0 && palette->keys[slot] != color){
+		slot = (slot + 1) & (PNG_PALETTE_SLOTS - 1);
+	}
+
+	return slot;
+}
+
+static void PNGPaletteRehash(PNGPalette *palette){
+	size_t i, slot;
+
+	memset(palette->slots, 0xFF, sizeof(palette->slots));
+	for(i = 0; i < palette->length; i++){
+		slot = PNGPaletteSlot(palette, palette->colors[i]);
+		palette->keys[slot] = palette->colors[i];
+		palette->slots[slot] = i;
+	}
+}
+
+static _Bool PNGBuildPalette(RGBABitmapImage *image, PNGPalette *palette){
+	size_t x, y, slot, i, translucent;
+	uint32_t *row, last, t;
+
+	palette->length = 0;
+	memset(palette->slots, 0xFF, sizeof(palette->slots));
+
+	last = image->xLength*image->yLength > 0 ? image->pixels[0] + 1 : 0;
+	for(y = 0; y < image->yLength; y++){
+		row = ImageRow(image, y);
+		for(x = 0; x < image->xLength; x++){
+			if(row[x] == last){
+				continue;
+			}
+			last = row[x];
+			slot = PNGPaletteSlot(palette, last);
+			if(palette->slots[slot] < 0){
+				if(palette->length == 256){
+					return false;
+				}
+				palette->keys[slot] = last;
+				palette->slots[slot] = palette->length;
+				palette->colors[palette->length++] = last;
+			}
+		}
+	}
+
+	translucent = 0;
+	for(i = 0; i < palette->length; i++){
+		if((palette->colors[i] & 0xFF) != 0xFF){
+			t = palette->colors[i];
+			palette->colors[i] = palette->colors[translucent];
+			palette->colors[translucent++] = t;
+		}
+	}
+	PNGPaletteRehash(palette);
+
+	return palette->length > 0;
+}
+
+static inline uint8_t PNGPaletteIndex(PNGPalette *palette, uint32_t color){
+	return palette->slots[PNGPaletteSlot(palette, color)];
+}
+
+/* Number of leading palette entries with alpha below 255, the length of tRNS. */
+static size_t PNGPaletteTranslucent(PNGPalette *palette){
+	size_t n;
+
+	for(n = 0; n < palette->length && (palette->colors[n] & 0xFF) != 0xFF; n++);
+
+	return n;
+}
+
+/* Filtered scanlines of the image: RGBA when bpp is 4, the alpha byte when bpp is 1. */
+static ByteArray *PNGColorDataFiltered(RGBABitmapImage *image, size_t bpp){
+	ByteArray *colordata;
+	size_t x, y, w, stride;
+	uint32_t *row;
+	uint8_t *p, *q, *rows, *cur, *prev, *scratch, *t;
+
+	w = image->xLength;
+	stride = bpp*w;
+	colordata = CreateByteArray((stride + 1)*image->yLength);
+	rows = (uint8_t*)Allocate(3*stride + 1, 1);
+	cur = rows;
+	prev = cur + stride;
+	scratch = prev + stride;
+	memset(prev, 0, stride);
+
+	p = colordata->bytes;
+	for(y = 0; y < image->yLength; y++){
+		row = ImageRow(image, y);
+		q = cur;
+		if(bpp == 4){
+			for(x = 0; x < w; x++){
+				WriteUInt32BE(q, row[x]);
+				q += 4;
+			}
+		}else{
+			for(x = 0; x < w; x++){
+				*q++ = row[x] & 0xFF;
+			}
+		}
+		PNGFilterRow(p, cur, prev, stride, bpp, scratch);
+		p += stride + 1;
+		t = prev;
+		prev = cur;
+		cur = t;
+	}
+	Free(rows);
+
+	return colordata;
+}
+
+/* Palette indices, unfiltered as the PNG specification recommends for palette images. */
+static ByteArray *PNGColorDataPalette(RGBABitmapImage *image, PNGPalette *palette){
+	ByteArray *colordata;
+	size_t x, y, w;
+	uint32_t *row, last;
+	uint8_t *p, index;
+
+	w = image->xLength;
+	colordata = CreateByteArray((w + 1)*image->yLength);
+
+	p = colordata->bytes;
+	last = palette->colors[0];
+	index = PNGPaletteIndex(palette, last);
+	for(y = 0; y < image->yLength; y++){
+		row = ImageRow(image, y);
+		*p++ = 0;
+		for(x = 0; x < w; x++){
+			if(row[x] != last){
+				last = row[x];
+				index = PNGPaletteIndex(palette, last);
+			}
+			*p++ = index;
+		}
+	}
+
+	return colordata;
+}
+
 ByteArray *ConvertToPNG(RGBABitmapImage *image){
-  return ConvertToPNGWithOptions(image, 6.0, false, 0.0, 0.001);
+  return ConvertToPNGWithOptions(image, 6.0, false, 0.0, 6.0);
 }
 ByteArray *ConvertToPNGGrayscale(RGBABitmapImage *image){
-  return ConvertToPNGWithOptions(image, 0.0, false, 0.0, 0.001);
+  return ConvertToPNGWithOptions(image, 0.0, false, 0.0, 6.0);
 }
 PHYS *PysicsHeader(double pixelsPerMeter){
   PHYS *phys;
@@ -5010,25 +6048,40 @@ PHYS *PysicsHeader(double pixelsPerMeter){
 
   return phys;
 }
+/* Colour type 6.0 is written as an 8-bit palette image (colour type 3) whenever the
+ * image has at most 256 distinct colours, and as filtered RGBA otherwise. */
 ByteArray *ConvertToPNGWithOptions(RGBABitmapImage *image, double colorType, _Bool setPhys, double pixelsPerMeter, double compressionLevel){
   PNGImage *png;
   ByteArray *pngData, *colorData;
+  PNGPalette *palette;
 
   png = (PNGImage *)Allocate(sizeof(PNGImage), 1);
 
   png->signature = PNGSignature(&png->signatureLength);
 
-  png->ihdr = PNGHeader(image, colorType);
-
   png->physPresent = setPhys;
   png->phys = PysicsHeader(pixelsPerMeter);
 
+  png->palette = NULL;
+  png->paletteLength = 0;
+  colorData = NULL;
   if(colorType == 6.0){
-    colorData = GetPNGColorData(image);
+    palette = (PNGPalette *)Allocate(sizeof(PNGPalette), 1);
+    if(PNGBuildPalette(image, palette)){
+      colorType = 3.0;
+      colorData = PNGColorDataPalette(image, palette);
+      png->palette = (uint32_t*)Allocate(sizeof(uint32_t) * palette->length, 1);
+      png->paletteLength = palette->length;
+      memcpy(png->palette, palette->colors, sizeof(uint32_t) * palette->length);
+    }else{
+      colorData = GetPNGColorData(image);
+    }
   }else{
     colorData = GetPNGColorDataGreyscale(image);
   }
-  png->zlibStruct = ZLibCompressStaticHuffman(colorData, compressionLevel);
+
+  png->ihdr = PNGHeader(image, colorType);
+  png->zlibStruct = ZLibCompressDynamicHuffman(colorData, compressionLevel);
 
   pngData = PNGSerializeChunks(png);
 
@@ -5038,11 +6091,24 @@ ByteArray *PNGSerializeChunks(PNGImage *png){
   double length, i, chunkLength;
   ByteArray *data;
   NumberReference *position;
+  size_t p, transparent;
 
   length = (double)png->signatureLength + 12.0 + PNGHeaderLength() + 12.0 + PNGIDATLength(png) + 12.0;
   if(png->physPresent){
     length = length + 4.0 + 4.0 + 1.0 + 12.0;
   }
+  transparent = 0;
+  if(png->paletteLength > 0){
+    length = length + 3.0*png->paletteLength + 12.0;
+    for(p = 0; p < png->paletteLength; p++){
+      if((png->palette[p] & 0xFF) != 0xFF){
+        transparent = p + 1;
+      }
+    }
+    if(transparent > 0){
+      length = length + transparent + 12.0;
+    }
+  }
   data = CreateByteArray(length);
   position = CreateNumberReference(0.0);
 
@@ -5077,15 +6143,36 @@ ByteArray *PNGSerializeChunks(PNGImage *png){
     Write4BytesBE(data, CRC32OfInterval(data, position->numberValue - chunkLength - 4.0, chunkLength + 4.0), position);
   }
 
+  /* PLTE and tRNS, the alpha of the first entries that are not opaque */
+  if(png->paletteLength > 0){
+    chunkLength = 3.0*png->paletteLength;
+    Write4BytesBE(data, chunkLength, position);
+    WriteStringBytes(data, strparam(L"PLTE"), position);
+    for(p = 0; p < png->paletteLength; p++){
+      WriteByte(data, (png->palette[p] >> 24) & 0xFF, position);
+      WriteByte(data, (png->palette[p] >> 16) & 0xFF, position);
+      WriteByte(data, (png->palette[p] >> 8) & 0xFF, position);
+    }
+    Write4BytesBE(data, CRC32OfInterval(data, position->numberValue - chunkLength - 4.0, chunkLength + 4.0), position);
+
+    if(transparent > 0){
+      chunkLength = transparent;
+      Write4BytesBE(data, chunkLength, position);
+      WriteStringBytes(data, strparam(L"tRNS"), position);
+      for(p = 0; p < transparent; p++){
+        WriteByte(data, png->palette[p] & 0xFF, position);
+      }
+      Write4BytesBE(data, CRC32OfInterval(data, position->numberValue - chunkLength - 4.0, chunkLength + 4.0), position);
+    }
+  }
+
   /* IDAT */
   chunkLength = PNGIDATLength(png);
   Write4BytesBE(data, chunkLength, position);
   WriteStringBytes(data, strparam(L"IDAT"), position);
   WriteByte(data, png->zlibStruct->CMF, position);
   WriteByte(data, png->zlibStruct->FLG, position);
-  for(i = 0.0; i < ByteArrayLength(png->zlibStruct->CompressedDataBlocks); i = i + 1.0){
-    WriteByte(data, GetByte(png->zlibStruct->CompressedDataBlocks, i), position);
-  }
+  WriteBytes(data, png->zlibStruct->CompressedDataBlocks->bytes, png->zlibStruct->CompressedDataBlocks->bytesLength, position);
   Write4BytesBE(data, png->zlibStruct->Adler32CheckValue, position);
   Write4BytesBE(data, CRC32OfInterval(data, position->numberValue - chunkLength - 4.0, chunkLength + 4.0), position);
 
@@ -5104,62 +6191,10 @@ double PNGHeaderLength(){
   return 4.0 + 4.0 + 1.0 + 1.0 + 1.0 + 1.0 + 1.0;
 }
 ByteArray *GetPNGColorData(RGBABitmapImage *image){
-  ByteArray *colordata;
-  size_t pixel;
-  double length, x, y, next;
-	uint32_t rgba;
-
-  length = 4.0*ImageWidth(image)*ImageHeight(image) + ImageHeight(image);
-
-  colordata = CreateByteArray(length);
-
-  next = 0.0;
-
-  for(y = 0.0; y < ImageHeight(image); y = y + 1.0){
-    SetByte(colordata, next, 0.0);
-    next = next + 1.0;
-    for(x = 0.0; x < ImageWidth(image); x = x + 1.0){
-			pixel = x + y * ImageWidth(image);
-			rgba = image->pixels[pixel];
-
-      SetByte(colordata, next, (rgba >> 24) & 0xFF);
-      next = next + 1.0;
-      SetByte(colordata, next, (rgba >> 16) & 0xFF);
-      next = next + 1.0;
-      SetByte(colordata, next, (rgba >> 8) & 0xFF);
-      next = next + 1.0;
-      SetByte(colordata, next, (rgba >> 0) & 0xFF);
-      next = next + 1.0;
-    }
-  }
-
-  return colordata;
+	return PNGColorDataFiltered(image, 4);
 }
 ByteArray *GetPNGColorDataGreyscale(RGBABitmapImage *image){
-  ByteArray *colordata;
-  double length, x, y, next;
-	uint32_t rgba;
-	size_t pixel;
-
-  length = ImageWidth(image)*ImageHeight(image) + ImageHeight(image);
-
-  colordata = CreateByteArray(length);
-
-  next = 0.0;
-
-  for(y = 0.0; y < ImageHeight(image); y = y + 1.0){
-    SetByte(colordata, next, 0.0);
-    next = next + 1.0;
-    for(x = 0.0; x < ImageWidth(image); x = x + 1.0){
-			pixel = x + y * ImageWidth(image);
-			rgba = image->pixels[pixel];
-
-      SetByte(colordata, next, rgba & 0xFF);
-      next = next + 1.0;
-    }
-  }
-
-  return colordata;
+	return PNGColorDataFiltered(image, 1);
 }
 IHDR *PNGHeader(RGBABitmapImage *image, double colortype){
   IHDR *ihdr;
@@ -6808,40 +7843,49 @@ double Read4bytesLE(ByteArray *data, NumberReference *position){
   return r;
 }
 void WriteByte(ByteArray *data, double b, NumberReference *position){
-  data->bytes[(int)(position->numberValue)] = b;
-  position->numberValue = position->numberValue + 1.0;
+	size_t p = position->numberValue;
+
+	data->bytes[p] = b;
+	position->numberValue = p + 1;
 }
 void Write2BytesLE(ByteArray *data, double b, NumberReference *position){
-  data->bytes[(int)(position->numberValue)] = BytesRound(fmod(b, pow(2.0, 8.0)));
-  position->numberValue = position->numberValue + 1.0;
-  data->bytes[(int)(position->numberValue)] = fmod(floor(b/pow(2.0, 8.0)), pow(2.0, 8.0));
-  position->numberValue = position->numberValue + 1.0;
+	size_t p = position->numberValue;
+	uint32_t v = (uint32_t)BytesRound(b);
+
+	data->bytes[p] = v;
+	data->bytes[p + 1] = v >> 8;
+	position->numberValue = p + 2;
 }
 void Write4BytesLE(ByteArray *data, double b, NumberReference *position){
-  data->bytes[(int)(position->numberValue)] = BytesRound(fmod(b, pow(2.0, 8.0)));
-  position->numberValue = position->numberValue + 1.0;
-  data->bytes[(int)(position->numberValue)] = fmod(floor(b/pow(2.0, 8.0)), pow(2.0, 8.0));
-  position->numberValue = position->numberValue + 1.0;
-  data->bytes[(int)(position->numberValue)] = fmod(floor(b/pow(2.0, 16.0)), pow(2.0, 8.0));
-  position->numberValue = position->numberValue + 1.0;
-  data->bytes[(int)(position->numberValue)] = fmod(floor(b/pow(2.0, 24.0)), pow(2.0, 8.0));
-  position->numberValue = position->numberValue + 1.0;
+	size_t p = position->numberValue;
+	uint32_t v = (uint32_t)BytesRound(b);
+
+	data->bytes[p] = v;
+	data->bytes[p + 1] = v >> 8;
+	data->bytes[p + 2] = v >> 16;
+	data->bytes[p + 3] = v >> 24;
+	position->numberValue = p + 4;
 }
 void Write2BytesBE(ByteArray *data, double b, NumberReference *position){
-  data->bytes[(int)(position->numberValue)] = fmod(floor(b/pow(2.0, 8.0)), pow(2.0, 8.0));
-  position->numberValue = position->numberValue + 1.0;
-  data->bytes[(int)(position->numberValue)] = BytesRound(fmod(b, pow(2.0, 8.0)));
-  position->numberValue = position->numberValue + 1.0;
+	size_t p = position->numberValue;
+	uint32_t v = (uint32_t)BytesRound(b);
+
+	data->bytes[p] = v >> 8;
+	data->bytes[p + 1] = v;
+	position->numberValue = p + 2;
 }
 void Write4BytesBE(ByteArray *data, double b, NumberReference *position){
-  data->bytes[(int)(position->numberValue)] = fmod(floor(b/pow(2.0, 24.0)), pow(2.0, 8.0));
-  position->numberValue = position->numberValue + 1.0;
-  data->bytes[(int)(position->numberValue)] = fmod(floor(b/pow(2.0, 16.0)), pow(2.0, 8.0));
-  position->numberValue = position->numberValue + 1.0;
-  data->bytes[(int)(position->numberValue)] = fmod(floor(b/pow(2.0, 8.0)), pow(2.0, 8.0));
-  position->numberValue = position->numberValue + 1.0;
-  data->bytes[(int)(position->numberValue)] = BytesRound(fmod(b, pow(2.0, 8.0)));
-  position->numberValue = position->numberValue + 1.0;
+	size_t p = position->numberValue;
+
+	WriteUInt32BE(data->bytes + p, (uint32_t)BytesRound(b));
+	position->numberValue = p + 4;
+}
+/* Copies length bytes to data at position and advances it. */
+void WriteBytes(ByteArray *data, const uint8_t *bytes, size_t length, NumberReference *position){
+	size_t p = position->numberValue;
+
+	memcpy(data->bytes + p, bytes, length);
+	position->numberValue = p + length;
 }
 void WriteStringBytes(ByteArray *data, wchar_t *cs, size_t csLength, NumberReference *position){
   double i, v;
@@ -6919,15 +7963,9 @@ double ByteArrayLength(ByteArray *response){
 }
 ByteArray *CreateAndFillByteArray(double length, double value){
   ByteArray *bytes;
-  double i;
-
-  bytes = (ByteArray *)Allocate(sizeof(ByteArray), 1);
-  bytes->bytes = (uint8_t*)Allocate(sizeof(uint8_t) * (length), 1);
-  bytes->bytesLength = length;
 
-  for(i = 0.0; i < length; i = i + 1.0){
-    bytes->bytes[(int)(i)] = value;
-  }
+  bytes = CreateByteArray(length);
+  memset(bytes->bytes, (int)value, bytes->bytesLength);
 
   return bytes;
 }
@@ -6941,10 +7979,10 @@ ByteArray *CreateByteArray(double length){
   return bytes;
 }
 void SetByte(ByteArray *array, double index, double value){
-  array->bytes[(int)(index)] = value;
+  array->bytes[(size_t)index] = value;
 }
 double GetByte(ByteArray *array, double index){
-  return array->bytes[(int)(index)];
+  return array->bytes[(size_t)index];
 }
 void AssertByteArraysEqual(ByteArray *a, ByteArray *b, NumberReference *failures){
   double i;
@@ -6964,22 +8002,14 @@ void FreeByteArray(ByteArray *byteArray){
   Free(byteArray);
 }
 _Bool CopyByteArrayRange(ByteArray *a, double from, double to, ByteArray *b){
-  double i, length;
-  uint8_t *n;
-  size_t nLength;
+  size_t length;
   _Bool success;
 
   if(from >= 0.0 && from <= (double)a->bytesLength && to >= 0.0 && to <= (double)a->bytesLength && from <= to){
-    length = to - from;
-    n = (uint8_t*)Allocate(sizeof(uint8_t) * (length), 1);
-    nLength = length;
-
-    for(i = 0.0; i < length; i = i + 1.0){
-      n[(int)(i)] = a->bytes[(int)(from + i)];
-    }
-
-    b->bytes = n;
-    b->bytesLength = nLength;
+    length = (size_t)to - (size_t)from;
+    b->bytes = (uint8_t*)Allocate(sizeof(uint8_t) * length, 1);
+    b->bytesLength = length;
+    memcpy(b->bytes, a->bytes + (size_t)from, length);
     success = true;
   }else{
     success = false;
@@ -7091,66 +8121,201 @@ StringReference **GenerateBase16ByteCombinations(size_t *returnArrayLength){
   *returnArrayLength = combLength;
   return comb;
 }
-double *MakeCRC32Table(size_t *returnArrayLength){
-  double c, n, k;
-  double *crcTable;
-  size_t crcTableLength;
-
-  crcTable = (double*)Allocate(sizeof(double) * (256.0), 1);
-  crcTableLength = 256.0;
-
-  for(n = 0.0; n < 256.0; n = n + 1.0){
-    c = n;
-    for(k = 0.0; k < 8.0; k = k + 1.0){
-      if( !DivisibleBy(c, 2.0) ){
-        c = Xor4Byte(3988292384.0, floor(c/2.0));
-      }else{
-        c = floor(c/2.0);
-      }
-    }
-    crcTable[(int)(n)] = c;
-  }
+/* CRC-32 as used by PNG (reflected polynomial 0xEDB88320). The eight 256-entry
+ * tables for slicing-by-8 are built once; on x86 CPUs with PCLMULQDQ long inputs
+ * are folded 64 bytes at a time with carry-less multiplication instead. */
+static uint32_t crc32Tables[8][256];
 
-  *returnArrayLength = crcTableLength;
-  return crcTable;
-}
-double UpdateCRC32(double crc, ByteArray *buf, double *crc_table, size_t crc_tableLength){
-  double n, index;
+static void MakeCRC32Tables(){
+	uint32_t c, n, k;
 
-  for(n = 0.0; n < ByteArrayLength(buf); n = n + 1.0){
-    index = And4Byte(Xor4Byte(crc, GetByte(buf, n)), pow(2.0, 8.0) - 1.0);
-    crc = Xor4Byte(crc_table[(int)(index)], floor(crc/pow(2.0, 8.0)));
-  }
+	for(n = 0; n < 256; n++){
+		c = n;
+		for(k = 0; k < 8; k++){
+			c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+		}
+		crc32Tables[0][n] = c;
+	}
+	for(n = 0; n < 256; n++){
+		c = crc32Tables[0][n];
+		for(k = 1; k < 8; k++){
+			c = crc32Tables[0][c & 0xFF] ^ (c >> 8);
+			crc32Tables[k][n] = c;
+		}
+	}
+}
 
-  return crc;
+#ifdef THREAD_SAFE_PTHREADS
+static pthread_once_t crc32Once = PTHREAD_ONCE_INIT;
+static void InitCRC32Tables(){
+	(void) pthread_once(&crc32Once, MakeCRC32Tables);
 }
-double CalculateCRC32(ByteArray *buf){
-  double *crcTable;
-  size_t crcTableLength;
-  double b32max, value;
+#else
+static void InitCRC32Tables(){
+	static _Bool done = false;
+	if(!done){
+		MakeCRC32Tables();
+		done = true;
+	}
+}
+#endif
+
+/* crc is the pre- and post-inverted register. */
+static uint32_t CRC32Slice8(uint32_t crc, const uint8_t *p, size_t length){
+	uint32_t lo, hi;
+
+	while(length >= 8){
+		lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+		hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 | (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+		crc = crc32Tables[7][lo & 0xFF] ^ crc32Tables[6][(lo >> 8) & 0xFF]
+		    ^ crc32Tables[5][(lo >> 16) & 0xFF] ^ crc32Tables[4][lo >> 24]
+		    ^ crc32Tables[3][hi & 0xFF] ^ crc32Tables[2][(hi >> 8) & 0xFF]
+		    ^ crc32Tables[1][(hi >> 16) & 0xFF] ^ crc32Tables[0][hi >> 24];
+		p += 8;
+		length -= 8;
+	}
+	while(length > 0){
+		crc = crc32Tables[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+		p++;
+		length--;
+	}
 
-  crcTable = MakeCRC32Table(&crcTableLength);
+	return crc;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRC32_CLMUL
+#include <emmintrin.h>
+#include <wmmintrin.h>
+
+/* Folding with carry-less multiplication, after Gopal et al., "Fast CRC Computation
+ * for Generic Polynomials Using PCLMULQDQ Instruction" (Intel, 2009). Needs length >= 64
+ * and a multiple of 16; crc is the inverted register. */
+__attribute__((target("pclmul,sse2")))
+static uint32_t CRC32Fold(uint32_t crc, const uint8_t *p, size_t length){
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8, mask;
+
+	x1 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+	x0 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+	p += 64;
+	length -= 64;
+
+	/* Four independent 128-bit lanes, 64 bytes per step. */
+	while(length >= 64){
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		y5 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+		y6 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+		y7 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+		y8 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+		p += 64;
+		length -= 64;
+	}
 
-  b32max = pow(2.0, 32.0) - 1.0;
-  value = UpdateCRC32(b32max, buf, crcTable, crcTableLength);
+	/* Fold the four lanes into one. */
+	x0 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	while(length >= 16){
+		x2 = _mm_loadu_si128((const __m128i *)p);
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		p += 16;
+		length -= 16;
+	}
 
-  return Xor4Byte(value, b32max);
+	/* 128 -> 64 bits. */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	mask = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x0 = _mm_set_epi64x(0, 0x0163cd6124);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits. */
+	x0 = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+	x2 = _mm_and_si128(x1, mask);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, mask);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
 }
-double CRC32OfInterval(ByteArray *data, double from, double length){
-  ByteArray *crcBase;
-  double i, crc;
+#endif
 
-  crcBase = CreateByteArray(length);
+/* zlib-style running CRC: start with crc = 0, feed consecutive pieces. */
+uint32_t CRC32Bytes(uint32_t crc, const uint8_t *bytes, size_t length){
+	size_t n;
 
-  for(i = 0.0; i < length; i = i + 1.0){
-    SetByte(crcBase, i, GetByte(data, from + i));
-  }
+	InitCRC32Tables();
+	crc = ~crc;
+
+#ifdef CRC32_CLMUL
+	if(length >= 64 && __builtin_cpu_supports("pclmul")){
+		n = length & ~(size_t)15;
+		crc = CRC32Fold(crc, bytes, n);
+		bytes += n;
+		length -= n;
+	}
+#else
+	(void)n;
+#endif
 
-  crc = CalculateCRC32(crcBase);
+	crc = CRC32Slice8(crc, bytes, length);
 
-  Free(crcBase);
+	return ~crc;
+}
+double *MakeCRC32Table(size_t *returnArrayLength){
+	double *crcTable;
+	size_t n;
+
+	InitCRC32Tables();
+	crcTable = (double*)Allocate(sizeof(double) * 256, 1);
+	for(n = 0; n < 256; n++){
+		crcTable[n] = crc32Tables[0][n];
+	}
 
-  return crc;
+	*returnArrayLength = 256;
+	return crcTable;
+}
+double UpdateCRC32(double crc, ByteArray *buf, double *crc_table, size_t crc_tableLength){
+	/* crc is the raw register here, as in the original formulation. The table argument
+	 * stays in the public signature; CRC32Bytes uses its own tables or PCLMULQDQ. */
+	(void)crc_table;
+	(void)crc_tableLength;
+	return (uint32_t)~CRC32Bytes(~(uint32_t)crc, buf->bytes, buf->bytesLength);
+}
+double CalculateCRC32(ByteArray *buf){
+	return CRC32Bytes(0, buf->bytes, buf->bytesLength);
+}
+double CRC32OfInterval(ByteArray *data, double from, double length){
+	return CRC32Bytes(0, data->bytes + (size_t)from, (size_t)length);
 }
 ZLIBStruct *ZLibCompressNoCompression(ByteArray *data){
   ZLIBStruct *zlibStruct;
@@ -7176,13 +8341,1217 @@ ZLIBStruct *ZLibCompressStaticHuffman(ByteArray *data, double level){
 
   return zlibStruct;
 }
-wchar_t charToLowerCase(wchar_t character){
-  wchar_t toReturn;
+/* DEFLATE (RFC 1951) with LZ77 hash chains, lazy matching and dynamic Huffman blocks.
+ * Levels follow zlib: 0 stores, 1-3 match greedily, 4-9 lazily with longer chains.
+ * Each block is written as dynamic, fixed or stored, whichever is smallest.
+ *
+ * Inputs of at least two DEFLATE_CHUNK_SIZE chunks are compressed pigz-style: every
+ * chunk is an independent run of blocks that may refer back into the previous 32 KiB,
+ * and all but the last end on a byte boundary with an empty stored block, so the pieces
+ * are simply concatenated. The chunks are compressed in parallel when more than one
+ * thread is available; the split is the same for any number of threads, so the output
+ * does not depend on it. Internal buffers use malloc, never the arena. */
+
+#define DEFLATE_WSIZE 32768
+#define DEFLATE_WMASK (DEFLATE_WSIZE - 1)
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_HASH_SIZE (1 << DEFLATE_HASH_BITS)
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_TOO_FAR 4096
+#define DEFLATE_BLOCK_SYMBOLS 16384
+#define DEFLATE_CHUNK_SIZE (128*1024)
+
+typedef struct DeflateConfig{
+	size_t good;
+	size_t lazy;
+	size_t nice;
+	int chain;
+} DeflateConfig;
+
+/* good, lazy, nice, chain as in zlib's configuration_table. */
+static const DeflateConfig deflateConfigs[10] = {
+	{0, 0, 0, 0},
+	{4, 4, 8, 4},
+	{4, 5, 16, 8},
+	{4, 6, 32, 32},
+	{4, 4, 16, 16},
+	{8, 16, 32, 32},
+	{8, 16, 128, 128},
+	{8, 32, 128, 256},
+	{32, 128, 258, 1024},
+	{32, 258, 258, 4096}
+};
+
+static const uint16_t deflateLengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t deflateLengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t deflateDistBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t deflateDistExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+static const uint8_t deflateCodeLengthOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+static uint8_t deflateLengthCode[DEFLATE_MAX_MATCH + 1];
+/* Distance code of d - 1: entries 0-255 for d <= 256, then 256 + ((d - 1) >> 7). */
+static uint8_t deflateDistCode[512];
+static uint8_t deflateFixedLitLengths[288];
+static int deflateThreads = 0;
+
+static void MakeDeflateTables(){
+	int code, n, dist, length;
+
+	for(code = 0; code < 29; code++){
+		for(length = deflateLengthBase[code]; length < deflateLengthBase[code] + (1 << deflateLengthExtra[code]) && length <= DEFLATE_MAX_MATCH; length++){
+			deflateLengthCode[length] = code;
+		}
+	}
+	dist = 0;
+	for(code = 0; code < 16; code++){
+		for(n = 0; n < (1 << deflateDistExtra[code]); n++){
+			deflateDistCode[dist++] = code;
+		}
+	}
+	dist >>= 7;
+	for(; code < 30; code++){
+		for(n = 0; n < (1 << (deflateDistExtra[code] - 7)); n++){
+			deflateDistCode[256 + dist++] = code;
+		}
+	}
+	for(n = 0; n < 288; n++){
+		deflateFixedLitLengths[n] = n < 144 ? 8 : n < 256 ? 9 : n < 280 ? 7 : 8;
+	}
+}
 
-  toReturn = character;
-  if(character == 'A'){
-    toReturn = 'a';
-  }else if(character == 'B'){
+#ifdef THREAD_SAFE_PTHREADS
+static pthread_once_t deflateOnce = PTHREAD_ONCE_INIT;
+static void InitDeflateTables(){
+	(void) pthread_once(&deflateOnce, MakeDeflateTables);
+}
+#else
+static void InitDeflateTables(){
+	static _Bool done = false;
+	if(!done){
+		MakeDeflateTables();
+		done = true;
+	}
+}
+#endif
+
+static int DeflateDistanceCode(size_t distance){
+	return distance <= 256 ? deflateDistCode[distance - 1] : deflateDistCode[256 + ((distance - 1) >> 7)];
+}
+
+/* LSB-first bit writer into a growing malloc buffer. */
+typedef struct DeflateOutput{
+	uint8_t *bytes;
+	size_t length;
+	size_t capacity;
+	uint64_t bits;
+	int count;
+	_Bool failed;
+} DeflateOutput;
+
+static _Bool DeflateReserve(DeflateOutput *out, size_t n){
+	uint8_t *bytes;
+	size_t capacity;
+
+	if(out->length + n > out->capacity){
+		capacity = out->capacity < 4096 ? 4096 : out->capacity;
+		while(capacity < out->length + n){
+			capacity *= 2;
+		}
+		bytes = realloc(out->bytes, capacity);
+		if(bytes == NULL){
+			out->failed = true;
+			return false;
+		}
+		out->bytes = bytes;
+		out->capacity = capacity;
+	}
+	return true;
+}
+
+static void DeflatePutBits(DeflateOutput *out, uint32_t value, int n){
+	out->bits |= (uint64_t)value << out->count;
+	out->count += n;
+	if(out->count >= 32){
+		if(DeflateReserve(out, 4)){
+			out->bytes[out->length++] = out->bits;
+			out->bytes[out->length++] = out->bits >> 8;
+			out->bytes[out->length++] = out->bits >> 16;
+			out->bytes[out->length++] = out->bits >> 24;
+		}
+		out->bits >>= 32;
+		out->count -= 32;
+	}
+}
+
+/* Pads to a byte boundary and flushes the bit buffer. */
+static void DeflateAlign(DeflateOutput *out){
+	while(out->count > 0){
+		if(DeflateReserve(out, 1)){
+			out->bytes[out->length++] = out->bits;
+		}
+		out->bits >>= 8;
+		out->count = out->count > 8 ? out->count - 8 : 0;
+	}
+	out->bits = 0;
+}
+
+static int DeflateCompareKeys(const void *a, const void *b){
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Huffman code lengths for n symbols, limited to maxBits. Unused symbols get length 0;
+ * if fewer than two symbols are used the code is padded to two symbols of length 1. */
+static void DeflateHuffmanLengths(const uint32_t *freqs, int n, int maxBits, uint8_t *lengths){
+	uint64_t keys[288];
+	uint32_t weight[2*288];
+	int parent[2*288], depth[2*288], count[2*288];
+	int used, i, a, b, leaf, inner, next, bits;
+	uint32_t total;
+
+	used = 0;
+	for(i = 0; i < n; i++){
+		lengths[i] = 0;
+		if(freqs[i] > 0){
+			keys[used++] = (uint64_t)freqs[i] << 16 | i;
+		}
+	}
+	if(used < 2){
+		a = used == 1 ? (int)(keys[0] & 0xFFFF) : 0;
+		lengths[a] = 1;
+		lengths[a == 0 ? 1 : 0] = 1;
+		return;
+	}
+	qsort(keys, used, sizeof(uint64_t), DeflateCompareKeys);
+
+	/* Two-queue construction: leaves sorted by weight, inner nodes created in order. */
+	for(i = 0; i < used; i++){
+		weight[i] = keys[i] >> 16;
+	}
+	leaf = 0;
+	inner = used;
+	for(next = used; next < 2*used - 1; next++){
+		a = (leaf < used && (inner >= next || weight[leaf] <= weight[inner])) ? leaf++ : inner++;
+		b = (leaf < used && (inner >= next || weight[leaf] <= weight[inner])) ? leaf++ : inner++;
+		weight[next] = weight[a] + weight[b];
+		parent[a] = next;
+		parent[b] = next;
+	}
+	depth[2*used - 2] = 0;
+	for(i = 2*used - 3; i >= 0; i--){
+		depth[i] = depth[parent[i]] + 1;
+	}
+
+	/* Count leaves per depth, then move overflowing leaves to maxBits and repair the
+	 * Kraft sum by splitting shorter codes, as in miniz. */
+	for(i = 0; i < 2*288; i++){
+		count[i] = 0;
+	}
+	for(i = 0; i < used; i++){
+		count[depth[i]]++;
+	}
+	for(i = maxBits + 1; i < used; i++){
+		count[maxBits] += count[i];
+	}
+	total = 0;
+	for(i = maxBits; i > 0; i--){
+		total += (uint32_t)count[i] << (maxBits - i);
+	}
+	while(total != (1u << maxBits)){
+		count[maxBits]--;
+		for(i = maxBits - 1; i > 0; i--){
+			if(count[i] > 0){
+				count[i]--;
+				count[i + 1] += 2;
+				break;
+			}
+		}
+		total--;
+	}
+
+	/* Least frequent symbols get the longest codes. */
+	i = 0;
+	for(bits = maxBits; bits > 0; bits--){
+		for(a = 0; a < count[bits]; a++){
+			lengths[keys[i++] & 0xFFFF] = bits;
+		}
+	}
+}
+
+/* Canonical codes, bit-reversed for LSB-first output. */
+static void DeflateCanonicalCodes(const uint8_t *lengths, int n, uint16_t *codes){
+	int blCount[16], i, len, k;
+	uint32_t nextCode[16], code, reversed;
+
+	for(i = 0; i < 16; i++){
+		blCount[i] = 0;
+	}
+	for(i = 0; i < n; i++){
+		blCount[lengths[i]]++;
+	}
+	blCount[0] = 0;
+	code = 0;
+	for(len = 1; len < 16; len++){
+		code = (code + blCount[len - 1]) << 1;
+		nextCode[len] = code;
+	}
+	for(i = 0; i < n; i++){
+		len = lengths[i];
+		codes[i] = 0;
+		if(len > 0){
+			code = nextCode[len]++;
+			reversed = 0;
+			for(k = 0; k < len; k++){
+				reversed = (reversed << 1) | ((code >> k) & 1);
+			}
+			codes[i] = reversed;
+		}
+	}
+}
+
+typedef struct DeflateState{
+	const uint8_t *data;
+	size_t dataLength;
+	size_t base;
+	uint32_t *head;
+	uint32_t *prev;
+	uint16_t *litlen;
+	uint16_t *dist;
+	size_t symbols;
+	size_t blockStart;
+	size_t blockEnd;
+	DeflateConfig config;
+	int level;
+	DeflateOutput out;
+} DeflateState;
+
+static _Bool DeflateStateInit(DeflateState *s, const uint8_t *data, size_t dataLength, int level){
+	s->data = data;
+	s->dataLength = dataLength;
+	s->level = level;
+	s->config = deflateConfigs[level];
+	s->head = malloc(sizeof(uint32_t) * DEFLATE_HASH_SIZE);
+	s->prev = malloc(sizeof(uint32_t) * DEFLATE_WSIZE);
+	s->litlen = malloc(sizeof(uint16_t) * DEFLATE_BLOCK_SYMBOLS);
+	s->dist = malloc(sizeof(uint16_t) * DEFLATE_BLOCK_SYMBOLS);
+	memset(&s->out, 0, sizeof(DeflateOutput));
+
+	return s->head != NULL && s->prev != NULL && s->litlen != NULL && s->dist != NULL;
+}
+
+static void DeflateStateFree(DeflateState *s){
+	free(s->head);
+	free(s->prev);
+	free(s->litlen);
+	free(s->dist);
+	free(s->out.bytes);
+}
+
+static uint32_t DeflateHash(const uint8_t *p){
+	uint32_t v = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+	return (v * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+/* Head and prev hold position - base + 1; 0 ends a chain. */
+static void DeflateInsert(DeflateState *s, size_t pos){
+	uint32_t h;
+
+	if(pos + DEFLATE_MIN_MATCH <= s->dataLength){
+		h = DeflateHash(s->data + pos);
+		s->prev[pos & DEFLATE_WMASK] = s->head[h];
+		s->head[h] = (uint32_t)(pos - s->base + 1);
+	}
+}
+
+static size_t DeflateMatchLength(const uint8_t *p, const uint8_t *q, size_t maxLength){
+	size_t length;
+
+	length = 0;
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	uint64_t a, b;
+	while(length + 8 <= maxLength){
+		memcpy(&a, p + length, 8);
+		memcpy(&b, q + length, 8);
+		if(a != b){
+			return length + (__builtin_ctzll(a ^ b) >> 3);
+		}
+		length += 8;
+	}
+#endif
+	while(length < maxLength && p[length] == q[length]){
+		length++;
+	}
+	return length;
+}
+
+/* Longest match for pos (not yet inserted) that beats prevLength; 0 if none. */
+static size_t DeflateLongestMatch(DeflateState *s, size_t pos, size_t end, size_t prevLength, size_t *distance){
+	const uint8_t *p, *q;
+	size_t maxLength, nice, best, length, cand;
+	uint32_t v, next;
+	int chain;
+
+	maxLength = end - pos < DEFLATE_MAX_MATCH ? end - pos : DEFLATE_MAX_MATCH;
+	if(maxLength < DEFLATE_MIN_MATCH){
+		return 0;
+	}
+	nice = s->config.nice < maxLength ? s->config.nice : maxLength;
+	chain = s->config.chain;
+	if(prevLength >= s->config.good){
+		chain >>= 2;
+	}
+
+	best = prevLength < DEFLATE_MIN_MATCH - 1 ? DEFLATE_MIN_MATCH - 1 : prevLength;
+	if(best >= maxLength){
+		return 0;
+	}
+	*distance = 0;
+	p = s->data + pos;
+	v = s->head[DeflateHash(p)];
+	while(v != 0 && chain-- > 0){
+		cand = s->base + v - 1;
+		if(pos - cand > DEFLATE_WSIZE){
+			break;
+		}
+		q = s->data + cand;
+		if(q[best] == p[best] && q[0] == p[0]){
+			length = DeflateMatchLength(p, q, maxLength);
+			if(length > best){
+				best = length;
+				*distance = pos - cand;
+				if(length >= nice){
+					break;
+				}
+			}
+		}
+		next = s->prev[cand & DEFLATE_WMASK];
+		if(next >= v){
+			break;
+		}
+		v = next;
+	}
+
+	return *distance != 0 ? best : 0;
+}
+
+static void DeflateWriteStored(DeflateOutput *out, const uint8_t *bytes, size_t length, _Bool final){
+	size_t piece;
+
+	do{
+		piece = length < 65535 ? length : 65535;
+		DeflatePutBits(out, final && piece == length, 1);
+		DeflatePutBits(out, 0, 2);
+		DeflateAlign(out);
+		DeflatePutBits(out, piece, 16);
+		DeflatePutBits(out, ~piece & 0xFFFF, 16);
+		DeflateAlign(out);
+		if(DeflateReserve(out, piece)){
+			memcpy(out->bytes + out->length, bytes, piece);
+			out->length += piece;
+		}
+		bytes += piece;
+		length -= piece;
+	}while(length > 0);
+}
+
+static void DeflateWriteSymbols(DeflateState *s, const uint16_t *litCodes, const uint8_t *litLengths, const uint16_t *distCodes, const uint8_t *distLengths){
+	DeflateOutput *out;
+	size_t i;
+	int code, length, distance;
+
+	out = &s->out;
+	for(i = 0; i < s->symbols; i++){
+		if(s->dist[i] == 0){
+			DeflatePutBits(out, litCodes[s->litlen[i]], litLengths[s->litlen[i]]);
+		}else{
+			length = s->litlen[i];
+			code = deflateLengthCode[length];
+			DeflatePutBits(out, litCodes[257 + code], litLengths[257 + code]);
+			DeflatePutBits(out, length - deflateLengthBase[code], deflateLengthExtra[code]);
+			distance = s->dist[i];
+			code = DeflateDistanceCode(distance);
+			DeflatePutBits(out, distCodes[code], distLengths[code]);
+			DeflatePutBits(out, distance - deflateDistBase[code], deflateDistExtra[code]);
+		}
+	}
+	DeflatePutBits(out, litCodes[256], litLengths[256]);
+}
+
+/* Emits the pending symbols as the cheapest of a dynamic, fixed or stored block. */
+static void DeflateFlushBlock(DeflateState *s, _Bool final){
+	uint32_t litFreqs[288], distFreqs[30], clFreqs[19];
+	uint8_t litLengths[288], distLengths[30], clLengths[19], allLengths[288 + 30];
+	uint16_t litCodes[288], distCodes[30], clCodes[19];
+	uint8_t fixedDistLengths[30];
+	uint16_t rle[288 + 30], rleExtra[288 + 30];
+	size_t i, n, rleLength, run, r, extraBits, dynamicBits, fixedBits, storedBits, storedLength;
+	int hlit, hdist, hclen, code, length;
+
+	for(i = 0; i < 288; i++){
+		litFreqs[i] = 0;
+	}
+	for(i = 0; i < 30; i++){
+		distFreqs[i] = 0;
+		fixedDistLengths[i] = 5;
+	}
+	for(i = 0; i < 19; i++){
+		clFreqs[i] = 0;
+	}
+	extraBits = 0;
+	for(i = 0; i < s->symbols; i++){
+		if(s->dist[i] == 0){
+			litFreqs[s->litlen[i]]++;
+		}else{
+			code = deflateLengthCode[s->litlen[i]];
+			litFreqs[257 + code]++;
+			extraBits += deflateLengthExtra[code];
+			code = DeflateDistanceCode(s->dist[i]);
+			distFreqs[code]++;
+			extraBits += deflateDistExtra[code];
+		}
+	}
+	litFreqs[256] = 1;
+
+	DeflateHuffmanLengths(litFreqs, 286, 15, litLengths);
+	DeflateHuffmanLengths(distFreqs, 30, 15, distLengths);
+	litLengths[286] = 0;
+	litLengths[287] = 0;
+
+	for(hlit = 286; hlit > 257 && litLengths[hlit - 1] == 0; hlit--);
+	for(hdist = 30; hdist > 1 && distLengths[hdist - 1] == 0; hdist--);
+
+	/* Run-length code the concatenated code lengths with symbols 16, 17 and 18. */
+	n = hlit + hdist;
+	memcpy(allLengths, litLengths, hlit);
+	memcpy(allLengths + hlit, distLengths, hdist);
+	rleLength = 0;
+	for(i = 0; i < n; i += run){
+		length = allLengths[i];
+		for(run = 1; i + run < n && allLengths[i + run] == length; run++);
+		r = run;
+		if(length == 0){
+			while(r >= 11){
+				rle[rleLength] = 18;
+				rleExtra[rleLength++] = (r < 138 ? r : 138) - 11;
+				r -= r < 138 ? r : 138;
+			}
+			if(r >= 3){
+				rle[rleLength] = 17;
+				rleExtra[rleLength++] = r - 3;
+				r = 0;
+			}
+		}else{
+			rle[rleLength] = length;
+			rleExtra[rleLength++] = 0;
+			r--;
+			while(r >= 3){
+				rle[rleLength] = 16;
+				rleExtra[rleLength++] = (r < 6 ? r : 6) - 3;
+				r -= r < 6 ? r : 6;
+			}
+		}
+		while(r > 0){
+			rle[rleLength] = length;
+			rleExtra[rleLength++] = 0;
+			r--;
+		}
+	}
+	for(i = 0; i < rleLength; i++){
+		clFreqs[rle[i]]++;
+	}
+	DeflateHuffmanLengths(clFreqs, 19, 7, clLengths);
+	for(hclen = 19; hclen > 4 && clLengths[deflateCodeLengthOrder[hclen - 1]] == 0; hclen--);
+
+	/* Sizes of the three alternatives in bits. */
+	dynamicBits = 3 + 5 + 5 + 4 + 3*hclen + extraBits;
+	for(i = 0; i < rleLength; i++){
+		dynamicBits += clLengths[rle[i]] + (rle[i] == 16 ? 2 : rle[i] == 17 ? 3 : rle[i] == 18 ? 7 : 0);
+	}
+	fixedBits = 3 + extraBits;
+	for(i = 0; i < 286; i++){
+		dynamicBits += (size_t)litFreqs[i]*litLengths[i];
+		fixedBits += (size_t)litFreqs[i]*deflateFixedLitLengths[i];
+	}
+	for(i = 0; i < 30; i++){
+		dynamicBits += (size_t)distFreqs[i]*distLengths[i];
+		fixedBits += (size_t)distFreqs[i]*5;
+	}
+	storedLength = s->blockEnd - s->blockStart;
+	storedBits = (storedLength/65535 + 1)*(3 + 7 + 32) + 8*storedLength;
+
+	if(storedBits < dynamicBits && storedBits < fixedBits){
+		DeflateWriteStored(&s->out, s->data + s->blockStart, storedLength, final);
+	}else if(fixedBits <= dynamicBits){
+		DeflatePutBits(&s->out, final, 1);
+		DeflatePutBits(&s->out, 1, 2);
+		DeflateCanonicalCodes(deflateFixedLitLengths, 288, litCodes);
+		DeflateCanonicalCodes(fixedDistLengths, 30, distCodes);
+		DeflateWriteSymbols(s, litCodes, deflateFixedLitLengths, distCodes, fixedDistLengths);
+	}else{
+		DeflatePutBits(&s->out, final, 1);
+		DeflatePutBits(&s->out, 2, 2);
+		DeflatePutBits(&s->out, hlit - 257, 5);
+		DeflatePutBits(&s->out, hdist - 1, 5);
+		DeflatePutBits(&s->out, hclen - 4, 4);
+		for(i = 0; i < (size_t)hclen; i++){
+			DeflatePutBits(&s->out, clLengths[deflateCodeLengthOrder[i]], 3);
+		}
+		DeflateCanonicalCodes(clLengths, 19, clCodes);
+		for(i = 0; i < rleLength; i++){
+			DeflatePutBits(&s->out, clCodes[rle[i]], clLengths[rle[i]]);
+			if(rle[i] >= 16){
+				DeflatePutBits(&s->out, rleExtra[i], rle[i] == 16 ? 2 : rle[i] == 17 ? 3 : 7);
+			}
+		}
+		DeflateCanonicalCodes(litLengths, 288, litCodes);
+		DeflateCanonicalCodes(distLengths, 30, distCodes);
+		DeflateWriteSymbols(s, litCodes, litLengths, distCodes, distLengths);
+	}
+
+	s->symbols = 0;
+	s->blockStart = s->blockEnd;
+}
+
+static void DeflateTally(DeflateState *s, size_t pos, size_t length, size_t distance){
+	if(distance == 0){
+		s->litlen[s->symbols] = s->data[pos];
+		s->dist[s->symbols] = 0;
+		s->blockEnd = pos + 1;
+	}else{
+		s->litlen[s->symbols] = length;
+		s->dist[s->symbols] = distance;
+		s->blockEnd = pos + length;
+	}
+	s->symbols++;
+	if(s->symbols == DEFLATE_BLOCK_SYMBOLS){
+		DeflateFlushBlock(s, false);
+	}
+}
+
+/* Compresses data[start, end) into s->out; earlier bytes back to 32 KiB serve as dictionary. */
+static void DeflateChunk(DeflateState *s, size_t start, size_t end, _Bool last){
+	size_t pos, p, length, distance, prevLength, prevDistance;
+	_Bool pending;
+
+	s->symbols = 0;
+	s->blockStart = start;
+	s->blockEnd = start;
+
+	if(s->level == 0){
+		DeflateWriteStored(&s->out, s->data + start, end - start, last);
+	}else{
+		s->base = start > DEFLATE_WSIZE ? start - DEFLATE_WSIZE : 0;
+		memset(s->head, 0, sizeof(uint32_t) * DEFLATE_HASH_SIZE);
+		for(p = s->base; p < start; p++){
+			DeflateInsert(s, p);
+		}
+
+		pos = start;
+		if(s->level <= 3){
+			/* Greedy: take the first match, index its bytes only if it is short. */
+			while(pos < end){
+				length = DeflateLongestMatch(s, pos, end, 0, &distance);
+				DeflateInsert(s, pos);
+				if(length >= DEFLATE_MIN_MATCH){
+					DeflateTally(s, pos, length, distance);
+					if(length <= s->config.lazy){
+						for(p = pos + 1; p < pos + length; p++){
+							DeflateInsert(s, p);
+						}
+					}
+					pos += length;
+				}else{
+					DeflateTally(s, pos, 1, 0);
+					pos++;
+				}
+			}
+		}else{
+			/* Lazy: emit the match found at pos - 1 only if pos does not have a longer one. */
+			pending = false;
+			prevLength = 0;
+			prevDistance = 0;
+			while(pos < end){
+				length = 0;
+				distance = 0;
+				if(!(pending && prevLength >= s->config.lazy)){
+					length = DeflateLongestMatch(s, pos, end, pending ? prevLength : 0, &distance);
+					if(length == DEFLATE_MIN_MATCH && distance > DEFLATE_TOO_FAR){
+						length = 0;
+					}
+				}
+				DeflateInsert(s, pos);
+
+				if(pending && prevLength >= DEFLATE_MIN_MATCH && length <= prevLength){
+					DeflateTally(s, pos - 1, prevLength, prevDistance);
+					for(p = pos + 1; p < pos - 1 + prevLength; p++){
+						DeflateInsert(s, p);
+					}
+					pos = pos - 1 + prevLength;
+					pending = false;
+					prevLength = 0;
+				}else{
+					if(pending){
+						DeflateTally(s, pos - 1, 1, 0);
+					}
+					pending = true;
+					prevLength = length;
+					prevDistance = distance;
+					pos++;
+				}
+			}
+			if(pending){
+				DeflateTally(s, pos - 1, 1, 0);
+			}
+		}
+		DeflateFlushBlock(s, last);
+	}
+
+	if(!last){
+		/* Empty stored block: byte-aligns the chunk so the next one can follow directly. */
+		DeflatePutBits(&s->out, 0, 3);
+		DeflateAlign(&s->out);
+		DeflatePutBits(&s->out, 0x0000, 16);
+		DeflatePutBits(&s->out, 0xFFFF, 16);
+	}
+	DeflateAlign(&s->out);
+}
+
+typedef struct DeflateJob{
+	const uint8_t *data;
+	size_t length;
+	int level;
+	size_t chunks;
+	size_t next;
+	DeflateOutput *outputs;
+	_Bool failed;
+#ifdef THREAD_SAFE_PTHREADS
+	pthread_mutex_t lock;
+#endif
+} DeflateJob;
+
+static void *DeflateWorker(void *arg){
+	DeflateJob *job;
+	DeflateState s;
+	size_t chunk, start, end;
+
+	job = (DeflateJob*)arg;
+	if(!DeflateStateInit(&s, job->data, job->length, job->level)){
+		DeflateStateFree(&s);
+#ifdef THREAD_SAFE_PTHREADS
+		pthread_mutex_lock(&job->lock);
+#endif
+		job->failed = true;
+#ifdef THREAD_SAFE_PTHREADS
+		pthread_mutex_unlock(&job->lock);
+#endif
+		return NULL;
+	}
+	for(;;){
+#ifdef THREAD_SAFE_PTHREADS
+		pthread_mutex_lock(&job->lock);
+#endif
+		chunk = job->next++;
+#ifdef THREAD_SAFE_PTHREADS
+		pthread_mutex_unlock(&job->lock);
+#endif
+		if(chunk >= job->chunks){
+			break;
+		}
+		start = chunk*DEFLATE_CHUNK_SIZE;
+		end = start + DEFLATE_CHUNK_SIZE < job->length ? start + DEFLATE_CHUNK_SIZE : job->length;
+		DeflateChunk(&s, start, end, chunk + 1 == job->chunks);
+		job->outputs[chunk] = s.out;
+		memset(&s.out, 0, sizeof(DeflateOutput));
+	}
+	DeflateStateFree(&s);
+	return NULL;
+}
+
+/* Sets the number of threads used by DeflateDataDynamicHuffman; 0 means one per CPU. */
+void SetDeflateThreads(double threads){
+	deflateThreads = threads;
+}
+
+ByteArray *DeflateDataDynamicHuffman(ByteArray *data, double level){
+	DeflateJob job;
+	ByteArray *deflated;
+	size_t i, length;
+	int threads, t;
+
+	InitDeflateTables();
+
+	job.data = data->bytes;
+	job.length = data->bytesLength;
+	job.level = level < 0.0 ? 0 : level > 9.0 ? 9 : (int)level;
+	job.next = 0;
+	job.failed = false;
+
+	threads = 1;
+#ifdef THREAD_SAFE_PTHREADS
+	threads = deflateThreads > 0 ? deflateThreads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if(job.length >= 2*DEFLATE_CHUNK_SIZE){
+		job.chunks = (job.length + DEFLATE_CHUNK_SIZE - 1)/DEFLATE_CHUNK_SIZE;
+	}else{
+		job.chunks = 1;
+	}
+	job.outputs = calloc(job.chunks, sizeof(DeflateOutput));
+	if(job.outputs == NULL){
+		return DeflateDataNoCompression(data);
+	}
+
+	if(job.chunks == 1){
+		/* One chunk covering everything. */
+		DeflateState s;
+		if(DeflateStateInit(&s, job.data, job.length, job.level)){
+			DeflateChunk(&s, 0, job.length, true);
+			job.outputs[0] = s.out;
+			memset(&s.out, 0, sizeof(DeflateOutput));
+		}else{
+			job.failed = true;
+		}
+		DeflateStateFree(&s);
+	}else{
+#ifdef THREAD_SAFE_PTHREADS
+		pthread_t workers[64];
+
+		if(threads > 64){
+			threads = 64;
+		}
+		if((size_t)threads > job.chunks){
+			threads = job.chunks;
+		}
+		pthread_mutex_init(&job.lock, NULL);
+		for(t = 1; t < threads; t++){
+			if(pthread_create(&workers[t], NULL, DeflateWorker, &job) != 0){
+				break;
+			}
+		}
+		threads = t;
+		DeflateWorker(&job);
+		for(t = 1; t < threads; t++){
+			pthread_join(workers[t], NULL);
+		}
+		pthread_mutex_destroy(&job.lock);
+#else
+		(void)t;
+		(void)threads;
+		DeflateWorker(&job);
+#endif
+	}
+
+	length = 0;
+	for(i = 0; i < job.chunks; i++){
+		job.failed = job.failed || job.outputs[i].failed || (job.outputs[i].bytes == NULL && job.length > 0);
+		length += job.outputs[i].length;
+	}
+
+	if(job.failed){
+		deflated = DeflateDataNoCompression(data);
+	}else{
+		deflated = CreateByteArray(length);
+		length = 0;
+		for(i = 0; i < job.chunks; i++){
+			memcpy(deflated->bytes + length, job.outputs[i].bytes, job.outputs[i].length);
+			length += job.outputs[i].length;
+		}
+	}
+
+	for(i = 0; i < job.chunks; i++){
+		free(job.outputs[i].bytes);
+	}
+	free(job.outputs);
+
+	return deflated;
+}
+ZLIBStruct *ZLibCompressDynamicHuffman(ByteArray *data, double level){
+  ZLIBStruct *zlibStruct;
+
+  zlibStruct = (ZLIBStruct *)Allocate(sizeof(ZLIBStruct), 1);
+
+  /* FLEVEL in the header is informational; each CMF/FLG pair is a multiple of 31. */
+  zlibStruct->CMF = 120.0;
+  if(level < 2.0){
+    zlibStruct->FLG = 1.0;
+  }else if(level < 6.0){
+    zlibStruct->FLG = 94.0;
+  }else if(level < 7.0){
+    zlibStruct->FLG = 156.0;
+  }else{
+    zlibStruct->FLG = 218.0;
+  }
+  zlibStruct->CompressedDataBlocks = DeflateDataDynamicHuffman(data, level);
+  zlibStruct->Adler32CheckValue = ComputeAdler32(data);
+
+  return zlibStruct;
+}
+/* Streaming PNG encoder. Rows are filtered (type 0) into a buffer holding the last
+ * 32 KiB as dictionary plus up to DEFLATE_CHUNK_SIZE of new data; each time the new data
+ * fills up it is compressed as a byte-aligned deflate chunk and written out as an IDAT
+ * chunk. Memory use is bounded by the buffer and one row, whatever the image height. */
+
+struct PNGStream{
+	FILE *file;
+	int fd;
+	size_t width;
+	size_t height;
+	size_t row;
+	int colorType;
+	size_t rowBytes;
+	uint8_t *buffer;
+	size_t bufferLength;
+	size_t bufferCapacity;
+	size_t chunkStart;
+	uint8_t *idat;
+	size_t idatLength;
+	size_t idatCapacity;
+	uint32_t adler;
+	uint8_t *rows;
+	PNGPalette *palette;
+	DeflateState deflate;
+	_Bool failed;
+};
+
+/* zlib-style running Adler-32: start with adler = 1. */
+uint32_t Adler32Bytes(uint32_t adler, const uint8_t *bytes, size_t length){
+	uint32_t a, b;
+	size_t n;
+
+	a = adler & 0xFFFF;
+	b = adler >> 16;
+	while(length > 0){
+		/* 5552 is the largest n with 255n(n+1)/2 + (n+1)(65520) < 2^32. */
+		n = length < 5552 ? length : 5552;
+		length -= n;
+		while(n-- > 0){
+			a += *bytes++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+
+	return (b << 16) | a;
+}
+
+static void PNGStreamWrite(PNGStream *stream, const uint8_t *bytes, size_t length){
+#if defined(__unix__) || defined(__APPLE__)
+	ssize_t written;
+#endif
+
+	if(stream->failed || length == 0){
+		return;
+	}
+	if(stream->file != NULL){
+		if(fwrite(bytes, 1, length, stream->file) != length){
+			stream->failed = true;
+		}
+	}else{
+#if defined(__unix__) || defined(__APPLE__)
+		while(length > 0){
+			written = write(stream->fd, bytes, length);
+			if(written < 0 && errno == EINTR){
+				continue;
+			}
+			if(written <= 0){
+				stream->failed = true;
+				return;
+			}
+			bytes += written;
+			length -= written;
+		}
+#else
+		stream->failed = true;
+#endif
+	}
+}
+
+static void PNGStreamChunk(PNGStream *stream, const char *type, const uint8_t *data, size_t length){
+	uint8_t header[8], trailer[4];
+	uint32_t crc;
+
+	WriteUInt32BE(header, length);
+	memcpy(header + 4, type, 4);
+	crc = CRC32Bytes(CRC32Bytes(0, header + 4, 4), data, length);
+	WriteUInt32BE(trailer, crc);
+
+	PNGStreamWrite(stream, header, 8);
+	PNGStreamWrite(stream, data, length);
+	PNGStreamWrite(stream, trailer, 4);
+}
+
+static void PNGStreamAppendIDAT(PNGStream *stream, const uint8_t *bytes, size_t length){
+	uint8_t *idat;
+	size_t capacity;
+
+	if(stream->idatLength + length > stream->idatCapacity){
+		capacity = 2*(stream->idatLength + length);
+		idat = realloc(stream->idat, capacity);
+		if(idat == NULL){
+			stream->failed = true;
+			return;
+		}
+		stream->idat = idat;
+		stream->idatCapacity = capacity;
+	}
+	memcpy(stream->idat + stream->idatLength, bytes, length);
+	stream->idatLength += length;
+}
+
+/* Compresses the buffered data after chunkStart and writes it as one IDAT chunk. */
+static void PNGStreamCompress(PNGStream *stream, _Bool last){
+	DeflateState *s;
+	uint8_t adler[4];
+	size_t keep;
+
+	s = &stream->deflate;
+	s->data = stream->buffer;
+	s->dataLength = stream->bufferLength;
+	s->out.length = 0;
+	DeflateChunk(s, stream->chunkStart, stream->bufferLength, last);
+	if(s->out.failed){
+		stream->failed = true;
+		return;
+	}
+	PNGStreamAppendIDAT(stream, s->out.bytes, s->out.length);
+	if(last){
+		WriteUInt32BE(adler, stream->adler);
+		PNGStreamAppendIDAT(stream, adler, 4);
+	}
+	if(!stream->failed && stream->idatLength > 0){
+		PNGStreamChunk(stream, "IDAT", stream->idat, stream->idatLength);
+	}
+	stream->idatLength = 0;
+
+	/* Keep the last 32 KiB as dictionary for the next chunk. */
+	keep = stream->bufferLength < DEFLATE_WSIZE ? stream->bufferLength : DEFLATE_WSIZE;
+	memmove(stream->buffer, stream->buffer + stream->bufferLength - keep, keep);
+	stream->bufferLength = keep;
+	stream->chunkStart = keep;
+}
+
+/* With a palette the rows are written as palette indices (colour type 3), otherwise as
+ * adaptively filtered RGBA or greyscale scanlines. */
+static PNGStream *PNGStreamCreate(FILE *file, int fd, size_t width, size_t height, double colorType, _Bool setPhys, double pixelsPerMeter, double compressionLevel, PNGPalette *palette){
+	PNGStream *stream;
+	uint8_t signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+	uint8_t ihdr[13], phys[9], zlibHeader[2], plte[3*256], trns[256];
+	uint32_t ppm;
+	size_t i, transparent;
+	int level;
+
+	InitDeflateTables();
+	level = compressionLevel < 0.0 ? 0 : compressionLevel > 9.0 ? 9 : (int)compressionLevel;
+
+	stream = calloc(1, sizeof(PNGStream));
+	if(stream == NULL){
+		return NULL;
+	}
+	stream->file = file;
+	stream->fd = fd;
+	stream->width = width;
+	stream->height = height;
+	stream->colorType = palette != NULL ? 3 : colorType == 6.0 ? 6 : 0;
+	stream->rowBytes = 1 + width*(stream->colorType == 6 ? 4 : 1);
+	stream->bufferCapacity = DEFLATE_WSIZE + DEFLATE_CHUNK_SIZE + stream->rowBytes;
+	stream->buffer = malloc(stream->bufferCapacity);
+	stream->rows = calloc(3, stream->rowBytes);
+	if(palette != NULL){
+		stream->palette = malloc(sizeof(PNGPalette));
+	}
+	stream->adler = 1;
+	if(stream->buffer == NULL || stream->rows == NULL || (palette != NULL && stream->palette == NULL) || !DeflateStateInit(&stream->deflate, stream->buffer, 0, level)){
+		DeflateStateFree(&stream->deflate);
+		free(stream->buffer);
+		free(stream->rows);
+		free(stream->palette);
+		free(stream);
+		return NULL;
+	}
+	if(palette != NULL){
+		memcpy(stream->palette, palette, sizeof(PNGPalette));
+	}
+
+	PNGStreamWrite(stream, signature, 8);
+
+	WriteUInt32BE(ihdr, width);
+	WriteUInt32BE(ihdr + 4, height);
+	ihdr[8] = 8;
+	ihdr[9] = stream->colorType;
+	ihdr[10] = 0;
+	ihdr[11] = 0;
+	ihdr[12] = 0;
+	PNGStreamChunk(stream, "IHDR", ihdr, 13);
+
+	if(setPhys){
+		ppm = pixelsPerMeter;
+		WriteUInt32BE(phys, ppm);
+		WriteUInt32BE(phys + 4, ppm);
+		phys[8] = 1;
+		PNGStreamChunk(stream, "pHYs", phys, 9);
+	}
+
+	if(palette != NULL){
+		for(i = 0; i < palette->length; i++){
+			plte[3*i] = palette->colors[i] >> 24;
+			plte[3*i + 1] = palette->colors[i] >> 16;
+			plte[3*i + 2] = palette->colors[i] >> 8;
+			trns[i] = palette->colors[i];
+		}
+		PNGStreamChunk(stream, "PLTE", plte, 3*palette->length);
+		transparent = PNGPaletteTranslucent(palette);
+		if(transparent > 0){
+			PNGStreamChunk(stream, "tRNS", trns, transparent);
+		}
+	}
+
+	zlibHeader[0] = 120;
+	zlibHeader[1] = level < 2 ? 1 : level < 6 ? 94 : level < 7 ? 156 : 218;
+	PNGStreamAppendIDAT(stream, zlibHeader, 2);
+
+	return stream;
+}
+
+PNGStream *PNGStreamOpen(FILE *file, size_t width, size_t height, double colorType, _Bool setPhys, double pixelsPerMeter, double compressionLevel){
+	return PNGStreamCreate(file, -1, width, height, colorType, setPhys, pixelsPerMeter, compressionLevel, NULL);
+}
+
+PNGStream *PNGStreamOpenFd(int fd, size_t width, size_t height, double colorType, _Bool setPhys, double pixelsPerMeter, double compressionLevel){
+	return PNGStreamCreate(NULL, fd, width, height, colorType, setPhys, pixelsPerMeter, compressionLevel, NULL);
+}
+
+/* Appends one row of width packed pixels. Returns false once any write has failed. */
+_Bool PNGStreamWriteRow(PNGStream *stream, const uint32_t *pixels){
+	uint8_t *p, *cur, *prev;
+	size_t x, stride;
+
+	if(stream->failed || stream->row >= stream->height){
+		stream->failed = true;
+		return false;
+	}
+
+	/* Unfiltered rows alternate between the first two row buffers. */
+	stride = stream->rowBytes - 1;
+	cur = stream->rows + (stream->row & 1)*stride;
+	prev = stream->rows + (~stream->row & 1)*stride;
+
+	p = stream->buffer + stream->bufferLength;
+	if(stream->colorType == 3){
+		*p++ = 0;
+		for(x = 0; x < stream->width; x++){
+			*p++ = PNGPaletteIndex(stream->palette, pixels[x]);
+		}
+	}else{
+		if(stream->colorType == 6){
+			for(x = 0; x < stream->width; x++){
+				WriteUInt32BE(cur + 4*x, pixels[x]);
+			}
+		}else{
+			for(x = 0; x < stream->width; x++){
+				cur[x] = pixels[x];
+			}
+		}
+		PNGFilterRow(p, cur, prev, stride, stream->colorType == 6 ? 4 : 1, stream->rows + 2*stride);
+	}
+	stream->adler = Adler32Bytes(stream->adler, stream->buffer + stream->bufferLength, stream->rowBytes);
+	stream->bufferLength += stream->rowBytes;
+	stream->row++;
+
+	if(stream->bufferLength - stream->chunkStart >= DEFLATE_CHUNK_SIZE && stream->row < stream->height){
+		PNGStreamCompress(stream, false);
+	}
+
+	return !stream->failed;
+}
+
+/* Flushes the last IDAT, writes IEND and frees the stream. Fails if rows are missing.
+ * The FILE or fd is left open. */
+_Bool PNGStreamClose(PNGStream *stream){
+	_Bool success;
+
+	if(stream->row != stream->height){
+		stream->failed = true;
+	}
+	if(!stream->failed){
+		PNGStreamCompress(stream, true);
+		PNGStreamChunk(stream, "IEND", NULL, 0);
+	}
+	if(stream->file != NULL && !stream->failed && fflush(stream->file) != 0){
+		stream->failed = true;
+	}
+	success = !stream->failed;
+
+	DeflateStateFree(&stream->deflate);
+	free(stream->buffer);
+	free(stream->idat);
+	free(stream->rows);
+	free(stream->palette);
+	free(stream);
+
+	return success;
+}
+
+/* Streams height rows produced by callback(context, y, row) into file. */
+_Bool WritePNGRows(FILE *file, size_t width, size_t height, double colorType, double compressionLevel, PNGRowCallback callback, void *context){
+	PNGStream *stream;
+	uint32_t *row;
+	size_t y;
+	_Bool success;
+
+	row = malloc(sizeof(uint32_t) * (width > 0 ? width : 1));
+	stream = PNGStreamOpen(file, width, height, colorType, false, 0.0, compressionLevel);
+	if(row == NULL || stream == NULL){
+		free(row);
+		if(stream != NULL){
+			stream->failed = true;
+			PNGStreamClose(stream);
+		}
+		return false;
+	}
+	success = true;
+	for(y = 0; y < height && success; y++){
+		callback(context, y, row);
+		success = PNGStreamWriteRow(stream, row);
+	}
+	free(row);
+
+	return PNGStreamClose(stream) && success;
+}
+
+/* Writes image to file without building the PNG in memory. */
+/* Like ConvertToPNGWithOptions, colour type 6.0 becomes a palette image when it can. */
+_Bool WriteImageAsPNG(RGBABitmapImage *image, FILE *file, double colorType, double compressionLevel){
+	PNGStream *stream;
+	PNGPalette *palette;
+	size_t y;
+
+	palette = NULL;
+	if(colorType == 6.0){
+		palette = malloc(sizeof(PNGPalette));
+		if(palette != NULL && !PNGBuildPalette(image, palette)){
+			free(palette);
+			palette = NULL;
+		}
+	}
+	stream = PNGStreamCreate(file, -1, image->xLength, image->yLength, colorType, false, 0.0, compressionLevel, palette);
+	free(palette);
+	if(stream == NULL){
+		return false;
+	}
+	for(y = 0; y < image->yLength; y++){
+		PNGStreamWriteRow(stream, ImageRow(image, y));
+	}
+
+	return PNGStreamClose(stream);
+}
+wchar_t charToLowerCase(wchar_t character){
+  wchar_t toReturn;
+
+  toReturn = character;
+  if(character == 'A'){
+    toReturn = 'a';
+  }else if(character == 'B'){
     toReturn = 'b';
   }else if(character == 'C'){
     toReturn = 'c';
@@ -7948,18 +10317,7 @@ double Read2bytesByteBoundary(double *data, size_t dataLength, NumberReference *
   return r;
 }
 double ComputeAdler32(ByteArray *data){
-  double a, b, m, i;
-
-  a = 1.0;
-  b = 0.0;
-  m = 65521.0;
-
-  for(i = 0.0; i < ByteArrayLength(data); i = i + 1.0){
-    a = fmod(a + GetByte(data, i), m);
-    b = fmod(b + a, m);
-  }
-
-  return b*pow(2.0, 16.0) + a;
+  return Adler32Bytes(1, data->bytes, data->bytesLength);
 }
 ByteArray *Pack(ByteArray *data, double level){
   ByteArray *output, *trimmed;
@@ -8257,33 +10615,32 @@ double ReverseBits(double x, double bits){
   return b;
 }
 ByteArray *DeflateDataNoCompression(ByteArray *data){
-  ByteArray *deflated;
-  NumberReference *position;
-  double block, i, blocks, blocklength, maxblocksize;
-
-  maxblocksize = pow(2.0, 16.0) - 1.0;
-  blocks = ceil(ByteArrayLength(data)/maxblocksize);
-
-  position = CreateNumberReference(0.0);
-
-  deflated = CreateByteArray((1.0 + 4.0)*blocks + ByteArrayLength(data));
-
-  for(block = 0.0; block < blocks; block = block + 1.0){
-    if(block + 1.0 == blocks){
-      WriteByte(deflated, 1.0, position);
-    }else{
-      WriteByte(deflated, 0.0, position);
-    }
-    blocklength = fmin(ByteArrayLength(data) - block*maxblocksize, maxblocksize);
-    Write2BytesLE(deflated, blocklength, position);
-    Write2BytesLE(deflated, Not2Byte(blocklength), position);
+	ByteArray *deflated;
+	size_t block, blocks, blocklength, from, maxblocksize;
+	uint8_t *p;
+
+	maxblocksize = 65535;
+	blocks = (data->bytesLength + maxblocksize - 1)/maxblocksize;
+	if(blocks == 0){
+		blocks = 1;
+	}
 
-    for(i = 0.0; i < blocklength; i = i + 1.0){
-      WriteByte(deflated, GetByte(data, block*maxblocksize + i), position);
-    }
-  }
+	deflated = CreateByteArray((1 + 4)*blocks + data->bytesLength);
+
+	p = deflated->bytes;
+	for(block = 0; block < blocks; block++){
+		from = block*maxblocksize;
+		blocklength = data->bytesLength - from < maxblocksize ? data->bytesLength - from : maxblocksize;
+		p[0] = block + 1 == blocks;
+		p[1] = blocklength;
+		p[2] = blocklength >> 8;
+		p[3] = ~blocklength;
+		p[4] = ~blocklength >> 8;
+		memcpy(p + 5, data->bytes + from, blocklength);
+		p += 5 + blocklength;
+	}
 
-  return deflated;
+	return deflated;
 }
 void GetDeflateStaticHuffmanCode(double b, NumberReference *code, NumberReference *length, double *bitReverseLookupTable, size_t bitReverseLookupTableLength){
   double reversed;
@@ -8398,66 +10755,42 @@ void GetDeflateDistanceCode(double distance, NumberReference *code, NumberRefere
   code->numberValue = ShiftRight4Byte(reversed, 32.0 - 5.0);
 }
 void AppendBitsToBytesLeft(ByteArray *bytes, NumberReference *nextbit, double data, double length){
-  double bytePos, bitPos, segment, part, remove;
-
-  for(; length > 0.0; ){
-    bytePos = Truncate(nextbit->numberValue/8.0);
-    bitPos = fmod(nextbit->numberValue, 8.0);
-
-    if(length < 8.0 - bitPos){
-      part = ShiftLeft4Byte(data, 8.0 - bitPos - length);
-
-      SetByte(bytes, bytePos, Or4Byte(GetByte(bytes, bytePos), part));
-
-      nextbit->numberValue = nextbit->numberValue + length;
-
-      length = 0.0;
-    }else{
-      segment = 8.0 - bitPos;
-
-      part = ShiftRight4Byte(data, length - segment);
-      SetByte(bytes, bytePos, Or4Byte(GetByte(bytes, bytePos), part));
-      nextbit->numberValue = nextbit->numberValue + segment;
-
-      remove = ShiftLeft4Byte(part, length - segment);
-      data = Xor4Byte(data, remove);
+	size_t bit, n, segment, bitPos;
+	uint64_t value;
+
+	bit = nextbit->numberValue;
+	n = length;
+	value = data;
+
+	/* Most significant bits first, filling each byte from its top. */
+	while(n > 0){
+		bitPos = bit & 7;
+		segment = 8 - bitPos < n ? 8 - bitPos : n;
+		bytes->bytes[bit >> 3] |= ((value >> (n - segment)) & ((1u << segment) - 1)) << (8 - bitPos - segment);
+		bit += segment;
+		n -= segment;
+	}
 
-      length = length - segment;
-    }
-  }
+	nextbit->numberValue = bit;
 }
 void AppendBitsToBytesRight(ByteArray *bytes, NumberReference *nextbit, double data, double length){
-  double bytePos, bitPos, segment, part;
-  double mask;
-
-  for(; length > 0.0; ){
-    bytePos = Truncate(nextbit->numberValue/8.0);
-    bitPos = fmod(nextbit->numberValue, 8.0);
-
-    if(length < 8.0 - bitPos){
-      part = ShiftLeft4Byte(data, bitPos);
-
-      SetByte(bytes, bytePos, Or4Byte(GetByte(bytes, bytePos), part));
-
-      nextbit->numberValue = nextbit->numberValue + length;
-
-      length = 0.0;
-    }else{
-      segment = 8.0 - bitPos;
-
-      mask = 1.0;
-      mask = ShiftLeft4Byte(mask, segment);
-      mask = mask - 1.0;
-
-      part = And4Byte(mask, data);
-      part = ShiftLeft4Byte(part, bitPos);
-      SetByte(bytes, bytePos, Or4Byte(GetByte(bytes, bytePos), part));
-      nextbit->numberValue = nextbit->numberValue + segment;
-
-      data = ShiftRight4Byte(data, segment);
+	size_t bit, n, segment, bitPos;
+	uint64_t value;
+
+	bit = nextbit->numberValue;
+	n = length;
+	value = data;
+
+	/* Least significant bits first, filling each byte from its bottom. */
+	while(n > 0){
+		bitPos = bit & 7;
+		segment = 8 - bitPos < n ? 8 - bitPos : n;
+		bytes->bytes[bit >> 3] |= (value & ((1u << segment) - 1)) << bitPos;
+		value >>= segment;
+		bit += segment;
+		n -= segment;
+	}
 
-      length = length - segment;
-    }
-  }
+	nextbit->numberValue = bit;
 }
 
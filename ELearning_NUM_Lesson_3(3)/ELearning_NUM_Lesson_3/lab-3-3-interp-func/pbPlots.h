@@ -4,6 +4,7 @@
 #include <string.h>
 #include <wchar.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #define strparam(str) (str), wcslen(str)
 
@@ -15,8 +16,25 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
+typedef struct ArenaScope{
+  int64_t chunks;
+  int64_t used;
+  int64_t serial;
+} ArenaScope;
+
+typedef struct ArenaStatistics{
+  int64_t current;
+  int64_t maximum;
+  int64_t reserved;
+  int64_t allocations;
+} ArenaStatistics;
+
 void StartArenaAllocator();
 void FreeAllocations();
+void ResetAllocations();
+ArenaScope BeginArenaScope();
+void EndArenaScope(ArenaScope scope);
+void GetArenaStatistics(ArenaStatistics *stats);
 void *Allocate(int64_t size, int64_t e);
 void Free(void *addr);
 
@@ -110,6 +128,9 @@ typedef struct ByteArrayReference ByteArrayReference;
 struct ZLIBStruct;
 typedef struct ZLIBStruct ZLIBStruct;
 
+struct PNGStream;
+typedef struct PNGStream PNGStream;
+
 struct RGBABitmapImageReference{
   RGBABitmapImage *image;
 };
@@ -128,6 +149,8 @@ struct ScatterPlotSeries{
   wchar_t *lineType;
   size_t lineTypeLength;
   double lineThickness;
+  wchar_t *decimation;
+  size_t decimationLength;
   double *xs;
   size_t xsLength;
   double *ys;
@@ -272,6 +295,8 @@ struct PNGImage{
   ZLIBStruct *zlibStruct;
   _Bool physPresent;
   PHYS *phys;
+  uint32_t *palette;
+  size_t paletteLength;
 };
 
 struct DynamicArrayCharacters{
@@ -366,6 +391,9 @@ void DrawYLabelsForPriority(double p, double yMin, double ox, double yMax, doubl
 double *ComputeGridLinePositions(size_t *returnArrayLength, double cMin, double cMax, StringArrayReference *labels, NumberArrayReference *priorities);
 double MapYCoordinate(double y, double yMin, double yMax, double yPixelMin, double yPixelMax);
 double MapXCoordinate(double x, double xMin, double xMax, double xPixelMin, double xPixelMax);
+size_t DecimateMinMax(double *xs, double *ys, size_t n, double xMin, double xMax, double xPixelMin, double xPixelMax, double *xsOut, double *ysOut);
+size_t DecimateLTTB(double *xs, double *ys, size_t n, size_t threshold, double *xsOut, double *ysOut);
+size_t DecimateScatterPlotSeries(ScatterPlotSeries *sp, double xMin, double xMax, double yMin, double yMax, double xPixelMin, double xPixelMax, double yPixelMin, double yPixelMax, double **xsOut, double **ysOut);
 double MapXCoordinateAutoSettings(double x, RGBABitmapImage *image, double *xs, size_t xsLength);
 double MapYCoordinateAutoSettings(double y, RGBABitmapImage *image, double *ys, size_t ysLength);
 double MapXCoordinateBasedOnSettings(double x, ScatterPlotSettings *settings);
@@ -378,6 +406,9 @@ void DrawTextUpwards(RGBABitmapImage *canvas, double x, double y, wchar_t *text,
 ScatterPlotSettings *GetDefaultScatterPlotSettings();
 ScatterPlotSeries *GetDefaultScatterPlotSeriesSettings();
 _Bool DrawScatterPlot(RGBABitmapImageReference *canvasReference, double width, double height, double *xs, size_t xsLength, double *ys, size_t ysLength, StringReference *errorMessage);
+void DrawScatterPlotSeriesOnImage(RGBABitmapImage *canvas, ScatterPlotSeries *sp, double xMin, double xMax, double yMin, double yMax, double xPixelMin, double xPixelMax, double yPixelMin, double yPixelMax, NumberReference *patternOffset);
+void SetPlotThreads(double threads);
+void DrawScatterPlotSeriesLayers(RGBABitmapImage *canvas, ScatterPlotSettings *settings, double xMin, double xMax, double yMin, double yMax, double xPixelMin, double xPixelMax, double yPixelMin, double yPixelMax, NumberReference *patternOffset);
 _Bool DrawScatterPlotFromSettings(RGBABitmapImageReference *canvasReference, ScatterPlotSettings *settings, StringReference *errorMessage);
 void ComputeBoundariesBasedOnSettings(ScatterPlotSettings *settings, Rectangle *boundaries);
 _Bool ScatterPlotFromSettingsValid(ScatterPlotSettings *settings, StringReference *errorMessage);
@@ -409,6 +440,9 @@ RGBA *CreateRGBColor(double r, double g, double b);
 RGBA *CreateRGBAColor(double r, double g, double b, double a);
 
 RGBABitmapImage *CreateImage(double w, double h, RGBA *color);
+void FillImagePacked(RGBABitmapImage *image, uint32_t color);
+void FillRectanglePacked(RGBABitmapImage *image, int64_t x, int64_t y, int64_t w, int64_t h, uint32_t color);
+void ClearImage(RGBABitmapImage *image, RGBA *color);
 void DeleteImage(RGBABitmapImage *image);
 double ImageWidth(RGBABitmapImage *image);
 double ImageHeight(RGBABitmapImage *image);
@@ -432,6 +466,36 @@ void CubicBezierPoint(double x0, double y0, double c0x, double c0y, double c1x,
 RGBABitmapImage *CopyImage(RGBABitmapImage *image);
 RGBA *GetImagePixel(RGBABitmapImage *image, double x, double y);
 RGBA GetImagePixelStruct(RGBABitmapImage *image, double x, double y);
+
+/* Packed pixel access: pixels[y*xLength + x] = 0xRRGGBBAA. No bounds checks, no allocation. */
+static inline uint32_t PackRGBA(RGBA *color){
+  uint32_t r = (uint32_t)floor(color->r*255.0 + 0.5);
+  uint32_t g = (uint32_t)floor(color->g*255.0 + 0.5);
+  uint32_t b = (uint32_t)floor(color->b*255.0 + 0.5);
+  uint32_t a = (uint32_t)floor(color->a*255.0 + 0.5);
+
+  return (r << 24) | (g << 16) | (b << 8) | a;
+}
+static inline RGBA UnpackRGBA(uint32_t color){
+  RGBA rgba;
+
+  rgba.r = ((color >> 24) & 0xFF) / 255.0;
+  rgba.g = ((color >> 16) & 0xFF) / 255.0;
+  rgba.b = ((color >> 8) & 0xFF) / 255.0;
+  rgba.a = ((color >> 0) & 0xFF) / 255.0;
+
+  return rgba;
+}
+static inline void SetPixelPacked(RGBABitmapImage *image, size_t x, size_t y, uint32_t color){
+  image->pixels[y*image->xLength + x] = color;
+}
+static inline uint32_t GetPixelPacked(RGBABitmapImage *image, size_t x, size_t y){
+  return image->pixels[y*image->xLength + x];
+}
+static inline uint32_t *ImageRow(RGBABitmapImage *image, size_t y){
+  return image->pixels + y*image->xLength;
+}
+
 void HorizontalFlip(RGBABitmapImage *img);
 void DrawFilledRectangle(RGBABitmapImage *image, double x, double y, double w, double h, RGBA *color);
 RGBABitmapImage *RotateAntiClockwise90Degrees(RGBABitmapImage *image);
@@ -455,8 +519,9 @@ _Bool *GetLinePattern3(size_t *returnArrayLength);
 _Bool *GetLinePattern2(size_t *returnArrayLength);
 _Bool *GetLinePattern1(size_t *returnArrayLength);
 
+void SetBlurThreads(double threads);
 RGBABitmapImage *Blur(RGBABitmapImage *src, double pixels);
-RGBA *CreateBlurForPoint(RGBABitmapImage *src, double x, double y, double pixels);
+RGBABitmapImage *BlurGaussian(RGBABitmapImage *src, double sigma);
 
 wchar_t *CreateStringScientificNotationDecimalFromNumber(size_t *returnArrayLength, double decimal);
 wchar_t *CreateStringDecimalFromNumber(size_t *returnArrayLength, double decimal);
@@ -756,6 +821,14 @@ void Write2BytesLE(ByteArray *data, double b, NumberReference *position);
 void Write4BytesLE(ByteArray *data, double b, NumberReference *position);
 void Write2BytesBE(ByteArray *data, double b, NumberReference *position);
 void Write4BytesBE(ByteArray *data, double b, NumberReference *position);
+void WriteBytes(ByteArray *data, const uint8_t *bytes, size_t length, NumberReference *position);
+
+static inline void WriteUInt32BE(uint8_t *p, uint32_t v){
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
 void WriteStringBytes(ByteArray *data, wchar_t *cs, size_t csLength, NumberReference *position);
 double BytesRound(double x);
 double *ByteArrayToNumberArray(size_t *returnArrayLength, ByteArray *src);
@@ -780,9 +853,22 @@ double *MakeCRC32Table(size_t *returnArrayLength);
 double UpdateCRC32(double crc, ByteArray *buf, double *crc_table, size_t crc_tableLength);
 double CalculateCRC32(ByteArray *buf);
 double CRC32OfInterval(ByteArray *data, double from, double length);
+uint32_t CRC32Bytes(uint32_t crc, const uint8_t *bytes, size_t length);
+uint32_t Adler32Bytes(uint32_t adler, const uint8_t *bytes, size_t length);
 
 ZLIBStruct *ZLibCompressNoCompression(ByteArray *data);
 ZLIBStruct *ZLibCompressStaticHuffman(ByteArray *data, double level);
+ZLIBStruct *ZLibCompressDynamicHuffman(ByteArray *data, double level);
+ByteArray *DeflateDataDynamicHuffman(ByteArray *data, double level);
+void SetDeflateThreads(double threads);
+
+typedef void (*PNGRowCallback)(void *context, size_t y, uint32_t *row);
+PNGStream *PNGStreamOpen(FILE *file, size_t width, size_t height, double colorType, _Bool setPhys, double pixelsPerMeter, double compressionLevel);
+PNGStream *PNGStreamOpenFd(int fd, size_t width, size_t height, double colorType, _Bool setPhys, double pixelsPerMeter, double compressionLevel);
+_Bool PNGStreamWriteRow(PNGStream *stream, const uint32_t *pixels);
+_Bool PNGStreamClose(PNGStream *stream);
+_Bool WritePNGRows(FILE *file, size_t width, size_t height, double colorType, double compressionLevel, PNGRowCallback callback, void *context);
+_Bool WriteImageAsPNG(RGBABitmapImage *image, FILE *file, double colorType, double compressionLevel);
 
 wchar_t charToLowerCase(wchar_t character);
 wchar_t charToUpperCase(wchar_t character);
@@ -0,0 +1,406 @@
+/*
+ * interp.c - Tensor-Product Chebyshev Interpolation in 2-D and 3-D
+ *
+ * GENERAL OVERVIEW:
+ * This program extends the 1-D barycentric Lagrange interpolation of lab-3-4-interp-cheb to fields sampled
+ * on tensor grids, i.e. f(x,y) on (nx+1) x (ny+1) Chebyshev nodes or f(x,y,z) on (nx+1) x (ny+1) x (nz+1) nodes.
+ * - The interpolant is evaluated separably: one 1-D barycentric formula per dimension, contracting the sample
+ *   array one dimension at a time.
+ * - A batched driver evaluates many scattered query points with a single work buffer.
+ * - A grid driver evaluates a whole tensor grid of query points with successive 1-D contractions (mode products).
+ * - It outputs data files for plotting a 2-D field, its interpolant and the interpolation nodes.
+ *
+ * MATHEMATICAL BACKGROUND:
+ * - The tensor-product interpolant is p(x,y) = sum_i sum_j c_i(x) d_j(y) f(x_i, y_j), where c_i(x) and d_j(y) are
+ *   the 1-D Lagrange basis functions. In barycentric form c_i(x) = (w_i/(x-x_i)) / sum_k (w_k/(x-x_k)).
+ * - The coefficient vectors c(x), d(y) (and e(z) in 3-D) cost O(n) each, i.e. O(n) per dimension, instead of
+ *   building the O(n^d) products of Lagrange polynomials explicitly.
+ * - Contracting the last dimension first turns the d-dimensional sum into d nested 1-D dot products. Every sample
+ *   is still read once per query point, which is unavoidable for a scattered point, but no basis is ever formed.
+ * - For a query grid of m points per dimension, contracting one dimension for all query coordinates at once costs
+ *   O(m n^d + m^2 n^(d-1) + ...) instead of O(m^d n^d) for point-by-point evaluation.
+ */
+
+#include <stdio.h>  // For printf, FILE, fopen, fprintf, etc.
+#include <stdlib.h> // For EXIT_SUCCESS, EXIT_FAILURE, malloc, free, rand
+#include <math.h>   // For cos, acos, pow, fabs, exp
+#include <time.h>   // For clock (timing of the batched drivers)
+
+#define e 0.000000000000001 // Small epsilon for floating point comparison
+
+#define TENSOR_DIM_MAX 3 // Highest number of dimensions supported by TENSORGRID
+
+// Samples of a function on a tensor grid of interpolation nodes
+struct TENSORGRID
+{
+    int d;                          // Number of dimensions (2 or 3)
+    int n[TENSOR_DIM_MAX];          // Degree per dimension (n[k]+1 nodes along dimension k)
+    double *xnodes[TENSOR_DIM_MAX]; // Interpolation nodes per dimension
+    double *barw[TENSOR_DIM_MAX];   // Barycentric weights per dimension
+    double *fvals;                  // Samples, row-major: the last dimension varies fastest
+};
+
+// ClosedChebNodes: x_k = cos(pi*k/n), k = 0..n
+static void ClosedChebNodes(double xnodes[], int n)
+{
+    int k;
+    for (k=0; k<=n; k++)
+        xnodes[k] = cos(k*acos(-1.0)/n);
+}
+
+// ClosedChebBarWeights: alternating +1/-1 with 0.5 at the endpoints
+static void ClosedChebBarWeights(double w[], int n)
+{
+    int k;
+    w[0] = 0.5;
+    for (k=1; k<=n-1; k++)
+        w[k] = pow(-1.0, k);
+    w[n] = 0.5*pow(-1.0, n);
+}
+
+// BarycentricCoeffs: normalized 1-D Lagrange basis values at t
+// c[]: output, c[j] = (barw[j]/(t-xnodes[j])) / sum_k (barw[k]/(t-xnodes[k]))
+// xnodes[], n, barw[]: as in LagrangeInterp1D
+// t: evaluation point
+// sum_j c[j]*fvals[j] equals LagrangeInterp1D(fvals, xnodes, n, barw, t)
+static void BarycentricCoeffs(double c[], double xnodes[], int n, double barw[], double t)
+{
+    double denomt = 0.0; // Denominator of barycentric formula
+    int j;
+    for (j=0; j<=n; j++)
+    {
+        double tdiff = t - xnodes[j]; // Distance from t to node j
+        // If t is (numerically) equal to a node, the basis is the unit vector of that node
+        if (fabs(tdiff) < e)
+        {
+            int k;
+            for (k=0; k<=n; k++)
+                c[k] = 0.0;
+            c[j] = 1.0;
+            return;
+        }
+        c[j] = barw[j] / tdiff;
+        denomt += c[j];
+    }
+    for (j=0; j<=n; j++)
+        c[j] /= denomt;
+}
+
+// TensorGridSize: number of samples on the grid
+static long TensorGridSize(struct TENSORGRID *grid)
+{
+    long size = 1;
+    int k;
+    for (k=0; k<grid->d; k++)
+        size *= grid->n[k] + 1;
+    return size;
+}
+
+// TensorWorkSize: number of doubles LagrangeInterpTensor needs as work buffer
+// (one coefficient vector per dimension plus the samples left after contracting the last dimension)
+static long TensorWorkSize(struct TENSORGRID *grid)
+{
+    long size = 0;
+    int k;
+    for (k=0; k<grid->d; k++)
+        size += grid->n[k] + 1;
+    return size + TensorGridSize(grid) / (grid->n[grid->d-1] + 1);
+}
+
+// LagrangeInterpTensor: tensor-product barycentric interpolation at a single point
+// grid: nodes, weights and samples
+// t[]: evaluation point, one coordinate per dimension
+// work[]: buffer of TensorWorkSize(grid) doubles
+// Returns: interpolated value at t
+static double LagrangeInterpTensor(struct TENSORGRID *grid, double t[], double work[])
+{
+    double *c[TENSOR_DIM_MAX]; // Coefficient vector per dimension
+    double *s;                 // Partially contracted samples
+    long rows;                 // Number of rows left to contract
+    long r;
+    int k, j;
+
+    // O(n) per dimension: one 1-D barycentric coefficient vector each
+    double *p = work;
+    for (k=0; k<grid->d; k++)
+    {
+        c[k] = p;
+        BarycentricCoeffs(c[k], grid->xnodes[k], grid->n[k], grid->barw[k], t[k]);
+        p += grid->n[k] + 1;
+    }
+    s = p;
+
+    // Contract the last (contiguous) dimension: one dot product per row of samples
+    k = grid->d - 1;
+    rows = TensorGridSize(grid) / (grid->n[k] + 1);
+    for (r=0; r<rows; r++)
+    {
+        double *row = grid->fvals + r*(grid->n[k] + 1);
+        double sum = 0.0;
+        for (j=0; j<=grid->n[k]; j++)
+            sum += c[k][j] * row[j];
+        s[r] = sum;
+    }
+
+    // Contract the remaining dimensions in place, last to first
+    for (k=grid->d-2; k>=0; k--)
+    {
+        rows /= grid->n[k] + 1;
+        for (r=0; r<rows; r++)
+        {
+            double sum = 0.0;
+            for (j=0; j<=grid->n[k]; j++)
+                sum += c[k][j] * s[r*(grid->n[k] + 1) + j];
+            s[r] = sum;
+        }
+    }
+    return s[0];
+}
+
+// LagrangeInterpTensorBatch: interpolate at m scattered points
+// grid: nodes, weights and samples
+// tq[]: query points, m rows of grid->d coordinates
+// m: number of query points
+// out[]: interpolated values, m entries
+// Returns: 0 on success, -1 if the work buffer could not be allocated
+static int LagrangeInterpTensorBatch(struct TENSORGRID *grid, double tq[], long m, double out[])
+{
+    double *work = malloc(TensorWorkSize(grid) * sizeof(double)); // Shared by all query points
+    long i;
+    if (!work)
+        return -1;
+    for (i=0; i<m; i++)
+        out[i] = LagrangeInterpTensor(grid, tq + i*grid->d, work);
+    free(work);
+    return 0;
+}
+
+// LagrangeInterpTensorGrid: interpolate on a tensor grid of query points
+// grid: nodes, weights and samples
+// tq[k][]: query coordinates along dimension k, m[k] entries
+// m[]: number of query coordinates per dimension
+// out[]: interpolated values, row-major m[0] x ... x m[d-1]
+// Returns: 0 on success, -1 if a buffer could not be allocated
+static int LagrangeInterpTensorGrid(struct TENSORGRID *grid, double *tq[], int m[], double out[])
+{
+    long shape[TENSOR_DIM_MAX]; // Current shape of the partially contracted array
+    long size, maxsize = 0;     // Current and largest intermediate size
+    int k;
+
+    for (k=0; k<grid->d; k++)
+        shape[k] = grid->n[k] + 1;
+    size = TensorGridSize(grid);
+    maxsize = size;
+    for (k=0; k<grid->d; k++)
+    {
+        size = size / shape[k] * m[k];
+        if (size > maxsize)
+            maxsize = size;
+    }
+
+    double *bufa = malloc(maxsize * sizeof(double)); // Ping-pong buffers for the mode products
+    double *bufb = malloc(maxsize * sizeof(double));
+    if (!bufa || !bufb)
+    {
+        free(bufa);
+        free(bufb);
+        return -1;
+    }
+
+    double *src = grid->fvals;
+    double *dst = bufa;
+    for (k=0; k<grid->d; k++)
+    {
+        long nk = grid->n[k] + 1;
+        long outer = 1, inner = 1;
+        long a, b;
+        int i, j;
+        for (i=0; i<k; i++) outer *= shape[i];
+        for (i=k+1; i<grid->d; i++) inner *= shape[i];
+
+        // Coefficient matrix C (m[k] x nk), one barycentric row per query coordinate
+        double *C = malloc((long) m[k] * nk * sizeof(double));
+        if (!C)
+        {
+            free(bufa);
+            free(bufb);
+            return -1;
+        }
+        for (i=0; i<m[k]; i++)
+            BarycentricCoeffs(C + i*nk, grid->xnodes[k], grid->n[k], grid->barw[k], tq[k][i]);
+
+        // Mode-k product: dst[a][i][b] = sum_j C[i][j] * src[a][j][b]
+        double *res = (k == grid->d-1) ? out : dst;
+        for (a=0; a<outer; a++)
+        {
+            for (i=0; i<m[k]; i++)
+            {
+                double *d_ab = res + (a*m[k] + i)*inner;
+                for (b=0; b<inner; b++)
+                    d_ab[b] = 0.0;
+                for (j=0; j<nk; j++)
+                {
+                    double cij = C[i*nk + j];
+                    double *s_ab = src + (a*nk + j)*inner;
+                    for (b=0; b<inner; b++)
+                        d_ab[b] += cij * s_ab[b];
+                }
+            }
+        }
+        free(C);
+
+        shape[k] = m[k];
+        src = res;
+        dst = (res == bufa) ? bufb : bufa;
+    }
+
+    free(bufa);
+    free(bufb);
+    return 0;
+}
+
+// f2(x,y): 2-D function to interpolate, a radial version of the Runge function
+static double f2(double x, double y)
+{
+    return 1.0/(1.0 + 16.0*(x*x + y*y));
+}
+
+// f3(x,y,z): smooth 3-D function to interpolate
+static double f3(double x, double y, double z)
+{
+    return exp(-x*x - 2.0*y*y) * cos(z + x*y);
+}
+
+// Uniform random number in [-1,1]
+static double urand(void)
+{
+    return -1.0 + 2.0*rand()/RAND_MAX;
+}
+
+int main(void)
+{
+    int n = 32; // Degree per dimension of the interpolating polynomial (number of nodes - 1)
+    int i, j, k;
+    // ClosedChebNodes and ClosedChebBarWeights, shared by all dimensions
+    double xnodes[n+1];
+    double w[n+1];
+    ClosedChebNodes(xnodes, n);
+    ClosedChebBarWeights(w, n);
+
+    // --- 2-D: sample f2 on the (n+1) x (n+1) Chebyshev grid ---
+    double *f2_sample = malloc((n+1)*(n+1)*sizeof(double));
+    if (!f2_sample)
+        return EXIT_FAILURE;
+    for (i=0; i<=n; i++)
+        for (j=0; j<=n; j++)
+            f2_sample[i*(n+1) + j] = f2(xnodes[i], xnodes[j]);
+    struct TENSORGRID grid2 = { 2, { n, n, 0 }, { xnodes, xnodes, NULL }, { w, w, NULL }, f2_sample };
+
+    // Test interpolation at (-1.0, -1.0)
+    double t2[2] = { -1.0, -1.0 };
+    double work2[TensorWorkSize(&grid2)];
+    double f_interp = LagrangeInterpTensor(&grid2, t2, work2);
+    printf("LagrangeInterpTensor(% 1.2f, % 1.2f) = % 1.2f\n", t2[0], t2[1], f_interp);
+
+    // Batched evaluation at random scattered points
+    long m = 100000; // Number of scattered query points
+    double *tq = malloc(3*m*sizeof(double));
+    double *fq = malloc(m*sizeof(double));
+    if (!tq || !fq)
+        return EXIT_FAILURE;
+    srand(1);
+    for (i=0; i<2*m; i++)
+        tq[i] = urand();
+    clock_t c0 = clock();
+    if (LagrangeInterpTensorBatch(&grid2, tq, m, fq))
+        return EXIT_FAILURE;
+    clock_t c1 = clock();
+    double maxerr = 0.0;
+    for (i=0; i<m; i++)
+        maxerr = fmax(maxerr, fabs(fq[i] - f2(tq[2*i], tq[2*i+1])));
+    printf("2-D batch: %ld points, %.1f ns/point, max error %.3e\n",
+           m, 1e9*(c1 - c0)/CLOCKS_PER_SEC/m, maxerr);
+
+    // --- 2-D: grid evaluation for plotting ---
+    int Nplot = 100; // Number of plot intervals per dimension
+    double tplot[Nplot+1];
+    for (i=0; i<=Nplot; i++)
+        tplot[i] = -1.0 + 2.0 * i / Nplot; // Uniform points in [-1,1]
+    double *tgrid[2] = { tplot, tplot };
+    int mgrid[2] = { Nplot+1, Nplot+1 };
+    double *fplot = malloc((Nplot+1)*(Nplot+1)*sizeof(double));
+    if (!fplot)
+        return EXIT_FAILURE;
+    c0 = clock();
+    if (LagrangeInterpTensorGrid(&grid2, tgrid, mgrid, fplot))
+        return EXIT_FAILURE;
+    c1 = clock();
+    maxerr = 0.0;
+    for (i=0; i<=Nplot; i++)
+        for (j=0; j<=Nplot; j++)
+            maxerr = fmax(maxerr, fabs(fplot[i*(Nplot+1) + j] - f2(tplot[i], tplot[j])));
+    printf("2-D grid : %d points, %.1f ns/point, max error %.3e\n",
+           (Nplot+1)*(Nplot+1), 1e9*(c1 - c0)/CLOCKS_PER_SEC/((Nplot+1)*(Nplot+1)), maxerr);
+
+    // --- 3-D: sample f3 on a (n+1)^3 Chebyshev grid ---
+    double *f3_sample = malloc((long) (n+1)*(n+1)*(n+1)*sizeof(double));
+    if (!f3_sample)
+        return EXIT_FAILURE;
+    for (i=0; i<=n; i++)
+        for (j=0; j<=n; j++)
+            for (k=0; k<=n; k++)
+                f3_sample[(i*(n+1) + j)*(n+1) + k] = f3(xnodes[i], xnodes[j], xnodes[k]);
+    struct TENSORGRID grid3 = { 3, { n, n, n }, { xnodes, xnodes, xnodes }, { w, w, w }, f3_sample };
+
+    m = 10000;
+    for (i=0; i<3*m; i++)
+        tq[i] = urand();
+    c0 = clock();
+    if (LagrangeInterpTensorBatch(&grid3, tq, m, fq))
+        return EXIT_FAILURE;
+    c1 = clock();
+    maxerr = 0.0;
+    for (i=0; i<m; i++)
+        maxerr = fmax(maxerr, fabs(fq[i] - f3(tq[3*i], tq[3*i+1], tq[3*i+2])));
+    printf("3-D batch: %ld points, %.1f ns/point, max error %.3e\n",
+           m, 1e9*(c1 - c0)/CLOCKS_PER_SEC/m, maxerr);
+
+    // --- Output data for plotting ---
+    FILE *fp = fopen("interp_plot.dat", "w"); // Open file for plot data
+    if (!fp) {
+        perror("Could not open interp_plot.dat for writing");
+        return EXIT_FAILURE;
+    }
+    for (i=0; i<=Nplot; i++) {
+        for (j=0; j<=Nplot; j++)
+            fprintf(fp, "% .10f % .10f % .10f % .10f\n", tplot[i], tplot[j],
+                    f2(tplot[i], tplot[j]), fplot[i*(Nplot+1) + j]); // x, y, true value, interpolated value
+        fprintf(fp, "\n"); // Blank line between rows for gnuplot splot
+    }
+    fclose(fp);
+
+    // Output nodes for plotting
+    FILE *fpn = fopen("interp_nodes.dat", "w"); // Open file for node data
+    if (!fpn) {
+        perror("Could not open interp_nodes.dat for writing");
+        return EXIT_FAILURE;
+    }
+    for (i=0; i<=n; i++)
+        for (j=0; j<=n; j++)
+            fprintf(fpn, "% .10f % .10f % .10f\n", xnodes[i], xnodes[j], f2_sample[i*(n+1) + j]); // Write node and value
+    fclose(fpn);
+
+    free(f2_sample);
+    free(f3_sample);
+    free(fplot);
+    free(tq);
+    free(fq);
+
+    // Print plotting instructions
+    printf("Data for plotting written to interp_plot.dat and interp_nodes.dat\n");
+    printf("You can plot with gnuplot using:\n");
+    printf("  gnuplot -persist -e \"splot 'interp_plot.dat' u 1:2:4 w l title 'Interpolation', \\\n");
+    printf("    'interp_nodes.dat' u 1:2:3 w p pt 7 ps 0.5 lc rgb 'red' title 'Nodes'\"\n");
+
+    return EXIT_SUCCESS;
+}
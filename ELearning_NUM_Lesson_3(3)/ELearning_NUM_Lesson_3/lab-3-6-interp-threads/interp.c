@@ -0,0 +1,371 @@
+/*
+ * interp.c - Multithreaded Bulk Chebyshev Interpolation
+ *
+ * GENERAL OVERVIEW:
+ * This program evaluates the Chebyshev interpolant of lab-3-4-interp-cheb at very large query sets.
+ * - A small pthread pool is started once and reused for every evaluation; each run uses the first p of its
+ *   workers, so the runs with 1, 2, 4, ... threads do not pay for starting threads.
+ * - The query array is cut into fixed-size chunks; idle threads grab the next chunk from a shared counter
+ *   and write the interpolated values in place into the output array.
+ * - Each thread records how many points it evaluated and how long it worked, so the per-thread throughput
+ *   can be reported after every run.
+ * - The results are compared bit for bit against a single-threaded run.
+ *
+ * DETERMINISM:
+ * - Every output value out[i] depends only on t[i] and is computed by the same LagrangeInterp1D call,
+ *   regardless of which thread handles its chunk. There are no shared reductions, so the results are
+ *   identical for any number of threads and any chunk schedule.
+ * - The query points are generated from their index, t_i = -1 + 2*i/(m-1), instead of accumulating
+ *   t += dt as the plotting loops do, so the query set itself does not depend on the evaluation order.
+ *
+ * USAGE:
+ *   ./interp [m] [threads]
+ *   m: number of query points (default 2000000), threads: pool size (default: number of online CPUs)
+ */
+
+#define _POSIX_C_SOURCE 200809L // For clock_gettime and sysconf
+
+#include <stdio.h>   // For printf, FILE, fopen, fprintf, etc.
+#include <stdlib.h>  // For EXIT_SUCCESS, EXIT_FAILURE, malloc, atol
+#include <string.h>  // For memcmp
+#include <math.h>    // For cos, acos, pow, fabs
+#include <time.h>    // For clock_gettime
+#include <unistd.h>  // For sysconf
+#include <pthread.h> // For the thread pool
+
+#define e 0.000000000000001 // Small epsilon for floating point comparison
+
+#define INTERP_CHUNK 4096 // Query points per chunk handed to a thread
+
+// LagrangeInterp1D: Barycentric Lagrange interpolation formula
+// fvals[]: function values at nodes
+// xnodes[]: interpolation nodes
+// n: degree (number of nodes - 1)
+// barw[]: barycentric weights
+// t: evaluation point
+// Returns: interpolated value at t
+static double LagrangeInterp1D(double fvals[], double xnodes[], int n, double barw[], double t)
+{
+    double numt = 0.0;   // Numerator of barycentric formula
+    double denomt = 0.0; // Denominator of barycentric formula
+    int j;
+    for (j=0; j<=n; j++)
+    {
+        double tdiff = t - xnodes[j]; // Distance from t to node j
+        numt += barw[j] / tdiff * fvals[j]; // Add weighted contribution to numerator
+        denomt += + barw[j] / tdiff;        // Add weighted contribution to denominator
+        // If t is (numerically) equal to a node, return f(node)
+        if (fabs(tdiff) < e)
+        {
+            numt = fvals[j];
+            denomt = 1.0;
+            break;
+        }
+    }
+    return numt / denomt; // Barycentric interpolation value
+}
+
+// One bulk evaluation: interpolant data, query array and the shared chunk counter
+struct INTERPJOB
+{
+    double *fvals;  // Function values at nodes
+    double *xnodes; // Interpolation nodes
+    double *barw;   // Barycentric weights
+    int n;          // Degree
+    double *t;      // Query points, m entries
+    double *out;    // Interpolated values, written in place, m entries
+    long m;         // Number of query points
+    long next;      // First query index not yet handed out (atomic)
+};
+
+// Work done by one thread during the last run
+struct THREADSTATS
+{
+    long points;    // Number of query points evaluated
+    double seconds; // Wall time spent evaluating
+};
+
+// Persistent pool of worker threads
+struct INTERPPOOL
+{
+    int nthreads;              // Number of worker threads
+    pthread_t *threads;        // Thread handles
+    struct THREADSTATS *stats; // Per-thread statistics of the last run
+    struct WORKERARG *args;    // Per-thread arguments, owned by the pool
+    pthread_mutex_t lock;      // Protects the fields below
+    pthread_cond_t start;      // Signalled when a new job is posted
+    pthread_cond_t done;       // Signalled when the last worker finishes
+    struct INTERPJOB *job;     // Current job
+    long generation;           // Incremented for every posted job
+    int use;                   // Workers taking part in the current job (the first use of them)
+    int active;                // Workers still busy with the current job
+    int stop;                  // Set to terminate the workers
+};
+
+// Argument handed to each worker thread
+struct WORKERARG
+{
+    struct INTERPPOOL *pool; // Owning pool
+    int id;                  // Index of the worker in pool->stats
+};
+
+// Monotonic wall clock in seconds
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+// Evaluate chunks of the job until the query array is exhausted
+// Returns: number of points evaluated by the caller
+static long InterpChunks(struct INTERPJOB *job)
+{
+    long points = 0;
+    for (;;)
+    {
+        long first = __atomic_fetch_add(&job->next, INTERP_CHUNK, __ATOMIC_RELAXED); // Claim the next chunk
+        long last = first + INTERP_CHUNK;
+        long i;
+        if (first >= job->m)
+            break;
+        if (last > job->m)
+            last = job->m;
+        for (i=first; i<last; i++)
+            job->out[i] = LagrangeInterp1D(job->fvals, job->xnodes, job->n, job->barw, job->t[i]);
+        points += last - first;
+    }
+    return points;
+}
+
+// Worker thread: wait for a job, evaluate chunks if it takes part, report, repeat
+static void *InterpWorker(void *p)
+{
+    struct WORKERARG *arg = p;
+    struct INTERPPOOL *pool = arg->pool;
+    long seen = 0; // Last job generation handled by this worker
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->generation == seen && !pool->stop)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stop)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        seen = pool->generation;
+        struct INTERPJOB *job = pool->job;
+        int use = arg->id < pool->use;
+        pthread_mutex_unlock(&pool->lock);
+        if (!use)
+            continue;
+
+        double t0 = now();
+        long points = InterpChunks(job);
+        pool->stats[arg->id].points = points;
+        pool->stats[arg->id].seconds = now() - t0;
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->active == 0)
+            pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return NULL;
+}
+
+// InterpPoolCreate: start a pool of nthreads workers
+// Returns: the pool, or NULL if it could not be created
+static struct INTERPPOOL *InterpPoolCreate(int nthreads)
+{
+    struct INTERPPOOL *pool = calloc(1, sizeof(struct INTERPPOOL));
+    int k;
+    if (!pool)
+        return NULL;
+    pool->nthreads = nthreads;
+    pool->threads = calloc(nthreads, sizeof(pthread_t));
+    pool->stats = calloc(nthreads, sizeof(struct THREADSTATS));
+    pool->args = calloc(nthreads, sizeof(struct WORKERARG));
+    if (!pool->threads || !pool->stats || !pool->args)
+    {
+        free(pool->threads);
+        free(pool->stats);
+        free(pool->args);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (k=0; k<nthreads; k++)
+    {
+        pool->args[k].pool = pool;
+        pool->args[k].id = k;
+        if (pthread_create(&pool->threads[k], NULL, InterpWorker, &pool->args[k]))
+        {
+            pool->nthreads = k; // Keep the workers that did start
+            break;
+        }
+    }
+    if (pool->nthreads == 0)
+    {
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->start);
+        pthread_cond_destroy(&pool->done);
+        free(pool->threads);
+        free(pool->stats);
+        free(pool->args);
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+// InterpPoolRun: evaluate the interpolant at all query points of job, in place, with the first nuse workers
+// Blocks until every chunk is done; per-thread statistics of those workers are left in pool->stats
+// Returns: the number of workers used
+static int InterpPoolRun(struct INTERPPOOL *pool, struct INTERPJOB *job, int nuse)
+{
+    if (nuse > pool->nthreads)
+        nuse = pool->nthreads;
+    job->next = 0;
+    pthread_mutex_lock(&pool->lock);
+    pool->job = job;
+    pool->use = nuse;
+    pool->active = nuse;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    while (pool->active > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+    return nuse;
+}
+
+// InterpPoolDestroy: stop and join the workers, free the pool
+static void InterpPoolDestroy(struct INTERPPOOL *pool)
+{
+    int k;
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (k=0; k<pool->nthreads; k++)
+        pthread_join(pool->threads[k], NULL);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool->stats);
+    free(pool->args);
+    free(pool);
+}
+
+// f(x): Function to interpolate
+// Here, f(x) = 1/(1+16x^2), a classic test function for interpolation
+static double f(double x)
+{
+    return 1.0/(1.0 + 16.0*x*x);
+}
+
+int main(int argc, char *argv[])
+{
+    long m = (argc > 1) ? atol(argv[1]) : 2000000; // Number of query points
+    int nthreads = (argc > 2) ? atoi(argv[2]) : (int) sysconf(_SC_NPROCESSORS_ONLN); // Pool size
+    if (m < 2 || nthreads < 1)
+    {
+        fprintf(stderr, "usage: %s [m >= 2] [threads >= 1]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int n = 32; // Degree of interpolating polynomial (number of nodes - 1)
+    int k;
+    // ClosedChebNodes: Compute Chebyshev nodes on [-1,1]
+    double xnodes[n+1];
+    for (k=0; k<=n; k++) xnodes[k] = k; // Initialize with indices
+    for (k=0; k<=n; k++) xnodes[k] = cos(xnodes[k]*acos(-1.0)/n); // Chebyshev nodes formula
+    // ClosedChebBarWeights: Compute barycentric weights for Chebyshev nodes
+    double w[n+1];
+    w[0] = 0.5; // Endpoints get weight 0.5
+    for (k=1; k<=n-1; k++)
+        w[k] = pow(-1.0, k); // Interior nodes alternate +1/-1
+    w[n] = 0.5*pow(-1.0, n); // Last endpoint weight
+    // Sample f at nodes
+    double f_sample[n+1];
+    for (k=0; k<=n; k++)
+        f_sample[k] = f(xnodes[k]);
+
+    // Query points from their index, independent of evaluation order
+    double *t = malloc(m*sizeof(double));
+    double *ref = malloc(m*sizeof(double)); // Single-threaded reference
+    double *out = malloc(m*sizeof(double)); // Parallel result
+    if (!t || !ref || !out)
+    {
+        fprintf(stderr, "Could not allocate %ld query points\n", m);
+        return EXIT_FAILURE;
+    }
+    long i;
+    for (i=0; i<m; i++)
+        t[i] = -1.0 + 2.0 * i / (m - 1);
+
+    struct INTERPJOB job = { f_sample, xnodes, w, n, t, ref, m, 0 };
+
+    // Reference run on the calling thread
+    double t0 = now();
+    InterpChunks(&job);
+    job.next = 0;
+    double tref = now() - t0;
+    printf("serial   : %ld points in %.3f s, %.1f Mpoints/s\n", m, tref, 1e-6*m/tref);
+
+    // Parallel runs with 1, 2, 4, ... threads up to nthreads, all on the same pool
+    struct INTERPPOOL *pool = InterpPoolCreate(nthreads);
+    if (!pool)
+    {
+        fprintf(stderr, "Could not start a pool of %d threads\n", nthreads);
+        return EXIT_FAILURE;
+    }
+    int p;
+    for (p=1; ; p = (2*p < pool->nthreads) ? 2*p : pool->nthreads)
+    {
+        job.out = out;
+        t0 = now();
+        int used = InterpPoolRun(pool, &job, p);
+        double tpar = now() - t0;
+
+        printf("%2d threads: %ld points in %.3f s, %.1f Mpoints/s, %s\n", used, m, tpar, 1e-6*m/tpar,
+               memcmp(out, ref, m*sizeof(double)) ? "results DIFFER from serial run" : "bitwise identical to serial run");
+        for (k=0; k<used; k++)
+        {
+            struct THREADSTATS *s = &pool->stats[k];
+            printf("    thread %2d: %10ld points, %.3f s, %.1f Mpoints/s\n", k, s->points, s->seconds,
+                   s->seconds > 0.0 ? 1e-6*s->points/s->seconds : 0.0);
+        }
+        if (p >= pool->nthreads)
+            break;
+    }
+    InterpPoolDestroy(pool);
+
+    // --- Output data for plotting ---
+    FILE *fp = fopen("interp_plot.dat", "w"); // Open file for plot data
+    if (!fp) {
+        perror("Could not open interp_plot.dat for writing");
+        return EXIT_FAILURE;
+    }
+    int Nplot = 500; // Number of plot points
+    long stride = (m - 1) / Nplot > 0 ? (m - 1) / Nplot : 1;
+    for (i = 0; i < m; i += stride)
+        fprintf(fp, "% .10f % .10f % .10f\n", t[i], f(t[i]), out[i]); // Write to file
+    fclose(fp);
+
+    free(t);
+    free(ref);
+    free(out);
+
+    // Print plotting instructions
+    printf("Data for plotting written to interp_plot.dat\n");
+    printf("You can plot with gnuplot using:\n");
+    printf("  gnuplot -persist -e \"plot 'interp_plot.dat' u 1:2 w l title 'f(x)', \\\n");
+    printf("    'interp_plot.dat' u 1:3 w l title 'Interpolation'\"\n");
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,443 @@
+/*
+ * interp.c - Fast Multipole Evaluation of the Barycentric Interpolation Formula
+ *
+ * GENERAL OVERVIEW:
+ * Evaluating LagrangeInterp1D at m targets with n+1 nodes costs O(n*m). This program evaluates the same
+ * interpolant with a one-dimensional fast multipole method (FMM) in O(n + m) for a user-specified accuracy.
+ * - Both sums of the barycentric formula are kernel sums with the kernel 1/(t - x_j):
+ *       N(t) = sum_j (w_j f_j)/(t - x_j),   D(t) = sum_j w_j/(t - x_j),   p(t) = N(t)/D(t)
+ * - The FMM computes N and D together, treating w_j f_j and w_j as two sets of charges at the nodes x_j.
+ * - Small problems fall back to direct summation with LagrangeInterp1D.
+ * - The program compares the FMM with direct summation for several tolerances and prints timings.
+ *
+ * MATHEMATICAL BACKGROUND (Chebyshev-proxy / black-box FMM):
+ * - The interval holding all nodes and targets is split into a binary tree of 2^L leaf boxes.
+ * - For two boxes separated by at least one box width, 1/(t - x) is smooth in both variables and is
+ *   replaced by its interpolant on p Chebyshev points per box. Its error decays like (3 + sqrt(8))^-p,
+ *   so p = log(1/tol)/log(3 + sqrt(8)) + 1 proxy points reach the tolerance tol.
+ * - Upward pass:   the charges of each leaf are interpolated onto its p proxy points (P2M) and merged
+ *                  into the parents (M2M).
+ * - Interactions:  each box receives the proxy potential of the at most 3 well-separated children of its
+ *                  parent's neighbours (M2L); the p x p matrices only depend on the offset of the boxes.
+ * - Downward pass: proxy potentials are interpolated to the children (L2L) and finally to the targets (L2P).
+ * - Near field:    targets sum the charges of their own and the two adjacent leaves directly (P2P); this is
+ *                  also where a target that coincides with a node is detected.
+ * - Cost: O(p*(n + m)) for P2M, L2P and O(n + m) for P2P with O(1) points per leaf, plus O(p^2) per box.
+ */
+
+#include <stdio.h>  // For printf, FILE, fopen, fprintf, etc.
+#include <stdlib.h> // For EXIT_SUCCESS, EXIT_FAILURE, malloc, calloc, rand
+#include <math.h>   // For cos, sin, acos, pow, fabs, log, sqrt, ceil
+#include <time.h>   // For clock
+
+#define e 0.000000000000001 // Small epsilon for floating point comparison
+
+#define FMM_LEAF 64               // Average number of nodes and targets per leaf box
+#define FMM_MAXLEVEL 20           // Deepest tree level
+#define FMM_DIRECT_MAX 4000000L   // Up to this many node-target pairs direct summation is used
+#define FMM_PMIN 4                // Fewest proxy points per box
+#define FMM_PMAX 40               // Most proxy points per box
+
+// LagrangeInterp1D: Barycentric Lagrange interpolation formula
+// fvals[]: function values at nodes
+// xnodes[]: interpolation nodes
+// n: degree (number of nodes - 1)
+// barw[]: barycentric weights
+// t: evaluation point
+// Returns: interpolated value at t
+static double LagrangeInterp1D(double fvals[], double xnodes[], int n, double barw[], double t)
+{
+    double numt = 0.0;   // Numerator of barycentric formula
+    double denomt = 0.0; // Denominator of barycentric formula
+    int j;
+    for (j=0; j<=n; j++)
+    {
+        double tdiff = t - xnodes[j]; // Distance from t to node j
+        numt += barw[j] / tdiff * fvals[j]; // Add weighted contribution to numerator
+        denomt += + barw[j] / tdiff;        // Add weighted contribution to denominator
+        // If t is (numerically) equal to a node, return f(node)
+        if (fabs(tdiff) < e)
+        {
+            numt = fvals[j];
+            denomt = 1.0;
+            break;
+        }
+    }
+    return numt / denomt; // Barycentric interpolation value
+}
+
+// Proxy points of a box: p Chebyshev points of the first kind on [-1,1] and their barycentric weights
+static void ChebProxy(double z[], double zw[], int p)
+{
+    int k;
+    for (k=0; k<p; k++)
+    {
+        z[k] = cos((2*k + 1)*acos(-1.0)/(2*p));
+        zw[k] = pow(-1.0, k) * sin((2*k + 1)*acos(-1.0)/(2*p));
+    }
+}
+
+// ProxyCoeffs: Lagrange basis of the p proxy points evaluated at u in [-1,1]
+static void ProxyCoeffs(double S[], double z[], double zw[], int p, double u)
+{
+    double denomt = 0.0;
+    int k;
+    for (k=0; k<p; k++)
+    {
+        double udiff = u - z[k];
+        if (fabs(udiff) < e) // u is a proxy point: unit basis vector
+        {
+            int j;
+            for (j=0; j<p; j++)
+                S[j] = 0.0;
+            S[k] = 1.0;
+            return;
+        }
+        S[k] = zw[k] / udiff;
+        denomt += S[k];
+    }
+    for (k=0; k<p; k++)
+        S[k] /= denomt;
+}
+
+// Sort point indices into the leaf boxes of width h starting at lo (counting sort)
+// start[]: nleaves+1 offsets into idx[], idx[]: point indices grouped by leaf
+// Returns: 0 on success, -1 if memory could not be allocated
+static int BinPoints(double x[], long cnt, double lo, double h, int nleaves, long start[], long idx[])
+{
+    long i;
+    int b;
+    for (b=0; b<=nleaves; b++)
+        start[b] = 0;
+    for (i=0; i<cnt; i++)
+    {
+        b = (int) ((x[i] - lo) / h);
+        if (b < 0) b = 0;
+        if (b >= nleaves) b = nleaves - 1;
+        start[b+1]++;
+    }
+    for (b=0; b<nleaves; b++)
+        start[b+1] += start[b];
+    long *fill = malloc(nleaves * sizeof(long)); // Next free slot per leaf
+    if (!fill)
+        return -1;
+    for (b=0; b<nleaves; b++)
+        fill[b] = start[b];
+    for (i=0; i<cnt; i++)
+    {
+        b = (int) ((x[i] - lo) / h);
+        if (b < 0) b = 0;
+        if (b >= nleaves) b = nleaves - 1;
+        idx[fill[b]++] = i;
+    }
+    free(fill);
+    return 0;
+}
+
+// FastInterp1D: evaluate the barycentric interpolant at m targets with the FMM
+// fvals[], xnodes[], n, barw[]: as in LagrangeInterp1D
+// t[]: targets, m entries
+// out[]: interpolated values, m entries
+// tol: requested accuracy of the far-field sums relative to sum_j |w_j f_j|/|t - x_j|
+// Returns: 0 on success, -1 if memory could not be allocated
+static int FastInterp1D(double fvals[], double xnodes[], int n, double barw[], double t[], long m, double out[], double tol)
+{
+    long N = n + 1; // Number of nodes
+    long i, j;
+    int b, c, k, l;
+
+    // Small problems: direct summation
+    if (N * m <= FMM_DIRECT_MAX)
+    {
+        for (i=0; i<m; i++)
+            out[i] = LagrangeInterp1D(fvals, xnodes, n, barw, t[i]);
+        return 0;
+    }
+
+    // Number of proxy points for the requested accuracy
+    int p = (int) ceil(log(1.0/tol) / log(3.0 + sqrt(8.0))) + 1;
+    if (p < FMM_PMIN) p = FMM_PMIN;
+    if (p > FMM_PMAX) p = FMM_PMAX;
+
+    // Domain [lo, hi] holding all nodes and targets, and tree depth
+    double lo = xnodes[0], hi = xnodes[0];
+    for (j=0; j<N; j++)
+    {
+        if (xnodes[j] < lo) lo = xnodes[j];
+        if (xnodes[j] > hi) hi = xnodes[j];
+    }
+    for (i=0; i<m; i++)
+    {
+        if (t[i] < lo) lo = t[i];
+        if (t[i] > hi) hi = t[i];
+    }
+    int L = 2;
+    while (L < FMM_MAXLEVEL && N + m > (long) FMM_LEAF << L)
+        L++;
+    int nleaves = 1 << L;
+    double h = (hi - lo) / nleaves; // Leaf box width
+
+    // Proxy points and the translation operators, which are the same for every box and level
+    double z[FMM_PMAX], zw[FMM_PMAX], S[FMM_PMAX];
+    ChebProxy(z, zw, p);
+    double *T0 = malloc(p*p*sizeof(double)); // T0[k*p+kc]: parent basis k at proxy point kc of the left child
+    double *T1 = malloc(p*p*sizeof(double)); // Same for the right child
+    double *M = malloc(4*p*p*sizeof(double)); // M2L for box offsets -3, -2, +2, +3 on a box of radius 1
+    long *srcstart = malloc((nleaves + 1) * sizeof(long));
+    long *srcidx = malloc(N * sizeof(long));
+    long *tgtstart = malloc((nleaves + 1) * sizeof(long));
+    long *tgtidx = malloc(m * sizeof(long));
+    double *Q = calloc((long) 2*nleaves * 2*p, sizeof(double));   // Proxy charges, all levels
+    double *Loc = calloc((long) 2*nleaves * 2*p, sizeof(double)); // Proxy potentials, all levels
+    if (!T0 || !T1 || !M || !srcstart || !srcidx || !tgtstart || !tgtidx || !Q || !Loc
+        || BinPoints(xnodes, N, lo, h, nleaves, srcstart, srcidx)
+        || BinPoints(t, m, lo, h, nleaves, tgtstart, tgtidx))
+    {
+        free(T0); free(T1); free(M); free(srcstart); free(srcidx);
+        free(tgtstart); free(tgtidx); free(Q); free(Loc);
+        return -1;
+    }
+    for (k=0; k<p; k++)
+    {
+        ProxyCoeffs(S, z, zw, p, -0.5 + 0.5*z[k]);
+        for (j=0; j<p; j++) T0[j*p + k] = S[j];
+        ProxyCoeffs(S, z, zw, p, 0.5 + 0.5*z[k]);
+        for (j=0; j<p; j++) T1[j*p + k] = S[j];
+    }
+    int offsets[4] = { -3, -2, 2, 3 };
+    for (c=0; c<4; c++)
+        for (k=0; k<p; k++)
+            for (j=0; j<p; j++)
+                M[(c*p + k)*p + j] = 1.0 / (z[k] - z[j] - 2.0*offsets[c]); // Target proxy k, source proxy j
+
+    // Level l occupies boxes [2^l, 2^(l+1)) of Q and Loc; box b holds 2 channels of p values:
+    // channel 0 carries the charges w_j f_j (numerator), channel 1 the charges w_j (denominator)
+#define BOX(A, l, b, c) ((A) + (((long) (1 << (l)) + (b))*2 + (c))*p)
+
+    // P2M: charges of each leaf onto its proxy points
+    double r = h / 2.0; // Leaf box radius
+    for (b=0; b<nleaves; b++)
+    {
+        double center = lo + (2*b + 1)*r;
+        double *q0 = BOX(Q, L, b, 0), *q1 = BOX(Q, L, b, 1);
+        for (i=srcstart[b]; i<srcstart[b+1]; i++)
+        {
+            j = srcidx[i];
+            ProxyCoeffs(S, z, zw, p, (xnodes[j] - center) / r);
+            for (k=0; k<p; k++)
+            {
+                q0[k] += S[k] * barw[j] * fvals[j];
+                q1[k] += S[k] * barw[j];
+            }
+        }
+    }
+
+    // M2M: merge children into parents, finest to coarsest
+    for (l=L-1; l>=2; l--)
+        for (b=0; b<(1 << l); b++)
+            for (c=0; c<2; c++)
+            {
+                double *qp = BOX(Q, l, b, c);
+                double *ql = BOX(Q, l+1, 2*b, c), *qr = BOX(Q, l+1, 2*b+1, c);
+                for (k=0; k<p; k++)
+                {
+                    double sum = 0.0;
+                    for (j=0; j<p; j++)
+                        sum += T0[k*p + j]*ql[j] + T1[k*p + j]*qr[j];
+                    qp[k] = sum;
+                }
+            }
+
+    // M2L: well-separated children of the parent's neighbours
+    for (l=2; l<=L; l++)
+    {
+        double rl = (hi - lo) / (1 << (l + 1)); // Box radius on level l
+        for (b=0; b<(1 << l); b++)
+        {
+            int o;
+            for (o=0; o<4; o++)
+            {
+                int src = b + offsets[o];
+                if (src < 0 || src >= (1 << l) || src/2 - b/2 > 1 || b/2 - src/2 > 1)
+                    continue;
+                for (c=0; c<2; c++)
+                {
+                    double *lc = BOX(Loc, l, b, c), *qs = BOX(Q, l, src, c);
+                    for (k=0; k<p; k++)
+                    {
+                        double sum = 0.0;
+                        for (j=0; j<p; j++)
+                            sum += M[(o*p + k)*p + j] * qs[j];
+                        lc[k] += sum / rl;
+                    }
+                }
+            }
+        }
+    }
+
+    // L2L: interpolate proxy potentials down to the children, coarsest to finest
+    for (l=2; l<L; l++)
+        for (b=0; b<(1 << l); b++)
+            for (c=0; c<2; c++)
+            {
+                double *lp = BOX(Loc, l, b, c);
+                double *ll = BOX(Loc, l+1, 2*b, c), *lr = BOX(Loc, l+1, 2*b+1, c);
+                for (k=0; k<p; k++)
+                {
+                    double suml = 0.0, sumr = 0.0;
+                    for (j=0; j<p; j++)
+                    {
+                        suml += T0[j*p + k]*lp[j];
+                        sumr += T1[j*p + k]*lp[j];
+                    }
+                    ll[k] += suml;
+                    lr[k] += sumr;
+                }
+            }
+
+    // L2P and P2P for the targets of each leaf
+    for (b=0; b<nleaves; b++)
+    {
+        double center = lo + (2*b + 1)*r;
+        double *l0 = BOX(Loc, L, b, 0), *l1 = BOX(Loc, L, b, 1);
+        int nb0 = (b > 0) ? b - 1 : 0, nb1 = (b < nleaves - 1) ? b + 1 : nleaves - 1;
+        for (i=tgtstart[b]; i<tgtstart[b+1]; i++)
+        {
+            long it = tgtidx[i];
+            double numt = 0.0, denomt = 0.0;
+            long hit = -1; // Node coinciding with the target, if any
+            ProxyCoeffs(S, z, zw, p, (t[it] - center) / r);
+            for (k=0; k<p; k++)
+            {
+                numt += S[k] * l0[k];
+                denomt += S[k] * l1[k];
+            }
+            for (j=srcstart[nb0]; j<srcstart[nb1+1] && hit < 0; j++)
+            {
+                long js = srcidx[j];
+                double tdiff = t[it] - xnodes[js];
+                if (fabs(tdiff) < e)
+                    hit = js;
+                numt += barw[js] / tdiff * fvals[js];
+                denomt += barw[js] / tdiff;
+            }
+            out[it] = (hit >= 0) ? fvals[hit] : numt / denomt;
+        }
+    }
+#undef BOX
+
+    free(T0); free(T1); free(M); free(srcstart); free(srcidx);
+    free(tgtstart); free(tgtidx); free(Q); free(Loc);
+    return 0;
+}
+
+// f(x): Function to interpolate
+// Here, f(x) = 1/(1+16x^2), a classic test function for interpolation
+static double f(double x)
+{
+    return 1.0/(1.0 + 16.0*x*x);
+}
+
+int main(void)
+{
+    int n = 100000; // Degree of interpolating polynomial (number of nodes - 1)
+    long m = 100000; // Number of targets
+    int k;
+    long i;
+    // ClosedChebNodes and ClosedChebBarWeights, as in lab-3-4-interp-cheb
+    double *xnodes = malloc((n+1)*sizeof(double));
+    double *w = malloc((n+1)*sizeof(double));
+    double *f_sample = malloc((n+1)*sizeof(double));
+    double *t = malloc(m*sizeof(double));
+    double *fast = malloc(m*sizeof(double));
+    if (!xnodes || !w || !f_sample || !t || !fast)
+        return EXIT_FAILURE;
+    for (k=0; k<=n; k++)
+        xnodes[k] = cos(k*acos(-1.0)/n); // Chebyshev nodes formula
+    w[0] = 0.5; // Endpoints get weight 0.5
+    for (k=1; k<=n-1; k++)
+        w[k] = (k % 2) ? -1.0 : 1.0; // Interior nodes alternate +1/-1
+    w[n] = (n % 2) ? -0.5 : 0.5; // Last endpoint weight
+    for (k=0; k<=n; k++)
+        f_sample[k] = f(xnodes[k]);
+
+    // Random targets in [-1,1], plus a few that hit nodes exactly
+    srand(1);
+    for (i=0; i<m; i++)
+        t[i] = -1.0 + 2.0*rand()/RAND_MAX;
+    t[0] = -1.0;
+    t[1] = 1.0;
+    t[2] = xnodes[n/3];
+
+    // Direct summation on a subset of the targets, for reference and to estimate its full cost
+    long msub = 2000;
+    double *direct = malloc(msub*sizeof(double));
+    if (!direct)
+        return EXIT_FAILURE;
+    clock_t c0 = clock();
+    for (i=0; i<msub; i++)
+        direct[i] = LagrangeInterp1D(f_sample, xnodes, n, w, t[i]);
+    clock_t c1 = clock();
+    double tdirect = (double) (c1 - c0) / CLOCKS_PER_SEC * m / msub;
+    printf("n = %d nodes, m = %ld targets\n", n + 1, m);
+    printf("direct summation: %.3f s (estimated from %ld targets)\n", tdirect, msub);
+
+    double tols[3] = { 1e-6, 1e-10, 1e-14 };
+    for (k=0; k<3; k++)
+    {
+        c0 = clock();
+        if (FastInterp1D(f_sample, xnodes, n, w, t, m, fast, tols[k]))
+            return EXIT_FAILURE;
+        c1 = clock();
+        double maxdiff = 0.0, maxerr = 0.0;
+        for (i=0; i<msub; i++)
+            maxdiff = fmax(maxdiff, fabs(fast[i] - direct[i]));
+        for (i=0; i<m; i++)
+            maxerr = fmax(maxerr, fabs(fast[i] - f(t[i])));
+        printf("FMM tol %.0e: %.3f s, max |FMM - direct| = %.3e, max |FMM - f| = %.3e\n",
+               tols[k], (double) (c1 - c0) / CLOCKS_PER_SEC, maxdiff, maxerr);
+    }
+    printf("FastInterp1D(% 1.2f) = % 1.2f, FastInterp1D(% 1.2f) = % 1.2f\n", t[0], fast[0], t[1], fast[1]);
+
+    // Small problem: falls back to direct summation
+    int nsmall = 32;
+    double xs[nsmall+1], ws[nsmall+1], fs[nsmall+1];
+    for (k=0; k<=nsmall; k++)
+    {
+        xs[k] = cos(k*acos(-1.0)/nsmall);
+        ws[k] = (k % 2) ? -1.0 : 1.0;
+        fs[k] = f(xs[k]);
+    }
+    ws[0] = 0.5;
+    ws[nsmall] *= 0.5;
+
+    // --- Output data for plotting ---
+    FILE *fp = fopen("interp_plot.dat", "w"); // Open file for plot data
+    if (!fp) {
+        perror("Could not open interp_plot.dat for writing");
+        return EXIT_FAILURE;
+    }
+    int Nplot = 500; // Number of plot points
+    double xp[Nplot+1], fp_interp[Nplot+1];
+    for (k=0; k<=Nplot; k++)
+        xp[k] = -1.0 + 2.0 * k / Nplot; // Uniform points in [-1,1]
+    FastInterp1D(fs, xs, nsmall, ws, xp, Nplot+1, fp_interp, 1e-12);
+    for (k=0; k<=Nplot; k++)
+        fprintf(fp, "% .10f % .10f % .10f\n", xp[k], f(xp[k]), fp_interp[k]); // Write to file
+    fclose(fp);
+
+    free(xnodes);
+    free(w);
+    free(f_sample);
+    free(t);
+    free(fast);
+    free(direct);
+
+    // Print plotting instructions
+    printf("Data for plotting written to interp_plot.dat\n");
+    printf("You can plot with gnuplot using:\n");
+    printf("  gnuplot -persist -e \"plot 'interp_plot.dat' u 1:2 w l title 'f(x)', \\\n");
+    printf("    'interp_plot.dat' u 1:3 w l title 'Interpolation'\"\n");
+
+    return EXIT_SUCCESS;
+}
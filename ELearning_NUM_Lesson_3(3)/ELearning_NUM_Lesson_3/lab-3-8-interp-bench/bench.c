@@ -0,0 +1,241 @@
+/*
+ * bench.c - Cost/Accuracy Benchmark of Equispaced vs. Chebyshev Interpolation
+ *
+ * GENERAL OVERVIEW:
+ * lab-3-1-interp interpolates on equispaced nodes and lab-3-2-interp-cheb on Chebyshev nodes. This program
+ * measures both node families side by side, over a sweep of degrees n and a catalog of test functions:
+ * - runge     : f(x) = 1/(1+16x^2) on [-1,1], the test function of the interpolation labs
+ * - expcos3   : f(x) = exp(cos^3(x)) on [0,2pi], the integrand of lab-5-1-int
+ * - abs       : f(x) = |x| on [-1,1], continuous but not differentiable
+ * - abs3      : f(x) = |x|^3 on [-1,1], two continuous derivatives
+ *
+ * For every (function, family, n) the benchmark records:
+ * - build    : time to compute nodes, barycentric weights and samples, in ns
+ * - ns/eval  : time per evaluation of LagrangeInterp1D
+ * - max err  : maximum of |p(t) - f(t)| over 10001 uniform points of the interval
+ * The table is printed and written to bench_table.dat. For an accuracy target tol (first argument,
+ * default 1e-8) the cheapest configuration per function with max err <= tol is reported.
+ *
+ * NOTES:
+ * - The equispaced weights (-1)^k binomial(n,k) are computed with the recurrence
+ *   w_k = -w_(k-1) * (n-k+1)/k in double precision; the long long factorials of lab-3-1-interp overflow for n > 20.
+ * - Equispaced interpolation is exponentially ill-conditioned, which shows up as growing errors for large n.
+ *
+ * USAGE:
+ *   ./bench [tol]
+ */
+
+#define _POSIX_C_SOURCE 200809L // For clock_gettime
+
+#include <stdio.h>  // For printf, FILE, fopen, fprintf, etc.
+#include <stdlib.h> // For EXIT_SUCCESS, EXIT_FAILURE, atof
+#include <math.h>   // For cos, acos, exp, fabs
+#include <time.h>   // For clock_gettime
+
+#define e 0.000000000000001 // Small epsilon for floating point comparison
+
+#define NMAX 256      // Largest degree in the sweep
+#define NERR 10000    // Number of intervals of the error grid
+#define NEVAL 2000    // Number of points per timing pass
+#define NBUILD 200    // Repetitions of the build for timing
+
+// LagrangeInterp1D: Barycentric Lagrange interpolation formula
+// fvals[]: function values at nodes
+// xnodes[]: interpolation nodes
+// n: degree (number of nodes - 1)
+// barw[]: barycentric weights
+// t: evaluation point
+// Returns: interpolated value at t
+static double LagrangeInterp1D(double fvals[], double xnodes[], int n, double barw[], double t)
+{
+    double numt = 0.0;   // Numerator of barycentric formula
+    double denomt = 0.0; // Denominator of barycentric formula
+    int j;
+    for (j=0; j<=n; j++)
+    {
+        double tdiff = t - xnodes[j]; // Distance from t to node j
+        numt += barw[j] / tdiff * fvals[j]; // Add weighted contribution to numerator
+        denomt += + barw[j] / tdiff;        // Add weighted contribution to denominator
+        // If t is (numerically) equal to a node, return f(node)
+        if (fabs(tdiff) < e)
+        {
+            numt = fvals[j];
+            denomt = 1.0;
+            break;
+        }
+    }
+    return numt / denomt; // Barycentric interpolation value
+}
+
+// EquispacedNodes and EquispacedBarWeights on [a,b]
+static void Equispaced(double xnodes[], double w[], int n, double a, double b)
+{
+    int k;
+    for (k=0; k<=n; k++)
+        xnodes[k] = a + (b - a)*k/n;
+    w[0] = 1.0;
+    for (k=1; k<=n; k++)
+        w[k] = -w[k-1] * (n - k + 1) / k; // w_k = (-1)^k * binomial(n, k)
+}
+
+// ClosedChebNodes and ClosedChebBarWeights on [a,b]
+static void Chebyshev(double xnodes[], double w[], int n, double a, double b)
+{
+    int k;
+    for (k=0; k<=n; k++)
+    {
+        xnodes[k] = 0.5*(a + b) + 0.5*(b - a)*cos(k*acos(-1.0)/n);
+        w[k] = (k % 2) ? -1.0 : 1.0;
+    }
+    w[0] = 0.5;
+    w[n] *= 0.5;
+}
+
+static double runge(double x)   { return 1.0/(1.0 + 16.0*x*x); }
+static double expcos3(double x) { return exp(cos(x)*cos(x)*cos(x)); }
+static double absx(double x)    { return fabs(x); }
+static double abs3(double x)    { return fabs(x*x*x); }
+
+// Test function catalog entry
+struct TESTFUNC
+{
+    const char *name;      // Short name for the table
+    double (*f)(double);   // Function to interpolate
+    double a, b;           // Interval
+};
+
+// Node family entry
+struct FAMILY
+{
+    const char *name;                                        // Short name for the table
+    void (*build)(double[], double[], int, double, double);  // Nodes and weights on [a,b]
+};
+
+// Monotonic wall clock in nanoseconds
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return 1e9*ts.tv_sec + ts.tv_nsec;
+}
+
+// One row of the result table
+struct RESULT
+{
+    int func, family, n;
+    double build_ns, eval_ns, maxerr;
+};
+
+int main(int argc, char *argv[])
+{
+    double tol = (argc > 1) ? atof(argv[1]) : 1e-8; // Accuracy target
+    struct TESTFUNC funcs[] = {
+        { "runge",   runge,   -1.0, 1.0 },
+        { "expcos3", expcos3,  0.0, 2.0*acos(-1.0) },
+        { "abs",     absx,    -1.0, 1.0 },
+        { "abs3",    abs3,    -1.0, 1.0 },
+    };
+    struct FAMILY families[] = {
+        { "equi", Equispaced },
+        { "cheb", Chebyshev },
+    };
+    int ns[] = { 4, 8, 16, 32, 64, 128, 256 };
+    int nfuncs = sizeof(funcs)/sizeof(funcs[0]);
+    int nfamilies = sizeof(families)/sizeof(families[0]);
+    int nns = sizeof(ns)/sizeof(ns[0]);
+    struct RESULT results[nfuncs*nfamilies*nns];
+    int nresults = 0;
+
+    double xnodes[NMAX+1], w[NMAX+1], f_sample[NMAX+1];
+    double teval[NEVAL];
+    volatile double sink = 0.0; // Keeps the timed evaluations from being optimized away
+    int fi, fa, ni, k, r;
+
+    FILE *fp = fopen("bench_table.dat", "w"); // Open file for the table
+    if (!fp) {
+        perror("Could not open bench_table.dat for writing");
+        return EXIT_FAILURE;
+    }
+    printf("%-8s %-5s %4s %12s %10s %12s\n", "function", "nodes", "n", "build [ns]", "ns/eval", "max err");
+    fprintf(fp, "# function nodes n build_ns ns_per_eval max_err\n");
+
+    for (fi=0; fi<nfuncs; fi++)
+    {
+        struct TESTFUNC *tf = &funcs[fi];
+        for (k=0; k<NEVAL; k++)
+            teval[k] = tf->a + (tf->b - tf->a)*(k + 0.5)/NEVAL; // Timing points, off the nodes
+        for (fa=0; fa<nfamilies; fa++)
+        {
+            for (ni=0; ni<nns; ni++)
+            {
+                int n = ns[ni];
+                struct RESULT *res = &results[nresults++];
+                res->func = fi;
+                res->family = fa;
+                res->n = n;
+
+                // Build: nodes, weights and samples
+                double t0 = now_ns();
+                for (r=0; r<NBUILD; r++)
+                {
+                    families[fa].build(xnodes, w, n, tf->a, tf->b);
+                    for (k=0; k<=n; k++)
+                        f_sample[k] = tf->f(xnodes[k]);
+                }
+                res->build_ns = (now_ns() - t0) / NBUILD;
+
+                // Evaluation: repeat passes until at least 10 ms have been measured
+                long evals = 0;
+                t0 = now_ns();
+                double t1 = t0;
+                while (t1 - t0 < 1e7)
+                {
+                    for (k=0; k<NEVAL; k++)
+                        sink += LagrangeInterp1D(f_sample, xnodes, n, w, teval[k]);
+                    evals += NEVAL;
+                    t1 = now_ns();
+                }
+                res->eval_ns = (t1 - t0) / evals;
+
+                // Accuracy on a fine uniform grid, including the endpoints
+                res->maxerr = 0.0;
+                for (k=0; k<=NERR; k++)
+                {
+                    double t = tf->a + (tf->b - tf->a)*k/NERR;
+                    double err = fabs(LagrangeInterp1D(f_sample, xnodes, n, w, t) - tf->f(t));
+                    if (!(err <= res->maxerr)) // Also catches NaN
+                        res->maxerr = err;
+                }
+
+                printf("%-8s %-5s %4d %12.1f %10.1f %12.3e\n", tf->name, families[fa].name, n,
+                       res->build_ns, res->eval_ns, res->maxerr);
+                fprintf(fp, "%s %s %d %.1f %.2f %.6e\n", tf->name, families[fa].name, n,
+                        res->build_ns, res->eval_ns, res->maxerr);
+            }
+        }
+    }
+    fclose(fp);
+    (void) sink;
+
+    // Cheapest configuration (lowest ns/eval) per function that meets the accuracy target
+    printf("\nCheapest configuration with max err <= %.1e:\n", tol);
+    for (fi=0; fi<nfuncs; fi++)
+    {
+        struct RESULT *best = NULL;
+        for (r=0; r<nresults; r++)
+            if (results[r].func == fi && results[r].maxerr <= tol
+                && (!best || results[r].eval_ns < best->eval_ns))
+                best = &results[r];
+        if (best)
+            printf("  %-8s %-5s n = %4d: %.1f ns/eval, max err %.3e\n", funcs[fi].name,
+                   families[best->family].name, best->n, best->eval_ns, best->maxerr);
+        else
+            printf("  %-8s no configuration up to n = %d reaches the target\n", funcs[fi].name, NMAX);
+    }
+
+    printf("Table written to bench_table.dat\n");
+    printf("You can plot the error against the cost with gnuplot using:\n");
+    printf("  gnuplot -persist -e \"set logscale y; plot 'bench_table.dat' u 5:6 w p pt 7 title 'max err vs ns/eval'\"\n");
+
+    return EXIT_SUCCESS;
+}
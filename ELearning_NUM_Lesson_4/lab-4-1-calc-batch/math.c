@@ -0,0 +1,342 @@
+// math.c - Batched Multithreaded Least-Squares Fits
+//
+// lab-4-1-calc-poly fits one dataset at a time. This program fits the same polynomial model to many
+// short, independent series at once (e.g. one line per sensor) and spreads the series over threads.
+//
+// Step-by-step overview:
+//
+// 1. **Input layout**
+//    - Series s has m points; point i is x[s*xstride + i], y[s*ystride + i]. The series can be rows of a
+//      matrix (stride = m), or padded rows (stride > m).
+//    - xstride = 0 means all series share the abscissae x[0..m-1], the common case of sensors sampled on
+//      the same time grid.
+//
+// 2. **Output layout**
+//    - out is one contiguous array of nseries rows of p+1 doubles: the p coefficients of series s
+//      (af[0] + af[1]*x + ...) followed by the residual norm. A series that cannot be fitted gets NaN.
+//
+// 3. **Workers**
+//    - fit_batch starts nthreads workers. Each owns a BATCHWS: design matrix, right-hand sides and a LAPACK
+//      workspace, allocated and queried once before any series is fitted.
+//    - Workers take chunks of BATCH_CHUNK series from a shared counter, so uneven speeds balance out and
+//      no two workers ever write the same output row.
+//    - Shared abscissae: the design matrix is the same for the whole chunk, so the chunk is solved as one
+//      least-squares problem with BATCH_CHUNK right-hand sides (a single QR factorization per chunk).
+//    - Individual abscissae: one LAPACKE_dgels_work call per series, still with the preallocated workspace.
+//
+// Main steps in main():
+//   1. Generate nseries noisy lines y = a1*x + a0 with random a0, a1 (noise in [-1, 1]), once on a shared
+//      grid in [0, 10] and once with jittered abscissae per series.
+//   2. Fit both batches with 1, 2, 4, ... threads and report series per second.
+//   3. Check every line against the 2x2 normal equations of lab-4-1-calc.
+//
+// Usage:
+//   ./math [nseries] [m] [maxthreads]
+//   defaults: 20000 series of 32 points, up to 4 threads
+
+#define _POSIX_C_SOURCE 200809L // For clock_gettime
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <time.h>
+#include <pthread.h>
+
+#include <lapacke.h>
+
+#define BATCH_CHUNK 64 // Series per work item (and right-hand sides per solve for shared abscissae)
+
+// Per-worker workspace
+struct BATCHWS
+{
+    double *A;        // Design matrix, column-major, m x p
+    double *B;        // Right-hand sides, column-major, m x BATCH_CHUNK
+    double *work;     // LAPACK workspace
+    lapack_int lwork;
+};
+
+// Description of one batch, shared by all workers
+struct BATCHJOB
+{
+    const double *x, *y;  // Series data
+    long xstride, ystride;
+    int nseries, m, p;
+    double *out;          // nseries x (p+1)
+    pthread_mutex_t lock; // Protects next and failed
+    int next;             // First series of the next chunk
+    int failed;           // Number of series that could not be fitted
+};
+
+// Allocates the workspace of one worker for m points and p coefficients
+// Returns 0, or -1 on allocation/query failure
+static int batchws_init(struct BATCHWS *ws, int m, int p)
+{
+    double wq;
+    ws->A = malloc(sizeof(double)*m*p);
+    ws->B = malloc(sizeof(double)*m*BATCH_CHUNK);
+    ws->work = NULL;
+    if (!ws->A || !ws->B)
+        return -1;
+    // One query for the largest problem solved: m x p with BATCH_CHUNK right-hand sides
+    if (LAPACKE_dgels_work(LAPACK_COL_MAJOR, 'N', m, p, BATCH_CHUNK, ws->A, m, ws->B, m, &wq, -1))
+        return -1;
+    ws->lwork = (lapack_int) wq;
+    ws->work = malloc(sizeof(double)*ws->lwork);
+    return ws->work ? 0 : -1;
+}
+
+static void batchws_free(struct BATCHWS *ws)
+{
+    free(ws->A);
+    free(ws->B);
+    free(ws->work);
+}
+
+// Vandermonde matrix A(i,j) = x_i^j, column-major
+static void design(double *A, int m, int p, const double x[])
+{
+    int i, j;
+    for (i=0; i<m; i++)
+        A[i] = 1.0;
+    for (j=1; j<p; j++)
+        for (i=0; i<m; i++)
+            A[j*m+i] = A[(j-1)*m+i]*x[i];
+}
+
+// Copies the solution of right-hand side c into output row s: coefficients and residual norm
+static void store(const struct BATCHJOB *job, const double *B, int c, int s)
+{
+    const double *bc = B + (long)c*job->m;
+    double *row = job->out + (long)s*(job->p + 1);
+    double r = 0.0;
+    int i;
+    for (i=0; i<job->p; i++)
+        row[i] = bc[i];
+    for (i=job->p; i<job->m; i++)
+        r += bc[i]*bc[i];
+    row[job->p] = sqrt(r);
+}
+
+// Marks output rows s0..s1-1 as failed
+static int fail(const struct BATCHJOB *job, int s0, int s1)
+{
+    int s, i;
+    for (s=s0; s<s1; s++)
+        for (i=0; i<=job->p; i++)
+            job->out[(long)s*(job->p + 1) + i] = NAN;
+    return s1 - s0;
+}
+
+// Fits the series s0..s1-1 with the workspace ws
+// Returns the number of series that could not be fitted
+static int fit_chunk(const struct BATCHJOB *job, struct BATCHWS *ws, int s0, int s1)
+{
+    int m = job->m, p = job->p;
+    int s, i, failed = 0;
+
+    if (job->xstride == 0)
+    {
+        // Shared abscissae: one QR factorization, s1-s0 right-hand sides
+        design(ws->A, m, p, job->x);
+        for (s=s0; s<s1; s++)
+            memcpy(ws->B + (long)(s - s0)*m, job->y + s*job->ystride, sizeof(double)*m);
+        if (LAPACKE_dgels_work(LAPACK_COL_MAJOR, 'N', m, p, s1 - s0, ws->A, m, ws->B, m, ws->work, ws->lwork))
+            return fail(job, s0, s1);
+        for (s=s0; s<s1; s++)
+            store(job, ws->B, s - s0, s);
+        return 0;
+    }
+    for (s=s0; s<s1; s++)
+    {
+        design(ws->A, m, p, job->x + s*job->xstride);
+        for (i=0; i<m; i++)
+            ws->B[i] = job->y[s*job->ystride + i];
+        if (LAPACKE_dgels_work(LAPACK_COL_MAJOR, 'N', m, p, 1, ws->A, m, ws->B, m, ws->work, ws->lwork))
+            failed += fail(job, s, s + 1);
+        else
+            store(job, ws->B, 0, s);
+    }
+    return failed;
+}
+
+// Worker: allocates its workspace, then fits chunks until none are left
+static void *batch_worker(void *arg)
+{
+    struct BATCHJOB *job = arg;
+    struct BATCHWS ws;
+    int ok = !batchws_init(&ws, job->m, job->p);
+
+    for (;;)
+    {
+        pthread_mutex_lock(&job->lock);
+        int s0 = job->next;
+        job->next += BATCH_CHUNK;
+        pthread_mutex_unlock(&job->lock);
+        if (s0 >= job->nseries)
+            break;
+        int s1 = (s0 + BATCH_CHUNK < job->nseries) ? s0 + BATCH_CHUNK : job->nseries;
+        int failed = ok ? fit_chunk(job, &ws, s0, s1) : fail(job, s0, s1);
+        if (failed)
+        {
+            pthread_mutex_lock(&job->lock);
+            job->failed += failed;
+            pthread_mutex_unlock(&job->lock);
+        }
+    }
+    batchws_free(&ws);
+    return NULL;
+}
+
+// Fits a polynomial with p coefficients to each of nseries series of m points
+// x, xstride, y, ystride: series layout (xstride = 0: shared abscissae x[0..m-1])
+// out: nseries x (p+1) output, coefficients then residual norm per series
+// Returns the number of series that could not be fitted (their rows are NaN), or -1 on invalid arguments
+static int fit_batch(const double *x, long xstride, const double *y, long ystride, int nseries, int m, int p,
+                     double *out, int nthreads)
+{
+    struct BATCHJOB job;
+    pthread_t *threads;
+    int k, started;
+
+    if (nseries < 0 || p < 1 || m < p || nthreads < 1 || (xstride && xstride < m) || ystride < m)
+        return -1;
+    job.x = x;
+    job.y = y;
+    job.xstride = xstride;
+    job.ystride = ystride;
+    job.nseries = nseries;
+    job.m = m;
+    job.p = p;
+    job.out = out;
+    job.next = 0;
+    job.failed = 0;
+    pthread_mutex_init(&job.lock, NULL);
+
+    // The calling thread works too, so nthreads-1 extra threads are started
+    threads = calloc(nthreads, sizeof(pthread_t));
+    started = 0;
+    if (threads)
+        for (k=1; k<nthreads; k++)
+        {
+            if (pthread_create(&threads[k], NULL, batch_worker, &job))
+                break;
+            started++;
+        }
+    batch_worker(&job);
+    for (k=1; k<=started; k++)
+        pthread_join(threads[k], NULL);
+    free(threads);
+    pthread_mutex_destroy(&job.lock);
+    return job.failed;
+}
+
+// Linear function used to generate true (noise-free) data
+static double f(double x, double a0, double a1)
+{
+    return a1*x + a0;
+}
+
+// Uniform random number in [0, 1]
+static double rnd(void)
+{
+    double d = rand();
+    return d / RAND_MAX;
+}
+
+// Monotonic wall clock in seconds
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+    int nseries = (argc > 1) ? atoi(argv[1]) : 20000;
+    int m = (argc > 2) ? atoi(argv[2]) : 32;
+    int maxthreads = (argc > 3) ? atoi(argv[3]) : 4;
+    int p = 2; // Lines: af[0] = intercept, af[1] = slope
+    int s, i, t, pass;
+
+    if (nseries < 1 || m < 2 || maxthreads < 1)
+    {
+        fprintf(stderr, "usage: %s [nseries(>=1)] [m(>=2)] [maxthreads(>=1)]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // --- Step 1: Generate the series ---
+    double *xg = malloc(sizeof(double)*m);                // Shared grid
+    double *xj = malloc(sizeof(double)*(long)nseries*m);  // Jittered abscissae, one row per series
+    double *yg = malloc(sizeof(double)*(long)nseries*m);  // Data on the shared grid
+    double *yj = malloc(sizeof(double)*(long)nseries*m);  // Data on the jittered abscissae
+    double *out = malloc(sizeof(double)*(long)nseries*(p + 1));
+    if (!xg || !xj || !yg || !yj || !out)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    srand(clock());
+    for (i=0; i<m; i++)
+        xg[i] = 0.0 + 10.0*i/(m - 1); // x values evenly spaced in [0, 10]
+    for (s=0; s<nseries; s++)
+    {
+        double a0 = 4*(-0.5 + rnd()), a1 = 2*(-0.5 + rnd());
+        for (i=0; i<m; i++)
+        {
+            double *xs = xj + (long)s*m;
+            xs[i] = xg[i] + 0.2*(-0.5 + rnd());
+            yg[(long)s*m+i] = f(xg[i], a0, a1) + 2*(-0.5 + rnd());  // noise in [-1, 1]
+            yj[(long)s*m+i] = f(xs[i], a0, a1) + 2*(-0.5 + rnd());
+        }
+    }
+
+    for (pass=0; pass<2; pass++)
+    {
+        const double *x = pass ? xj : xg;
+        const double *y = pass ? yj : yg;
+        long xstride = pass ? m : 0;
+        printf("%s abscissae, %d series of %d points:\n", pass ? "Individual" : "Shared", nseries, m);
+
+        // --- Step 2: Fit with 1, 2, 4, ... threads ---
+        for (t=1; t<=maxthreads; t*=2)
+        {
+            double t0 = now_s();
+            int failed = fit_batch(x, xstride, y, m, nseries, m, p, out, t);
+            double dt = now_s() - t0;
+            printf("  %2d threads: %.3lf s, %.0lf series/s, %d failed\n", t, dt, nseries/dt, failed);
+        }
+
+        // --- Step 3: Check against the 2x2 normal equations ---
+        double maxdiff = 0.0, meanres = 0.0;
+        for (s=0; s<nseries; s++)
+        {
+            const double *xs = x + s*xstride, *ys = y + (long)s*m;
+            double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+            for (i=0; i<m; i++)
+            {
+                sx += xs[i];
+                sy += ys[i];
+                sxx += xs[i]*xs[i];
+                sxy += xs[i]*ys[i];
+            }
+            double det = m*sxx - sx*sx;
+            double a0 = (sxx*sy - sx*sxy)/det, a1 = (m*sxy - sx*sy)/det;
+            double *row = out + (long)s*(p + 1);
+            if (fabs(row[0] - a0) > maxdiff) maxdiff = fabs(row[0] - a0);
+            if (fabs(row[1] - a1) > maxdiff) maxdiff = fabs(row[1] - a1);
+            meanres += row[2];
+        }
+        printf("  max |QR - normal equations| = %.3e, mean residual norm %.4lf\n", maxdiff, meanres/nseries);
+        printf("  series 0: a0 = %.6lf a1 = %.6lf residual norm %.6lf\n\n", out[0], out[1], out[2]);
+    }
+
+    free(xg);
+    free(xj);
+    free(yg);
+    free(yj);
+    free(out);
+    return EXIT_SUCCESS;
+}
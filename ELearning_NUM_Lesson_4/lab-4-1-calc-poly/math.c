@@ -0,0 +1,381 @@
+// math.c - Polynomial Least-Squares Fit with LAPACK QR
+//
+// lab-4-1-calc-lib fits a line y = a0 + a1*x through the 2x2 normal equations. This program fits a
+// polynomial of any degree k directly from the (n+1) x (k+1) design matrix with a QR factorization
+// (LAPACKE_dgels), which avoids squaring the condition number as the normal equations do.
+//
+// Step-by-step overview:
+//
+// 1. **Fit object (struct POLYFIT)**
+//    - polyfit_init allocates the design matrix A, the right-hand side B and the LAPACK workspace for up
+//      to mmax points and k+1 coefficients. The optimal workspace size is queried once (lwork = -1).
+//    - polyfit_solve refills A and B and calls LAPACKE_dgels_work with the stored workspace. Repeated fits
+//      of the same shape therefore do no allocation and no workspace query.
+//
+// 2. **Basis functions**
+//    - POLY_MONOMIAL: the Vandermonde matrix A(i,j) = x_i^j, coefficients af[j] of y = sum(af[j]*x^j),
+//      directly comparable to a0 and a1 of lab-4-1-calc.
+//    - POLY_CHEBYSHEV: A(i,j) = T_j(t_i) with t = (2x - a - b)/(b - a) mapping [a, b] onto [-1, 1]. The
+//      columns are close to orthogonal, so high degrees stay well conditioned.
+//
+// 3. **Blockwise assembly**
+//    - A is stored column-major, the layout LAPACK works in. It is filled in blocks of POLY_BLOCK rows:
+//      within a block, column j is computed from columns j-1 and j-2 (x^j = x*x^(j-1) or the Chebyshev
+//      recurrence T_j = 2t*T_(j-1) - T_(j-2)), which are still in cache.
+//
+// 4. **Results**
+//    - dgels overwrites B with the coefficients in B[0..k] and leaves the residuals' components in
+//      B[k+1..m-1], so the residual norm comes for free.
+//    - A holds R afterwards; max|R_jj|/min|R_jj| is a cheap lower bound of the condition number of A.
+//
+// Main steps in main():
+//   1. Generate noisy data along a cubic on [0, 10] (noise in [-1, 1]).
+//   2. Fit degrees 1..6 and print the coefficients and residual norms. Degree 1 is checked against the
+//      2x2 normal equations of lab-4-1-calc.
+//   3. Time repeated fits of the same shape against allocating and querying on every fit.
+//   4. Compare the monomial and the Chebyshev basis at a high degree.
+//   5. Write the data and the cubic fit to lsq_data.dat and lsq_fit.dat for gnuplot.
+//
+// Usage:
+//   ./math [n] [degree]
+//   n: number of intervals, n+1 points (default 200), degree: high degree for step 4 (default 14)
+
+#define _POSIX_C_SOURCE 200809L // For clock_gettime
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <time.h>
+
+#include <lapacke.h>
+
+#define POLY_BLOCK 256 // Rows of the design matrix filled per block
+
+#define POLY_MONOMIAL  0 // Basis x^j
+#define POLY_CHEBYSHEV 1 // Basis T_j((2x - a - b)/(b - a))
+
+// Polynomial least-squares fit with preallocated LAPACK storage
+struct POLYFIT
+{
+    int basis;       // POLY_MONOMIAL or POLY_CHEBYSHEV
+    int p;           // Number of coefficients (degree + 1)
+    int mmax;        // Largest number of points
+    double a, b;     // Interval of the Chebyshev basis
+    double *A;       // Design matrix, column-major, mmax x p (leading dimension mmax)
+    double *B;       // Right-hand side, mmax
+    double *work;    // LAPACK workspace
+    lapack_int lwork;
+};
+
+static void printm(char *name, int m, int n, double *pA)
+{
+    int i, j;
+    // Print a matrix or vector with a label
+    printf("\n %s\n", name);
+    for (i=0; i<m; i++)
+    {
+        for (j=0; j<n; j++)
+            printf(" %10.6lf", pA[i*n+j]);
+        printf("\n");
+    }
+}
+
+// Allocates the storage for fits of up to mmax points with p coefficients and queries the workspace size
+// Returns 0, or -1 on invalid arguments or allocation/query failure
+static int polyfit_init(struct POLYFIT *pf, int basis, int p, int mmax, double a, double b)
+{
+    double wq;
+    lapack_int info;
+
+    pf->A = pf->B = pf->work = NULL;
+    if (p < 1 || mmax < p || (basis == POLY_CHEBYSHEV && !(b > a)))
+        return -1;
+    pf->basis = basis;
+    pf->p = p;
+    pf->mmax = mmax;
+    pf->a = a;
+    pf->b = b;
+    pf->A = malloc(sizeof(double)*mmax*p);
+    pf->B = malloc(sizeof(double)*mmax);
+    if (!pf->A || !pf->B)
+        return -1;
+    // Workspace query: lwork = -1 returns the optimal size in wq
+    info = LAPACKE_dgels_work(LAPACK_COL_MAJOR, 'N', mmax, p, 1, pf->A, mmax, pf->B, mmax, &wq, -1);
+    if (info)
+        return -1;
+    pf->lwork = (lapack_int) wq;
+    pf->work = malloc(sizeof(double)*pf->lwork);
+    return pf->work ? 0 : -1;
+}
+
+static void polyfit_free(struct POLYFIT *pf)
+{
+    free(pf->A);
+    free(pf->B);
+    free(pf->work);
+    pf->A = pf->B = pf->work = NULL;
+}
+
+// Fills rows 0..m-1 of the design matrix for the points x[] block by block
+static void polyfit_design(struct POLYFIT *pf, int m, const double x[])
+{
+    int p = pf->p, ld = pf->mmax;
+    double *A = pf->A;
+    int r0, r, j;
+
+    for (r0=0; r0<m; r0+=POLY_BLOCK)
+    {
+        int r1 = (r0 + POLY_BLOCK < m) ? r0 + POLY_BLOCK : m;
+        for (r=r0; r<r1; r++)
+            A[r] = 1.0;
+        if (p < 2)
+            continue;
+        // Column 1 holds the basis variable: x, or t in [-1, 1]
+        if (pf->basis == POLY_CHEBYSHEV)
+            for (r=r0; r<r1; r++)
+                A[ld+r] = (2.0*x[r] - pf->a - pf->b) / (pf->b - pf->a);
+        else
+            for (r=r0; r<r1; r++)
+                A[ld+r] = x[r];
+        for (j=2; j<p; j++)
+        {
+            double *c = A + j*ld, *c1 = c - ld, *c2 = c1 - ld;
+            if (pf->basis == POLY_CHEBYSHEV)
+                for (r=r0; r<r1; r++)
+                    c[r] = 2.0*A[ld+r]*c1[r] - c2[r];
+            else
+                for (r=r0; r<r1; r++)
+                    c[r] = A[ld+r]*c1[r];
+        }
+    }
+}
+
+// Least-squares fit of the m points (x[i], y[i]) with the stored workspace
+// af[0..p-1]: coefficients in the basis of pf
+// resnorm: 2-norm of the residual y - A*af (may be NULL)
+// Returns 0, -1 if m is out of range, or the LAPACK info (> 0: A does not have full rank)
+static int polyfit_solve(struct POLYFIT *pf, int m, const double x[], const double y[], double af[], double *resnorm)
+{
+    int p = pf->p;
+    lapack_int info;
+    int i;
+
+    if (m < p || m > pf->mmax)
+        return -1;
+    polyfit_design(pf, m, x);
+    for (i=0; i<m; i++)
+        pf->B[i] = y[i];
+    info = LAPACKE_dgels_work(LAPACK_COL_MAJOR, 'N', m, p, 1, pf->A, pf->mmax, pf->B, pf->mmax,
+                              pf->work, pf->lwork);
+    if (info)
+        return info;
+    for (i=0; i<p; i++)
+        af[i] = pf->B[i];
+    if (resnorm)
+    {
+        double s = 0.0;
+        for (i=p; i<m; i++)
+            s += pf->B[i]*pf->B[i];
+        *resnorm = sqrt(s);
+    }
+    return 0;
+}
+
+// Lower bound of the condition number of the last design matrix, from the diagonal of R
+static double polyfit_cond(const struct POLYFIT *pf)
+{
+    double rmin = INFINITY, rmax = 0.0;
+    int j;
+    for (j=0; j<pf->p; j++)
+    {
+        double r = fabs(pf->A[j*pf->mmax + j]);
+        if (r < rmin) rmin = r;
+        if (r > rmax) rmax = r;
+    }
+    return rmax / rmin;
+}
+
+// Evaluates the fitted polynomial at x (Horner for monomials, Clenshaw for Chebyshev)
+static double polyfit_eval(const struct POLYFIT *pf, const double af[], double x)
+{
+    int j;
+    if (pf->basis == POLY_CHEBYSHEV)
+    {
+        double t = (2.0*x - pf->a - pf->b) / (pf->b - pf->a);
+        double b1 = 0.0, b2 = 0.0;
+        for (j=pf->p-1; j>=1; j--)
+        {
+            double b0 = 2.0*t*b1 - b2 + af[j];
+            b2 = b1;
+            b1 = b0;
+        }
+        return t*b1 - b2 + af[0];
+    }
+    double s = 0.0;
+    for (j=pf->p-1; j>=0; j--)
+        s = s*x + af[j];
+    return s;
+}
+
+// Cubic used to generate true (noise-free) data
+static double f(double x)
+{
+    return 0.5 + 0.5*x - 0.3*x*x + 0.025*x*x*x;
+}
+
+// Monotonic wall clock in seconds
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+    int n = (argc > 1) ? atoi(argv[1]) : 200;
+    int kmax = (argc > 2) ? atoi(argv[2]) : 14;
+    struct POLYFIT pf;
+    double af[64], res;
+    int k, deg, r;
+
+    if (n < 1 || kmax < 1 || kmax > 63 || kmax > n)
+    {
+        fprintf(stderr, "usage: %s [n(>=1)] [degree(1..min(63,n))]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // --- Step 1: Generate synthetic data ---
+    double *x = malloc(sizeof(double)*(n+1));
+    double *y = malloc(sizeof(double)*(n+1));
+    if (!x || !y)
+        return EXIT_FAILURE;
+    srand(clock());
+    for (k=0; k<=n; k++)
+    {
+        double d = rand();
+        d /= RAND_MAX;
+        x[k] = 0.0 + 10.0*k/n;          // x values evenly spaced in [0, 10]
+        y[k] = f(x[k]) + 2*(-0.5 + d);  // noise in [-1, 1]
+    }
+
+    // --- Step 2: Fits of degree 1..6 in the monomial basis ---
+    printf("Data: y = 0.5 + 0.5x - 0.3x^2 + 0.025x^3 + noise, %d points\n", n+1);
+    for (deg=1; deg<=6 && deg<=n; deg++)
+    {
+        if (polyfit_init(&pf, POLY_MONOMIAL, deg+1, n+1, 0.0, 10.0) || polyfit_solve(&pf, n+1, x, y, af, &res))
+        {
+            fprintf(stderr, "Fit of degree %d failed\n", deg);
+            return EXIT_FAILURE;
+        }
+        printf("\n degree %d: residual norm %.6lf, rms %.6lf", deg, res, res/sqrt(n+1.0));
+        printm("af", 1, deg+1, af);
+        if (deg == 1)
+        {
+            // Cross-check with the normal equations of lab-4-1-calc
+            double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+            for (k=0; k<=n; k++)
+            {
+                sx += x[k];
+                sy += y[k];
+                sxx += x[k]*x[k];
+                sxy += x[k]*y[k];
+            }
+            double det = (n+1)*sxx - sx*sx;
+            printf(" normal equations: a0 = %.6lf a1 = %.6lf\n", (sxx*sy - sx*sxy)/det, ((n+1)*sxy - sx*sy)/det);
+        }
+        polyfit_free(&pf);
+    }
+
+    // --- Step 3: Repeated fits of the same shape ---
+    int reps = 2000;
+    double t0, tfresh, treuse;
+    volatile double sink = 0.0;
+    t0 = now_s();
+    for (r=0; r<reps; r++)
+    {
+        struct POLYFIT tmp;
+        if (polyfit_init(&tmp, POLY_MONOMIAL, 4, n+1, 0.0, 10.0) || polyfit_solve(&tmp, n+1, x, y, af, NULL))
+            return EXIT_FAILURE;
+        sink += af[0];
+        polyfit_free(&tmp);
+    }
+    tfresh = (now_s() - t0) / reps;
+    if (polyfit_init(&pf, POLY_MONOMIAL, 4, n+1, 0.0, 10.0))
+        return EXIT_FAILURE;
+    t0 = now_s();
+    for (r=0; r<reps; r++)
+    {
+        if (polyfit_solve(&pf, n+1, x, y, af, NULL))
+            return EXIT_FAILURE;
+        sink += af[0];
+    }
+    treuse = (now_s() - t0) / reps;
+    (void) sink;
+    printf("\n Cubic fit, %d repetitions: %.2lf us with allocation and query per fit, %.2lf us reusing the workspace\n",
+           reps, 1e6*tfresh, 1e6*treuse);
+
+    // --- Step 4: Monomial vs. Chebyshev basis at a high degree ---
+    printf("\n Degree %d:\n", kmax);
+    int bases[2] = { POLY_MONOMIAL, POLY_CHEBYSHEV };
+    const char *names[2] = { "monomial ", "chebyshev" };
+    for (r=0; r<2; r++)
+    {
+        struct POLYFIT hp;
+        int info;
+        if (polyfit_init(&hp, bases[r], kmax+1, n+1, 0.0, 10.0))
+            return EXIT_FAILURE;
+        info = polyfit_solve(&hp, n+1, x, y, af, &res);
+        if (info)
+            printf("  %s: dgels failed (info = %d)\n", names[r], info);
+        else
+        {
+            // Error of the fit against the data, evaluated through the basis (tests the coefficients)
+            double maxdev = 0.0;
+            for (k=0; k<=n; k++)
+            {
+                double dv = fabs(polyfit_eval(&hp, af, x[k]) - y[k]);
+                if (dv > maxdev)
+                    maxdev = dv;
+            }
+            printf("  %s: cond(A) >= %.3e, residual norm %.6lf, max |p(x_k) - y_k| %.6lf\n",
+                   names[r], polyfit_cond(&hp), res, maxdev);
+        }
+        polyfit_free(&hp);
+    }
+
+    // --- Step 5: Output data and the cubic fit for gnuplot ---
+    if (polyfit_solve(&pf, n+1, x, y, af, NULL))
+        return EXIT_FAILURE;
+    FILE *fp = fopen("lsq_data.dat", "w");
+    if (!fp) {
+        perror("Could not open lsq_data.dat for writing");
+        return EXIT_FAILURE;
+    }
+    for (k = 0; k <= n; k++) {
+        fprintf(fp, "% .10f % .10f % .10f\n", x[k], y[k], f(x[k]));
+    }
+    fclose(fp);
+    FILE *fp_fit = fopen("lsq_fit.dat", "w");
+    if (!fp_fit) {
+        perror("Could not open lsq_fit.dat for writing");
+        return EXIT_FAILURE;
+    }
+    int Nplot = 200;
+    for (int i = 0; i <= Nplot; ++i) {
+        double xp = 0.0 + 10.0 * i / Nplot;
+        fprintf(fp_fit, "% .10f % .10f\n", xp, polyfit_eval(&pf, af, xp));
+    }
+    fclose(fp_fit);
+    polyfit_free(&pf);
+    free(x);
+    free(y);
+
+    printf("\nData for gnuplot written to lsq_data.dat and lsq_fit.dat\n");
+    printf("You can plot with gnuplot using:\n");
+    printf("  gnuplot -persist -e \"plot 'lsq_data.dat' u 1:2 w p pt 7 ps 1 lc rgb 'red' title 'Noisy data', \\\n");
+    printf("    'lsq_data.dat' u 1:3 w l lc rgb 'blue' title 'True cubic', \\\n");
+    printf("    'lsq_fit.dat' u 1:2 w l lc rgb 'green' title 'Fitted cubic'\"\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,395 @@
+// math.c - Geometric ellipse fit with Levenberg-Marquardt
+// General Overview:
+// lab-4-2-calc-lib fits the conic p0*x^2 + p1*y^2 + p2*x*y + p3*x + p4*y = 1 algebraically with LAPACKE_dgels.
+// That minimizes algebraic values, not distances, and is biased towards small ellipses for noisy data.
+// This program fits the parametric model of the labs directly,
+//   x(t) = a*cos(th)*cos(t) - b*sin(th)*sin(t) + x0
+//   y(t) = a*sin(th)*sin(t) + b*cos(th)*cos(t) + y0,
+// by minimizing the sum of squared orthogonal distances of the points to the curve over P = (a, b, th, x0, y0):
+//
+// - Foot points: for the current P, each point gets the curve parameter t_k of its closest curve point,
+//   found with a few Newton steps on d/dt |p_k - f(t)|^2 = 0, warm-started from the t_k of the last step.
+// - Residuals: the signed distance r_k = n_k.(p_k - f(t_k)), n_k the unit normal at the foot point. Since
+//   t_k minimizes the distance, its derivative with respect to t_k vanishes and the Jacobian row of r_k is
+//   -n_k.df/dP with t_k held fixed, which is analytic (lm_normal). Using the x and y differences as two
+//   residuals instead gives the same gradient but a J^T*J that also counts moving the curve along itself,
+//   and the iteration only converges linearly.
+// - Levenberg-Marquardt: J^T*J and J^T*r are accumulated in one pass over the points. The step solves
+//   (J^T*J + lambda*diag(J^T*J)) d = -J^T*r with a 5x5 Cholesky factorization. A rejected step only
+//   changes lambda: J^T*J and J^T*r are reused and the small system is refactored, without another pass
+//   over the data. lambda is divided by 3 after an accepted step and multiplied by 4 after a rejected one.
+// - Warm start: the algebraic conic fit (dgels) is converted to center, axes and orientation in closed form
+//   and mapped to (a, b, th), so LM starts next to the minimum and converges in a few iterations.
+//
+// Note on the parametrization: the matrix M = [a*cos(th) -b*sin(th); b*cos(th) a*sin(th)] that maps
+// (cos t, sin t) to the point has orthogonal columns, so M = R(phi)*diag(A, B) with
+// r = sqrt(a^2 + b^2), A = r*cos(th), B = r*sin(th), phi = atan2(b, a): semi-axes A, B, rotation phi.
+//
+// Usage:
+//   ./math [n]
+//   n: number of intervals, n+1 points (default 100)
+
+#include <stdio.h>   // Standard I/O functions
+#include <stdlib.h>  // Standard library (for rand, srand, malloc, EXIT_SUCCESS)
+#include <math.h>    // Math functions (cos, sin, acos, atan2, sqrt, fabs)
+#include <time.h>    // Time functions (for seeding random number generator)
+#include <lapacke.h> // LAPACK C interface for linear algebra
+
+#define FOOT_ITER 20   // Newton steps per foot point at most
+#define LM_ITER 100    // Levenberg-Marquardt iterations at most
+
+// Helper function to print a matrix with a name
+static void printm(char *name, int m, int n, double *pA)
+{
+    int i, j;
+    printf("\n %s\n", name); // Print matrix name
+    for (i=0; i<m; i++)
+    {
+        for (j=0; j<n; j++)
+            printf(" %10.6lf", pA[i*n+j]); // Print each element
+        printf("\n");
+    }
+}
+
+// Parametric function for x-coordinate of ellipse
+static double fx(double t, double a, double b, double th, double x0)
+{
+    // a, b: ellipse axes; th: rotation; x0: center x; t: parameter
+    return a*cos(th)*cos(t) - b*sin(th)*sin(t) + x0;
+}
+
+// Parametric function for y-coordinate of ellipse
+static double fy(double t, double a, double b, double th, double y0)
+{
+    // a, b: ellipse axes; th: rotation; y0: center y; t: parameter
+    return a*sin(th)*sin(t) + b*cos(th)*cos(t) + y0;
+}
+
+// Curve parameter of the point of the ellipse P closest to (x, y), Newton iteration from t
+static double foot(const double P[5], double x, double y, double t)
+{
+    double a = P[0], b = P[1], c = cos(P[2]), s = sin(P[2]);
+    int it;
+    for (it=0; it<FOOT_ITER; it++)
+    {
+        double ct = cos(t), st = sin(t);
+        double ex = a*c*ct - b*s*st, ey = a*s*st + b*c*ct; // f(t) - center
+        double dx = x - P[3] - ex, dy = y - P[4] - ey;      // p - f(t)
+        double d1x = -a*c*st - b*s*ct, d1y = a*s*ct - b*c*st; // f'(t); f''(t) = -(f(t) - center)
+        double g = -(dx*d1x + dy*d1y);                        // h'(t) of h = |p - f(t)|^2/2
+        double h = d1x*d1x + d1y*d1y + (dx*ex + dy*ey);       // h''(t)
+        double hmin = d1x*d1x + d1y*d1y;
+        double dt = -g / ((h > 0.1*hmin) ? h : hmin + sqrt(dx*dx + dy*dy)*sqrt(ex*ex + ey*ey));
+        t += dt;
+        if (fabs(dt) < 1e-12)
+            break;
+    }
+    return t;
+}
+
+// Updates the foot points t[] for P and returns the sum of squared distances
+static double foot_all(const double P[5], const double x[], const double y[], double t[], int m)
+{
+    double cost = 0.0;
+    int k;
+    for (k=0; k<m; k++)
+    {
+        t[k] = foot(P, x[k], y[k], t[k]);
+        double dx = x[k] - fx(t[k], P[0], P[1], P[2], P[3]);
+        double dy = y[k] - fy(t[k], P[0], P[1], P[2], P[4]);
+        cost += dx*dx + dy*dy;
+    }
+    return cost;
+}
+
+// Accumulates J^T*J (N, upper triangle) and J^T*r (g) for the signed distances r_k = n_k.(p_k - f(t_k)),
+// n_k the unit normal of the ellipse at the foot point t[k]
+static void lm_normal(const double P[5], const double x[], const double y[], const double t[], int m,
+                      double N[25], double g[5])
+{
+    double a = P[0], b = P[1], c = cos(P[2]), s = sin(P[2]);
+    int i, j, k;
+    for (i=0; i<25; i++)
+        N[i] = 0.0;
+    for (i=0; i<5; i++)
+        g[i] = 0.0;
+    for (k=0; k<m; k++)
+    {
+        double ct = cos(t[k]), st = sin(t[k]);
+        double d1x = -a*c*st - b*s*ct, d1y = a*s*ct - b*c*st; // Tangent f'(t)
+        double len = sqrt(d1x*d1x + d1y*d1y);
+        double nx = d1y/len, ny = -d1x/len;
+        double r = nx*(x[k] - (a*c*ct - b*s*st + P[3])) + ny*(y[k] - (a*s*st + b*c*ct + P[4]));
+        // Row of J = -n.df/dP
+        double jr[5] = { -(nx*c*ct + ny*s*st),
+                         nx*s*st - ny*c*ct,
+                         nx*(a*s*ct + b*c*st) + ny*(b*s*ct - a*c*st),
+                         -nx,
+                         -ny };
+        for (i=0; i<5; i++)
+        {
+            for (j=i; j<5; j++)
+                N[i*5+j] += jr[i]*jr[j];
+            g[i] += jr[i]*r;
+        }
+    }
+}
+
+// Solves (N + lambda*diag(N)) d = -g by Cholesky; N holds the upper triangle
+// Returns 0, or -1 if the damped matrix is not positive definite
+static int lm_step(const double N[25], const double g[5], double lambda, double d[5])
+{
+    double L[25], z[5];
+    int i, j, k;
+    for (j=0; j<5; j++)
+    {
+        double v = N[j*5+j]*(1.0 + lambda);
+        for (k=0; k<j; k++)
+            v -= L[j*5+k]*L[j*5+k];
+        if (!(v > 0.0))
+            return -1;
+        L[j*5+j] = sqrt(v);
+        for (i=j+1; i<5; i++)
+        {
+            double w = N[j*5+i];
+            for (k=0; k<j; k++)
+                w -= L[i*5+k]*L[j*5+k];
+            L[i*5+j] = w / L[j*5+j];
+        }
+    }
+    for (i=0; i<5; i++)
+    {
+        double w = -g[i];
+        for (k=0; k<i; k++)
+            w -= L[i*5+k]*z[k];
+        z[i] = w / L[i*5+i];
+    }
+    for (i=4; i>=0; i--)
+    {
+        double w = z[i];
+        for (k=i+1; k<5; k++)
+            w -= L[k*5+i]*d[k];
+        d[i] = w / L[i*5+i];
+    }
+    return 0;
+}
+
+// Geometric fit: refines P in place, t[] holds the foot points afterwards
+// Returns the number of accepted steps, or -1 on allocation failure
+static int lm_fit(double P[5], const double x[], const double y[], double t[], int m, int verbose)
+{
+    double N[25], g[5], d[5], Pn[5];
+    double lambda = 1e-3;
+    double *tn = malloc(sizeof(double)*m);
+    int it, k, i, done = 0;
+
+    if (!tn)
+        return -1;
+    double cost = foot_all(P, x, y, t, m);
+    if (verbose)
+        printf("  iter  0: sum of squared distances %.10lf\n", cost);
+    for (it=0; it<LM_ITER && !done; )
+    {
+        lm_normal(P, x, y, t, m, N, g);
+        // Damping loop: N and g stay the same, only the 5x5 system is refactored
+        for (;;)
+        {
+            double cn = INFINITY;
+            if (!lm_step(N, g, lambda, d))
+            {
+                for (i=0; i<5; i++)
+                    Pn[i] = P[i] + d[i];
+                for (k=0; k<m; k++)
+                    tn[k] = t[k];
+                cn = foot_all(Pn, x, y, tn, m);
+            }
+            if (cn < cost)
+            {
+                double gain = cost - cn;
+                for (i=0; i<5; i++)
+                    P[i] = Pn[i];
+                for (k=0; k<m; k++)
+                    t[k] = tn[k];
+                cost = cn;
+                lambda /= 3.0;
+                it++;
+                if (verbose)
+                    printf("  iter %2d: sum of squared distances %.10lf, lambda %.1e\n", it, cost, lambda);
+                done = (gain <= 1e-12*cost); // Converged
+                break;
+            }
+            lambda *= 4.0;
+            if (lambda > 1e12)
+            {
+                done = 1; // No further decrease possible: P is a minimum to working precision
+                break;
+            }
+        }
+    }
+    free(tn);
+    return it;
+}
+
+// Algebraic conic fit p0*x^2 + p1*y^2 + p2*x*y + p3*x + p4*y = 1 with LAPACK (as in lab-4-2-calc-lib)
+static int conic_fit(const double x[], const double y[], int m, double p[5])
+{
+    double *A = malloc(sizeof(double)*m*5), *B = malloc(sizeof(double)*m), wq, *work = NULL;
+    int k, err = -1;
+    if (A && B)
+    {
+        for (k=0; k<m; k++)
+        {
+            A[0*m+k] = x[k]*x[k];
+            A[1*m+k] = y[k]*y[k];
+            A[2*m+k] = x[k]*y[k];
+            A[3*m+k] = x[k];
+            A[4*m+k] = y[k];
+            B[k] = 1.0;
+        }
+        if (!LAPACKE_dgels_work(LAPACK_COL_MAJOR, 'N', m, 5, 1, A, m, B, m, &wq, -1)
+            && (work = malloc(sizeof(double)*(size_t) wq))
+            && !LAPACKE_dgels_work(LAPACK_COL_MAJOR, 'N', m, 5, 1, A, m, B, m, work, (lapack_int) wq))
+        {
+            for (k=0; k<5; k++)
+                p[k] = B[k];
+            err = 0;
+        }
+    }
+    free(A);
+    free(B);
+    free(work);
+    return err;
+}
+
+// Converts an ellipse conic to the parameters P = (a, b, th, x0, y0) of fx/fy
+// Returns 0, or -1 if the conic is not an ellipse
+static int conic_to_params(const double p[5], double P[5])
+{
+    // Center: gradient of the conic is zero
+    double det = 4.0*p[0]*p[1] - p[2]*p[2];
+    if (!(det > 0.0))
+        return -1;
+    double xc = (p[2]*p[4] - 2.0*p[1]*p[3]) / det;
+    double yc = (p[2]*p[3] - 2.0*p[0]*p[4]) / det;
+    // d^T*Q*d = 1 around the center, Q = [p0 p2/2; p2/2 p1]/(1 - value of the quadratic part at the center)
+    double k = 1.0 - (p[0]*xc*xc + p[1]*yc*yc + p[2]*xc*yc + p[3]*xc + p[4]*yc);
+    double q11 = p[0]/k, q12 = 0.5*p[2]/k, q22 = p[1]/k;
+    // Eigenvalues and angle of the first eigenvector of Q: semi-axes 1/sqrt(eigenvalue)
+    double mean = 0.5*(q11 + q22), dev = sqrt(0.25*(q11 - q22)*(q11 - q22) + q12*q12);
+    double l1 = mean - dev, l2 = mean + dev;
+    if (!(l1 > 0.0))
+        return -1;
+    double phi = 0.5*atan2(2.0*q12, q11 - q22) + ((l1 < l2) ? 0.5*acos(-1.0) : 0.0); // Direction of l1
+    double A = 1.0/sqrt(l1), B = 1.0/sqrt(l2);
+    // M = R(phi)*diag(A, B)  <=>  r = sqrt(A^2 + B^2), th = atan2(B, A), a = r*cos(phi), b = r*sin(phi)
+    double r = sqrt(A*A + B*B);
+    P[0] = r*cos(phi);
+    P[1] = r*sin(phi);
+    P[2] = atan2(B, A);
+    P[3] = xc;
+    P[4] = yc;
+    return 0;
+}
+
+// Initial foot parameters from the inverse of M: (cos t, sin t) ~ M^-1 (p - center)
+static void foot_init(const double P[5], const double x[], const double y[], double t[], int m)
+{
+    double c = cos(P[2]), s = sin(P[2]);
+    double m11 = P[0]*c, m12 = -P[1]*s, m21 = P[1]*c, m22 = P[0]*s;
+    double det = m11*m22 - m12*m21;
+    int k;
+    for (k=0; k<m; k++)
+    {
+        double dx = x[k] - P[3], dy = y[k] - P[4];
+        t[k] = atan2((-m21*dx + m11*dy)/det, (m22*dx - m12*dy)/det);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    // --- 1. Set ellipse parameters ---
+    double a  = 2.0; // Major axis
+    double b  = 1.5; // Minor axis
+    double th = acos(-1.0)/8.0; // Rotation angle (pi/8)
+    double x0 = 2.0; // Center x
+    double y0 = 0.0; // Center y
+    int n = (argc > 1) ? atoi(argv[1]) : 100;
+    int k;
+
+    if (n < 5)
+    {
+        fprintf(stderr, "usage: %s [n(>=5)]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // --- 2. Simulate measured data: ellipse points with noise in [-0.25, 0.25] ---
+    double *x = malloc(sizeof(double)*(n+1)), *y = malloc(sizeof(double)*(n+1)), *t = malloc(sizeof(double)*(n+1));
+    if (!x || !y || !t)
+        return EXIT_FAILURE;
+    srand(clock()); // Seed RNG
+    for (k=0; k<=n; k++)
+    {
+        double ts = 0.0 + 2.0*acos(-1.0)*k/n; // t from 0 to 2*pi
+        x[k] = fx(ts, a, b, th, x0) + 0.5*(-0.5 + (double) rand()/RAND_MAX);
+        y[k] = fy(ts, a, b, th, y0) + 0.5*(-0.5 + (double) rand()/RAND_MAX);
+    }
+
+    // --- 3. Algebraic fit and conversion to (a, b, th, x0, y0) ---
+    double p[5], P[5], Ptrue[5] = { a, b, th, x0, y0 };
+    if (conic_fit(x, y, n+1, p) || conic_to_params(p, P))
+    {
+        fprintf(stderr, "The algebraic fit is not an ellipse\n");
+        return EXIT_FAILURE;
+    }
+    printm("p (algebraic conic)", 1, 5, p);
+    printm("P = (a, b, th, x0, y0), true", 1, 5, Ptrue);
+    printm("P from the algebraic fit", 1, 5, P);
+    foot_init(P, x, y, t, n+1);
+    double calg = foot_all(P, x, y, t, n+1);
+
+    // --- 4. Geometric fit with Levenberg-Marquardt ---
+    printf("\n Levenberg-Marquardt:\n");
+    int iters = lm_fit(P, x, y, t, n+1, 1);
+    if (iters < 0)
+        return EXIT_FAILURE;
+    double cgeo = foot_all(P, x, y, t, n+1);
+    printm("P from the geometric fit", 1, 5, P);
+    printf(" %d iterations; RMS distance: algebraic %.6lf, geometric %.6lf\n",
+           iters, sqrt(calg/(n+1)), sqrt(cgeo/(n+1)));
+
+    // --- 5. Output data and fitted ellipse for gnuplot ---
+    FILE *fp = fopen("geom_data.dat", "w");
+    if (!fp) {
+        perror("Could not open geom_data.dat for writing");
+        return EXIT_FAILURE;
+    }
+    for (k = 0; k <= n; k++) {
+        // Data point and its foot point on the fitted ellipse
+        fprintf(fp, "% .10f % .10f % .10f % .10f\n", x[k], y[k],
+                fx(t[k], P[0], P[1], P[2], P[3]), fy(t[k], P[0], P[1], P[2], P[4]));
+    }
+    fclose(fp);
+    FILE *fp_fit = fopen("geom_fit.dat", "w");
+    if (!fp_fit) {
+        perror("Could not open geom_fit.dat for writing");
+        return EXIT_FAILURE;
+    }
+    int Nplot = 200;
+    for (int i = 0; i <= Nplot; ++i) {
+        double tp = 2.0*acos(-1.0)*i/Nplot;
+        fprintf(fp_fit, "% .10f % .10f % .10f % .10f\n", fx(tp, P[0], P[1], P[2], P[3]), fy(tp, P[0], P[1], P[2], P[4]),
+                fx(tp, a, b, th, x0), fy(tp, a, b, th, y0));
+    }
+    fclose(fp_fit);
+    free(x);
+    free(y);
+    free(t);
+
+    printf("\nData for gnuplot written to geom_data.dat and geom_fit.dat\n");
+    printf("You can plot with gnuplot using:\n");
+    printf("  gnuplot -persist -e \"set size ratio -1; plot 'geom_data.dat' u 1:2 w p pt 7 lc rgb 'red' title 'Noisy data', \\\n");
+    printf("    'geom_data.dat' u 1:2:(\\$3-\\$1):(\\$4-\\$2) w vectors nohead lc rgb 'gray' title 'Distances', \\\n");
+    printf("    'geom_fit.dat' u 3:4 w l lc rgb 'blue' title 'True ellipse', \\\n");
+    printf("    'geom_fit.dat' u 1:2 w l lc rgb 'green' title 'Geometric fit'\"\n");
+    return EXIT_SUCCESS;
+}
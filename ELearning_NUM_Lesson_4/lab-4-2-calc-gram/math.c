@@ -0,0 +1,444 @@
+// math.c - Streaming conic fit from the 5x5 Gram matrix, with optional QR refinement
+// General Overview:
+// lab-4-2-calc-lib fits the conic p0*x^2 + p1*y^2 + p2*x*y + p3*x + p4*y = 1 to noisy ellipse points by
+// building the whole (n+1) x 5 design matrix A on the stack and calling LAPACKE_dgels. The memory grows
+// with n, and a few hundred thousand points overflow the stack. This program solves the same
+// least-squares problem min ||A*p - 1|| from a stream of points in constant memory:
+//
+// - Gram path: the points are taken in blocks of CONIC_BLOCK rows. For each block the 15 distinct entries
+//   of A^T*A (a symmetric rank-k update, SYRK) and the 5 entries of A^T*1 are summed in CONIC_LANES
+//   independent lanes, which the compiler turns into vector instructions. The block totals are added to
+//   the running sums with Neumaier compensation. The final 5x5 system G*p = A^T*1 is solved by Cholesky.
+// - QR path (optional): a 6x6 triangular factor R of the augmented matrix [A 1] is kept. Each block is
+//   stacked under R and refactored with LAPACKE_dgeqrf_work, so R always equals the R factor of all rows
+//   seen so far. The fit then follows from R*p = r by back substitution, without squaring the condition
+//   number as the Gram matrix does. R(5,5) is the residual norm.
+// - The coordinates are scaled by a power of two s (u = x/s, v = y/s) before they enter the sums. This
+//   does not change the least-squares problem, only its conditioning; the coefficients are scaled back.
+//
+// Memory: the accumulator holds 2x25 Gram entries, 2x5 right-hand side entries, the 6x6 R and one QR block
+// buffer, independent of the number of points. 10^8 points need no more memory than 100.
+//
+// Usage:
+//   ./math [N] [qr]
+//   N: number of streamed points (default 10000000), qr: 0 disables the QR path (default 1)
+
+#define _POSIX_C_SOURCE 200809L // For clock_gettime
+
+#include <stdio.h>   // Standard I/O functions
+#include <stdlib.h>  // Standard library (for rand, srand, malloc, EXIT_SUCCESS)
+#include <string.h>  // For memset, memcpy
+#include <math.h>    // Math functions (cos, sin, acos, sqrt, frexp, ldexp)
+#include <time.h>    // Time functions (for seeding and timing)
+#include <lapacke.h> // LAPACK C interface for linear algebra
+
+#define CONIC_BLOCK 256 // Points per block
+#define CONIC_LANES 4   // Independent partial sums per entry inside a block
+
+// Streaming accumulator of the conic least-squares problem
+struct CONICACC
+{
+    double s;                    // Coordinate scale, u = x/s, v = y/s (0: taken from the first block)
+    long n;                      // Number of points accumulated
+    double G[25], Gc[25];        // A^T*A of the scaled rows, upper triangle used, and compensation terms
+    double r[5], rc[5];          // A^T*1 and compensation terms
+    int qr;                      // Nonzero: also maintain the QR factor
+    double R[36];                // 6x6 upper triangular factor of [A 1], column-major
+    double *buf;                 // (6 + CONIC_BLOCK) x 6 QR work matrix, column-major
+    double *tau, *work;          // dgeqrf scalar factors and workspace
+    lapack_int lwork;
+};
+
+// Helper function to print a matrix with a name
+static void printm(char *name, int m, int n, double *pA)
+{
+    int i, j;
+    printf("\n %s\n", name); // Print matrix name
+    for (i=0; i<m; i++)
+    {
+        for (j=0; j<n; j++)
+            printf(" %10.6lf", pA[i*n+j]); // Print each element
+        printf("\n");
+    }
+}
+
+// Parametric function for x-coordinate of ellipse
+static double fx(double t, double a, double b, double th, double x0)
+{
+    // a, b: ellipse axes; th: rotation; x0: center x; t: parameter
+    return a*cos(th)*cos(t) - b*sin(th)*sin(t) + x0;
+}
+
+// Parametric function for y-coordinate of ellipse
+static double fy(double t, double a, double b, double th, double y0)
+{
+    // a, b: ellipse axes; th: rotation; y0: center y; t: parameter
+    return a*sin(th)*sin(t) + b*cos(th)*cos(t) + y0;
+}
+
+// Neumaier compensated addition: *s + *c carries the sum, v is added
+static void kahan_add(double *s, double *c, double v)
+{
+    double t = *s + v;
+    if (fabs(*s) >= fabs(v))
+        *c += (*s - t) + v;
+    else
+        *c += (v - t) + *s;
+    *s = t;
+}
+
+// Initializes an empty accumulator; s: coordinate scale (0: from the first block), qr: enable the QR path
+// Returns 0, or -1 if the QR storage cannot be allocated
+static int conic_init(struct CONICACC *acc, double s, int qr)
+{
+    double wq;
+    memset(acc, 0, sizeof(*acc));
+    acc->s = s;
+    acc->qr = qr;
+    if (!qr)
+        return 0;
+    acc->buf = malloc(sizeof(double)*(6 + CONIC_BLOCK)*6);
+    acc->tau = malloc(sizeof(double)*6);
+    if (!acc->buf || !acc->tau)
+        return -1;
+    if (LAPACKE_dgeqrf_work(LAPACK_COL_MAJOR, 6 + CONIC_BLOCK, 6, acc->buf, 6 + CONIC_BLOCK, acc->tau, &wq, -1))
+        return -1;
+    acc->lwork = (lapack_int) wq;
+    acc->work = malloc(sizeof(double)*acc->lwork);
+    return acc->work ? 0 : -1;
+}
+
+static void conic_free(struct CONICACC *acc)
+{
+    free(acc->buf);
+    free(acc->tau);
+    free(acc->work);
+    acc->buf = acc->tau = acc->work = NULL;
+}
+
+// Adds one block of at most CONIC_BLOCK points
+// Returns 0, or the dgeqrf info of the QR path
+static int conic_block(struct CONICACC *acc, const double x[], const double y[], int m)
+{
+    double u[CONIC_BLOCK], v[CONIC_BLOCK];
+    double sum[20][CONIC_LANES]; // 15 Gram entries and 5 right-hand side entries per lane
+    double inv = 1.0 / acc->s;
+    int k, l, i, j, e;
+
+    for (k=0; k<m; k++)
+    {
+        u[k] = x[k]*inv;
+        v[k] = y[k]*inv;
+    }
+    // Pad to a multiple of the lane count with zero rows, which add nothing to the sums
+    for (; k % CONIC_LANES; k++)
+        u[k] = v[k] = 0.0;
+
+    memset(sum, 0, sizeof(sum));
+    for (k=0; k<m; k+=CONIC_LANES)
+        for (l=0; l<CONIC_LANES; l++)
+        {
+            double a[5] = { u[k+l]*u[k+l], v[k+l]*v[k+l], u[k+l]*v[k+l], u[k+l], v[k+l] };
+            e = 0;
+            for (i=0; i<5; i++)
+                for (j=i; j<5; j++)
+                    sum[e++][l] += a[i]*a[j];
+            for (i=0; i<5; i++)
+                sum[15+i][l] += a[i];
+        }
+    // Fold the lanes and add the block totals to the compensated running sums
+    e = 0;
+    for (i=0; i<5; i++)
+        for (j=i; j<5; j++, e++)
+        {
+            double t = 0.0;
+            for (l=0; l<CONIC_LANES; l++)
+                t += sum[e][l];
+            kahan_add(&acc->G[i*5+j], &acc->Gc[i*5+j], t);
+        }
+    for (i=0; i<5; i++)
+    {
+        double t = 0.0;
+        for (l=0; l<CONIC_LANES; l++)
+            t += sum[15+i][l];
+        kahan_add(&acc->r[i], &acc->rc[i], t);
+    }
+    acc->n += m;
+
+    if (acc->qr)
+    {
+        // Stack the current R over the block rows [u^2 v^2 uv u v 1] and refactor
+        int ld = 6 + m;
+        double *B = acc->buf;
+        for (j=0; j<6; j++)
+        {
+            memcpy(B + j*ld, acc->R + j*6, sizeof(double)*6);
+            double *c = B + j*ld + 6;
+            for (k=0; k<m; k++)
+            {
+                switch (j)
+                {
+                    case 0: c[k] = u[k]*u[k]; break;
+                    case 1: c[k] = v[k]*v[k]; break;
+                    case 2: c[k] = u[k]*v[k]; break;
+                    case 3: c[k] = u[k]; break;
+                    case 4: c[k] = v[k]; break;
+                    default: c[k] = 1.0;
+                }
+            }
+        }
+        lapack_int info = LAPACKE_dgeqrf_work(LAPACK_COL_MAJOR, ld, 6, B, ld, acc->tau, acc->work, acc->lwork);
+        if (info)
+            return info;
+        for (j=0; j<6; j++)
+            for (i=0; i<6; i++)
+                acc->R[j*6+i] = (i <= j) ? B[j*ld+i] : 0.0;
+    }
+    return 0;
+}
+
+// Adds the points (x[k], y[k]), k = 0..m-1
+// Returns 0, or the dgeqrf info of the QR path
+static int conic_add(struct CONICACC *acc, const double x[], const double y[], long m)
+{
+    long k;
+    int info;
+    if (m <= 0)
+        return 0;
+    if (acc->s == 0.0)
+    {
+        // Power of two scale from the first block, so the scaling itself is exact
+        double mx = 0.0;
+        int ex;
+        for (k=0; k<m && k<CONIC_BLOCK; k++)
+        {
+            if (fabs(x[k]) > mx) mx = fabs(x[k]);
+            if (fabs(y[k]) > mx) mx = fabs(y[k]);
+        }
+        frexp(mx > 0.0 ? mx : 1.0, &ex);
+        acc->s = ldexp(1.0, ex);
+    }
+    for (k=0; k<m; k+=CONIC_BLOCK)
+        if ((info = conic_block(acc, x + k, y + k, (m - k < CONIC_BLOCK) ? m - k : CONIC_BLOCK)))
+            return info;
+    return 0;
+}
+
+// Converts coefficients of the scaled coordinates back to x, y
+static void conic_unscale(const struct CONICACC *acc, const double q[5], double p[5])
+{
+    double s = acc->s;
+    p[0] = q[0]/(s*s);
+    p[1] = q[1]/(s*s);
+    p[2] = q[2]/(s*s);
+    p[3] = q[3]/s;
+    p[4] = q[4]/s;
+}
+
+// Solves the Gram system G*p = A^T*1 by Cholesky
+// p: conic coefficients [x^2, y^2, xy, x, y], res: residual norm ||A*p - 1|| (may be NULL)
+// Returns 0, or -1 if G is not positive definite (fewer than 5 points in general position)
+static int conic_solve_gram(const struct CONICACC *acc, double p[5], double *res)
+{
+    double L[25], z[5], q[5];
+    int i, j, k;
+    for (j=0; j<5; j++)
+    {
+        double d = acc->G[j*5+j] + acc->Gc[j*5+j];
+        for (k=0; k<j; k++)
+            d -= L[j*5+k]*L[j*5+k];
+        if (!(d > 1e-14*(acc->G[j*5+j] + acc->Gc[j*5+j])))
+            return -1;
+        L[j*5+j] = sqrt(d);
+        for (i=j+1; i<5; i++)
+        {
+            double t = acc->G[j*5+i] + acc->Gc[j*5+i];
+            for (k=0; k<j; k++)
+                t -= L[i*5+k]*L[j*5+k];
+            L[i*5+j] = t / L[j*5+j];
+        }
+    }
+    for (i=0; i<5; i++)
+    {
+        double t = acc->r[i] + acc->rc[i];
+        for (k=0; k<i; k++)
+            t -= L[i*5+k]*z[k];
+        z[i] = t / L[i*5+i];
+    }
+    for (i=4; i>=0; i--)
+    {
+        double t = z[i];
+        for (k=i+1; k<5; k++)
+            t -= L[k*5+i]*q[k];
+        q[i] = t / L[i*5+i];
+    }
+    if (res)
+    {
+        // ||A*q - 1||^2 = n - q^T*A^T*1, since G*q = A^T*1
+        double rr = (double) acc->n;
+        for (i=0; i<5; i++)
+            rr -= q[i]*(acc->r[i] + acc->rc[i]);
+        *res = (rr > 0.0) ? sqrt(rr) : 0.0;
+    }
+    conic_unscale(acc, q, p);
+    return 0;
+}
+
+// Solves R(0:4,0:4)*p = R(0:4,5) from the QR path
+// Returns 0, or -1 if the QR path is off or R is singular
+static int conic_solve_qr(const struct CONICACC *acc, double p[5], double *res)
+{
+    double q[5];
+    int i, k;
+    if (!acc->qr)
+        return -1;
+    for (i=4; i>=0; i--)
+    {
+        double t = acc->R[5*6+i];
+        if (!(fabs(acc->R[i*6+i]) > 1e-14*fabs(acc->R[0])))
+            return -1;
+        for (k=i+1; k<5; k++)
+            t -= acc->R[k*6+i]*q[k];
+        q[i] = t / acc->R[i*6+i];
+    }
+    if (res)
+        *res = fabs(acc->R[5*6+5]);
+    conic_unscale(acc, q, p);
+    return 0;
+}
+
+// Coefficients of the exact ellipse fx/fy in the form p0*x^2 + p1*y^2 + p2*x*y + p3*x + p4*y = 1
+static void ellipse_conic(double a, double b, double th, double x0, double y0, double p[5])
+{
+    // (x - x0, y - y0) = M*(cos t, sin t), so the ellipse is d^T*Q*d = 1 with Q = (M*M^T)^-1
+    double m11 = a*cos(th), m12 = -b*sin(th), m21 = b*cos(th), m22 = a*sin(th);
+    double s11 = m11*m11 + m12*m12, s12 = m11*m21 + m12*m22, s22 = m21*m21 + m22*m22;
+    double det = s11*s22 - s12*s12;
+    double q11 = s22/det, q12 = -s12/det, q22 = s11/det;
+    double k = 1.0 - (q11*x0*x0 + 2.0*q12*x0*y0 + q22*y0*y0);
+    p[0] = q11/k;
+    p[1] = q22/k;
+    p[2] = 2.0*q12/k;
+    p[3] = -2.0*(q11*x0 + q12*y0)/k;
+    p[4] = -2.0*(q22*y0 + q12*x0)/k;
+}
+
+// Monotonic wall clock in seconds
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+    // --- 1. Set ellipse parameters ---
+    double a  = 2.0; // Major axis
+    double b  = 1.5; // Minor axis
+    double th = acos(-1.0)/8.0; // Rotation angle (pi/8)
+    double x0 = 2.0; // Center x
+    double y0 = 0.0; // Center y
+    long N = (argc > 1) ? atol(argv[1]) : 10000000;
+    int qr = (argc > 2) ? atoi(argv[2]) : 1;
+    struct CONICACC acc;
+    double p[5], pq[5], ptrue[5], res, resq;
+    long k;
+    int i;
+
+    if (N < 5)
+    {
+        fprintf(stderr, "usage: %s [N(>=5)] [qr(0|1)]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    ellipse_conic(a, b, th, x0, y0, ptrue);
+    printm("p (exact ellipse)", 1, 5, ptrue);
+
+    // --- 2. Small dataset of lab-4-2-calc-lib: full dgels against the streaming paths ---
+    int n = 100;
+    double x[n+1], y[n+1];
+    srand(clock()); // Seed RNG
+    for (k=0; k<=n; k++)
+    {
+        double t = 0.0 + 2.0*acos(-1.0)*k/n; // t from 0 to 2*pi
+        x[k] = fx(t, a, b, th, x0) + 0.5*(-0.5 + (double) rand()/RAND_MAX); // Add noise in [-0.25, 0.25]
+        y[k] = fy(t, a, b, th, y0) + 0.5*(-0.5 + (double) rand()/RAND_MAX);
+    }
+    double *A = malloc(sizeof(double)*(n+1)*5), B[n+1], wq;
+    if (!A)
+        return EXIT_FAILURE;
+    for (k=0; k<=n; k++)
+    {
+        A[0*(n+1)+k] = x[k]*x[k]; // x^2
+        A[1*(n+1)+k] = y[k]*y[k]; // y^2
+        A[2*(n+1)+k] = x[k]*y[k]; // x*y
+        A[3*(n+1)+k] = x[k];      // x
+        A[4*(n+1)+k] = y[k];      // y
+        B[k] = 1.0;
+    }
+    LAPACKE_dgels_work(LAPACK_COL_MAJOR, 'N', n+1, 5, 1, A, n+1, B, n+1, &wq, -1);
+    double *work = malloc(sizeof(double)*(size_t) wq);
+    if (!work || LAPACKE_dgels_work(LAPACK_COL_MAJOR, 'N', n+1, 5, 1, A, n+1, B, n+1, work, (lapack_int) wq))
+        return EXIT_FAILURE;
+    free(work);
+    free(A);
+    printf("\n%d points:", n+1);
+    printm("p (dgels on the full matrix)", 1, 5, B);
+    if (conic_init(&acc, 0.0, 1) || conic_add(&acc, x, y, n+1))
+        return EXIT_FAILURE;
+    int errg = conic_solve_gram(&acc, p, &res);
+    int errq = conic_solve_qr(&acc, pq, &resq);
+    if (!errg)
+        printm("p (Gram)", 1, 5, p);
+    else
+        printf(" Gram solve failed (G not positive definite)\n");
+    if (!errq)
+        printm("p (streaming QR)", 1, 5, pq);
+    else
+        printf(" Streaming QR solve failed (R singular)\n");
+    // Compare only the solutions that exist
+    double d1 = 0.0, d2 = 0.0;
+    for (i=0; i<5; i++)
+    {
+        if (!errg && fabs(p[i] - B[i]) > d1) d1 = fabs(p[i] - B[i]);
+        if (!errq && fabs(pq[i] - B[i]) > d2) d2 = fabs(pq[i] - B[i]);
+    }
+    if (!errg)
+        printf(" max |Gram - dgels| = %.3e\n", d1);
+    if (!errq)
+        printf(" max |QR - dgels| = %.3e\n", d2);
+    conic_free(&acc);
+
+    // --- 3. Long stream, generated block by block, in constant memory ---
+    double xb[CONIC_BLOCK], yb[CONIC_BLOCK];
+    if (conic_init(&acc, 0.0, qr))
+        return EXIT_FAILURE;
+    double t0 = now_s();
+    for (k=0; k<N; k+=CONIC_BLOCK)
+    {
+        int m = (N - k < CONIC_BLOCK) ? N - k : CONIC_BLOCK;
+        for (i=0; i<m; i++)
+        {
+            double t = 2.0*acos(-1.0)*(k + i)/N;
+            xb[i] = fx(t, a, b, th, x0) + 0.5*(-0.5 + (double) rand()/RAND_MAX);
+            yb[i] = fy(t, a, b, th, y0) + 0.5*(-0.5 + (double) rand()/RAND_MAX);
+        }
+        if (conic_add(&acc, xb, yb, m))
+            return EXIT_FAILURE;
+    }
+    double dt = now_s() - t0;
+    printf("\n%ld streamed points (%.2lf s including data generation):", N, dt);
+    if (!conic_solve_gram(&acc, p, &res))
+    {
+        printm("p (Gram)", 1, 5, p);
+        printf(" residual norm %.6lf\n", res);
+    }
+    if (!conic_solve_qr(&acc, pq, &resq))
+    {
+        printm("p (streaming QR)", 1, 5, pq);
+        printf(" residual norm %.6lf\n", resq);
+    }
+    conic_free(&acc);
+
+    return EXIT_SUCCESS;
+}
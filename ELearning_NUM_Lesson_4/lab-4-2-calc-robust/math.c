@@ -0,0 +1,649 @@
+// math.c - Robust line and conic fits: RANSAC and IRLS (Huber, Tukey)
+// General Overview:
+// The data of lab-4-1-calc and lab-4-2-calc-lib only has bounded uniform noise, and the plain
+// least-squares fit (normal equations or LAPACKE_dgels) is fine for it. A few gross outliers are enough to
+// drag that fit far away. This program adds two robust estimators, for both models of the labs:
+//   line:  y = a0 + a1*x                                 (rows [1 x], right-hand side y)
+//   conic: p0*x^2 + p1*y^2 + p2*x*y + p3*x + p4*y = 1    (rows [x^2 y^2 xy x y], right-hand side 1)
+//
+// RANSAC:
+// - A hypothesis is the exact fit through a random minimal sample (2 points for the line, 5 for the conic).
+// - Hypotheses are drawn in batches of RANSAC_BATCH and scored in parallel: the worker threads are started
+//   once per fit, wait for a batch, take one hypothesis at a time and count the points within the threshold.
+//   The scoring loops are branch-free over the coordinate arrays so the compiler can vectorize them.
+// - Early termination, twice: a hypothesis is abandoned as soon as its inliers plus the points not yet
+//   scored can no longer beat the best count of the earlier batches; and the number of batches adapts to
+//   the best inlier ratio w, stopping once log(1 - confidence)/log(1 - w^s) hypotheses have been tried.
+//   Equal counts go to the earlier hypothesis, so the result does not depend on the number of threads.
+// - The best hypothesis is refitted by least squares on its inliers, and the inliers of the refit are
+//   selected again, until the inlier set no longer changes (local optimization, as in LO-RANSAC). A single
+//   refit still carries the error of the minimal sample through the choice of the inliers.
+//
+// IRLS (iteratively reweighted least squares):
+// - Starting from a fit, the residuals r_k are scaled by s = 1.4826*median(|r|) (median over the gated points,
+//   see below) and turned into weights:
+//   Huber: w = 1 for |r| <= 1.345s, else 1.345s/|r|; Tukey: w = (1 - (r/4.685s)^2)^2 for |r| < 4.685s, else 0.
+// - The residuals are those of the least-squares rows (rhs - row*c), so IRLS is a plain M-estimator of the
+//   linear problem. For the conic these are algebraic values, not distances, and far outliers have large
+//   rows (x^2, y^2): they are high-leverage points that even Tukey weights do not reliably remove. IRLS is
+//   therefore run as a refinement after RANSAC, on the points within gate*thr of the RANSAC fit. The line
+//   uses a gate of 2 so IRLS can move away from the RANSAC fit; for the conic the outliers inside a wider
+//   band outweigh the inliers it adds, and the gate is the RANSAC threshold itself.
+// - Each step solves the weighted problem with rows scaled by sqrt(w). The design matrix, right-hand side
+//   and LAPACK workspace (struct WLS) keep their shape and are allocated and queried only once.
+//
+// Residuals: vertical distance for the line; for the conic the Sampson distance F/|grad F| with
+// F = p0*x^2 + p1*y^2 + p2*x*y + p3*x + p4*y - 1, a first-order approximation of the distance to the curve.
+//
+// Usage:
+//   ./math [outlier fraction] [threads]
+//   defaults: 0.3, 4 threads
+
+#define _POSIX_C_SOURCE 200809L // For rand_r
+
+#include <stdio.h>   // Standard I/O functions
+#include <stdlib.h>  // Standard library (for rand, srand, malloc, qsort, EXIT_SUCCESS)
+#include <string.h>  // For memcpy
+#include <math.h>    // Math functions (cos, sin, acos, sqrt, log, fabs)
+#include <time.h>    // Time functions (for seeding the random number generator)
+#include <pthread.h> // For parallel hypothesis scoring
+#include <lapacke.h> // LAPACK C interface for linear algebra
+
+#define MODEL_PMAX 5     // Largest number of coefficients
+#define RANSAC_BATCH 32  // Hypotheses per scoring round
+#define RANSAC_LO_ITER 20 // Refits on the inliers at most
+#define SCORE_BLOCK 256  // Points scored between two early-termination checks
+#define NTRUE 360        // Points on the true curve for the error report
+
+#define IRLS_HUBER 0
+#define IRLS_TUKEY 1
+
+// Fit model: design rows, minimal sample size and residuals
+struct MODEL
+{
+    const char *name;
+    int p;                                                        // Number of coefficients = minimal sample size
+    void (*row)(double x, double y, double a[], double *rhs);     // Design row and right-hand side of a point
+    double (*resid)(const double c[], double x, double y);        // Signed residual distance
+    long (*score)(const double c[], const double x[], const double y[], long n, double thr, long need);
+    double gate;                                                  // IRLS gate in units of the RANSAC threshold
+};
+
+// Weighted least-squares solver with preallocated storage
+struct WLS
+{
+    const struct MODEL *model;
+    long nmax;
+    double *A, *B, *work; // Column-major nmax x p design matrix, right-hand side, LAPACK workspace
+    lapack_int lwork;
+};
+
+// Helper function to print a matrix with a name
+static void printm(char *name, int m, int n, double *pA)
+{
+    int i, j;
+    printf("\n %s\n", name); // Print matrix name
+    for (i=0; i<m; i++)
+    {
+        for (j=0; j<n; j++)
+            printf(" %10.6lf", pA[i*n+j]); // Print each element
+        printf("\n");
+    }
+}
+
+// --- Line model ---
+
+static void line_row(double x, double y, double a[], double *rhs)
+{
+    a[0] = 1.0;
+    a[1] = x;
+    *rhs = y;
+}
+
+static double line_resid(const double c[], double x, double y)
+{
+    return y - c[0] - c[1]*x;
+}
+
+// Counts the points with |y - c0 - c1*x| <= thr; returns -1 as soon as need can no longer be reached
+static long line_score(const double c[], const double x[], const double y[], long n, double thr, long need)
+{
+    long cnt = 0, k0, k;
+    for (k0=0; k0<n; k0+=SCORE_BLOCK)
+    {
+        long k1 = (k0 + SCORE_BLOCK < n) ? k0 + SCORE_BLOCK : n;
+        for (k=k0; k<k1; k++)
+            cnt += fabs(y[k] - c[0] - c[1]*x[k]) <= thr;
+        if (cnt + (n - k1) < need)
+            return -1;
+    }
+    return cnt;
+}
+
+// --- Conic model ---
+
+static void conic_row(double x, double y, double a[], double *rhs)
+{
+    a[0] = x*x;
+    a[1] = y*y;
+    a[2] = x*y;
+    a[3] = x;
+    a[4] = y;
+    *rhs = 1.0;
+}
+
+// Sampson distance F/|grad F|
+static double conic_resid(const double c[], double x, double y)
+{
+    double F = c[0]*x*x + c[1]*y*y + c[2]*x*y + c[3]*x + c[4]*y - 1.0;
+    double gx = 2.0*c[0]*x + c[2]*y + c[3];
+    double gy = 2.0*c[1]*y + c[2]*x + c[4];
+    double g = sqrt(gx*gx + gy*gy);
+    return (g > 0.0) ? F/g : F;
+}
+
+// Counts the points with Sampson distance <= thr (F^2 <= thr^2*|grad F|^2, no division or square root)
+static long conic_score(const double c[], const double x[], const double y[], long n, double thr, long need)
+{
+    double t2 = thr*thr;
+    long cnt = 0, k0, k;
+    for (k0=0; k0<n; k0+=SCORE_BLOCK)
+    {
+        long k1 = (k0 + SCORE_BLOCK < n) ? k0 + SCORE_BLOCK : n;
+        for (k=k0; k<k1; k++)
+        {
+            double xk = x[k], yk = y[k];
+            double F = c[0]*xk*xk + c[1]*yk*yk + c[2]*xk*yk + c[3]*xk + c[4]*yk - 1.0;
+            double gx = 2.0*c[0]*xk + c[2]*yk + c[3];
+            double gy = 2.0*c[1]*yk + c[2]*xk + c[4];
+            cnt += F*F <= t2*(gx*gx + gy*gy);
+        }
+        if (cnt + (n - k1) < need)
+            return -1;
+    }
+    return cnt;
+}
+
+static const struct MODEL line_model = { "line", 2, line_row, line_resid, line_score, 2.0 };
+static const struct MODEL conic_model = { "conic", 5, conic_row, conic_resid, conic_score, 1.0 };
+
+// Exact fit through p points (Gaussian elimination with partial pivoting)
+// Returns 0, or -1 if the sample is degenerate
+static int fit_minimal(const struct MODEL *mo, const double x[], const double y[], const int idx[], double c[])
+{
+    int p = mo->p, i, j, k;
+    double M[MODEL_PMAX][MODEL_PMAX+1];
+    for (i=0; i<p; i++)
+        mo->row(x[idx[i]], y[idx[i]], M[i], &M[i][p]);
+    for (k=0; k<p; k++)
+    {
+        int piv = k;
+        for (i=k+1; i<p; i++)
+            if (fabs(M[i][k]) > fabs(M[piv][k]))
+                piv = i;
+        if (!(fabs(M[piv][k]) > 1e-12))
+            return -1;
+        if (piv != k)
+            for (j=k; j<=p; j++)
+            {
+                double t = M[k][j];
+                M[k][j] = M[piv][j];
+                M[piv][j] = t;
+            }
+        for (i=k+1; i<p; i++)
+        {
+            double f = M[i][k]/M[k][k];
+            for (j=k; j<=p; j++)
+                M[i][j] -= f*M[k][j];
+        }
+    }
+    for (i=p-1; i>=0; i--)
+    {
+        double t = M[i][p];
+        for (j=i+1; j<p; j++)
+            t -= M[i][j]*c[j];
+        c[i] = t/M[i][i];
+    }
+    return 0;
+}
+
+// Allocates the weighted least-squares storage for up to nmax points and queries the workspace once
+static int wls_init(struct WLS *ws, const struct MODEL *mo, long nmax)
+{
+    double wq;
+    ws->model = mo;
+    ws->nmax = nmax;
+    ws->A = malloc(sizeof(double)*nmax*mo->p);
+    ws->B = malloc(sizeof(double)*nmax);
+    ws->work = NULL;
+    if (!ws->A || !ws->B
+        || LAPACKE_dgels_work(LAPACK_COL_MAJOR, 'N', nmax, mo->p, 1, ws->A, nmax, ws->B, nmax, &wq, -1))
+        return -1;
+    ws->lwork = (lapack_int) wq;
+    ws->work = malloc(sizeof(double)*ws->lwork);
+    return ws->work ? 0 : -1;
+}
+
+static void wls_free(struct WLS *ws)
+{
+    free(ws->A);
+    free(ws->B);
+    free(ws->work);
+}
+
+// Least squares with weights w[k] >= 0 (NULL: all 1); points with w = 0 are left out
+// Returns 0, or -1 if fewer than p points have weight or the matrix is rank deficient
+static int wls_solve(struct WLS *ws, const double x[], const double y[], const double w[], long n, double c[])
+{
+    int p = ws->model->p, j;
+    double a[MODEL_PMAX], rhs;
+    long k, m = 0;
+    for (k=0; k<n; k++)
+    {
+        double sw = w ? sqrt(w[k]) : 1.0;
+        if (sw == 0.0)
+            continue;
+        ws->model->row(x[k], y[k], a, &rhs);
+        for (j=0; j<p; j++)
+            ws->A[j*ws->nmax+m] = sw*a[j];
+        ws->B[m++] = sw*rhs;
+    }
+    if (m < p || LAPACKE_dgels_work(LAPACK_COL_MAJOR, 'N', m, p, 1, ws->A, ws->nmax, ws->B, ws->nmax,
+                                    ws->work, ws->lwork))
+        return -1;
+    for (j=0; j<p; j++)
+        c[j] = ws->B[j];
+    return 0;
+}
+
+// --- RANSAC ---
+
+// Scoring state shared by the worker threads; they are started once per RANSAC call and score one batch per round
+struct SCOREJOB
+{
+    const struct MODEL *model;
+    const double *x, *y;
+    long n;
+    double thr;
+    double (*hyp)[MODEL_PMAX]; // Hypotheses of the round
+    int *valid;                // valid[h]: hypothesis h could be formed
+    long *count;               // Inlier count per hypothesis, -1 if abandoned
+    int nh, next;              // Number of hypotheses, next one to score
+    long need;                 // Count to reach in this round (best of the earlier rounds + 1)
+    long round;                // Round number, raised by the calling thread to start a round
+    int active, quit;          // Workers still scoring the round; set to stop the workers
+    pthread_mutex_t lock;      // Protects next, round, active and quit
+    pthread_cond_t start, done;
+};
+
+// Scores the hypotheses of the current round, one at a time
+static void score_batch(struct SCOREJOB *job)
+{
+    for (;;)
+    {
+        pthread_mutex_lock(&job->lock);
+        int h = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (h >= job->nh)
+            break;
+        job->count[h] = job->valid[h]
+                        ? job->model->score(job->hyp[h], job->x, job->y, job->n, job->thr, job->need) : -1;
+    }
+}
+
+static void *score_worker(void *arg)
+{
+    struct SCOREJOB *job = arg;
+    long round = 0;
+    pthread_mutex_lock(&job->lock);
+    for (;;)
+    {
+        while (job->round == round && !job->quit)
+            pthread_cond_wait(&job->start, &job->lock);
+        if (job->quit)
+            break;
+        round = job->round;
+        pthread_mutex_unlock(&job->lock);
+        score_batch(job);
+        pthread_mutex_lock(&job->lock);
+        if (--job->active == 0)
+            pthread_cond_signal(&job->done);
+    }
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+// RANSAC fit; thr: inlier distance, conf: confidence of having drawn an all-inlier sample
+// c: refitted coefficients, ws: least-squares storage for the refit, inl: inlier mask (0/1 weights) of c
+// Returns the number of inliers of c, or -1 if no hypothesis could be formed
+static long ransac(const struct MODEL *mo, struct WLS *ws, const double x[], const double y[], long n, double thr,
+                   double conf, long maxhyp, int nthreads, unsigned int seed, double c[], double inl[])
+{
+    int p = mo->p;
+    double hyp[RANSAC_BATCH][MODEL_PMAX], bestc[MODEL_PMAX], cn[MODEL_PMAX];
+    int valid[RANSAC_BATCH], idx[MODEL_PMAX];
+    long count[RANSAC_BATCH], tried = 0, need = maxhyp, best = -1, cnt, k;
+    pthread_t threads[nthreads];
+    int h, i, j, t, started, it, changed;
+
+    if (n < p)
+        return -1;
+    // Start the workers; the calling thread is worker 0
+    struct SCOREJOB job = { mo, x, y, n, thr, hyp, valid, count, RANSAC_BATCH, 0, 0, 0, 0, 0,
+                            PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+    for (started=1; started<nthreads; started++)
+        if (pthread_create(&threads[started], NULL, score_worker, &job))
+            break;
+    while (tried < need && tried < maxhyp)
+    {
+        // Draw a batch of minimal samples (distinct indices) and fit them
+        for (h=0; h<RANSAC_BATCH; h++)
+        {
+            for (i=0; i<p; i++)
+            {
+                do
+                {
+                    idx[i] = rand_r(&seed) % n;
+                    for (j=0; j<i && idx[j] != idx[i]; j++)
+                        ;
+                } while (j < i);
+            }
+            valid[h] = !fit_minimal(mo, x, y, idx, hyp[h]);
+        }
+        // Score the batch in parallel. need only depends on the earlier batches, so every hypothesis that
+        // can beat them is counted in full, whichever thread scores it
+        pthread_mutex_lock(&job.lock);
+        job.next = 0;
+        job.need = best + 1;
+        job.active = started - 1;
+        job.round++;
+        pthread_cond_broadcast(&job.start);
+        pthread_mutex_unlock(&job.lock);
+        score_batch(&job);
+        pthread_mutex_lock(&job.lock);
+        while (job.active > 0)
+            pthread_cond_wait(&job.done, &job.lock);
+        pthread_mutex_unlock(&job.lock);
+        // Best count in index order: ties go to the lowest hypothesis index, independent of the thread timing
+        for (h=0; h<RANSAC_BATCH; h++)
+            if (count[h] > best)
+            {
+                best = count[h];
+                memcpy(bestc, hyp[h], sizeof(double)*p);
+            }
+        tried += RANSAC_BATCH;
+        // Adaptive number of hypotheses for the best inlier ratio so far
+        if (best > 0)
+        {
+            double good = pow((double) best / n, p); // Probability that a sample is all inliers
+            need = (good >= 1.0) ? 0 : (good <= 0.0) ? maxhyp : (long) ceil(log(1.0 - conf) / log(1.0 - good));
+        }
+    }
+    pthread_mutex_lock(&job.lock);
+    job.quit = 1;
+    pthread_cond_broadcast(&job.start);
+    pthread_mutex_unlock(&job.lock);
+    for (t=1; t<started; t++)
+        pthread_join(threads[t], NULL);
+    pthread_cond_destroy(&job.start);
+    pthread_cond_destroy(&job.done);
+    pthread_mutex_destroy(&job.lock);
+    if (best < 0)
+        return -1;
+    // Local optimization: refit on the inliers and select them again until the inlier set no longer changes
+    memcpy(c, bestc, sizeof(double)*p);
+    cnt = 0;
+    for (k=0; k<n; k++)
+        cnt += (inl[k] = fabs(mo->resid(c, x[k], y[k])) <= thr);
+    for (it=0; it<RANSAC_LO_ITER; it++)
+    {
+        if (wls_solve(ws, x, y, inl, n, cn))
+            break;
+        memcpy(c, cn, sizeof(double)*p);
+        changed = 0;
+        cnt = 0;
+        for (k=0; k<n; k++)
+        {
+            double v = fabs(mo->resid(c, x[k], y[k])) <= thr;
+            changed |= (v != inl[k]);
+            cnt += (inl[k] = v);
+        }
+        if (!changed)
+            break;
+    }
+    printf(" RANSAC (%s): %ld hypotheses, %ld inliers of %ld; refit: %d steps, %ld inliers\n",
+           mo->name, tried, best, n, it + (it < RANSAC_LO_ITER), cnt);
+    return cnt;
+}
+
+// --- IRLS ---
+
+static int cmp_double(const void *a, const void *b)
+{
+    double da = *(const double *) a, db = *(const double *) b;
+    return (da > db) - (da < db);
+}
+
+// IRLS with Huber or Tukey weights, starting from c; at most maxit steps
+// gate: 0/1 prior weights that restrict the fit to a subset of the points (NULL: all points)
+// Returns the number of steps, or -1 on failure
+static int irls(const struct MODEL *mo, struct WLS *ws, const double x[], const double y[], const double gate[],
+                long n, int type, int maxit, double c[])
+{
+    int p = mo->p, it, j;
+    double *r = malloc(sizeof(double)*n), *ar = malloc(sizeof(double)*n), *w = malloc(sizeof(double)*n);
+    double cn[MODEL_PMAX];
+    long k;
+
+    if (!r || !ar || !w)
+    {
+        free(r);
+        free(ar);
+        free(w);
+        return -1;
+    }
+    for (it=1; it<=maxit; it++)
+    {
+        long ng = 0; // Points inside the gate
+        for (k=0; k<n; k++)
+        {
+            double a[MODEL_PMAX], rhs;
+            mo->row(x[k], y[k], a, &rhs);
+            r[k] = rhs;
+            for (j=0; j<p; j++)
+                r[k] -= a[j]*c[j];
+            if (!gate || gate[k] != 0.0)
+                ar[ng++] = fabs(r[k]);
+        }
+        if (ng == 0)
+        {
+            it = -1;
+            break;
+        }
+        // Robust scale (MAD) over the gated points only: points outside the gate would inflate it
+        qsort(ar, ng, sizeof(double), cmp_double);
+        double s = 1.4826*((ng % 2) ? ar[ng/2] : 0.5*(ar[ng/2-1] + ar[ng/2]));
+        if (!(s > 0.0))
+            break; // Exact fit of more than half of the points
+        for (k=0; k<n; k++)
+        {
+            double u = fabs(r[k])/s;
+            if (type == IRLS_HUBER)
+                w[k] = (u <= 1.345) ? 1.0 : 1.345/u;
+            else
+                w[k] = (u < 4.685) ? (1.0 - (u/4.685)*(u/4.685))*(1.0 - (u/4.685)*(u/4.685)) : 0.0;
+            if (gate)
+                w[k] *= gate[k];
+        }
+        if (wls_solve(ws, x, y, w, n, cn))
+        {
+            it = -1;
+            break;
+        }
+        double d = 0.0, m = 0.0;
+        for (j=0; j<p; j++)
+        {
+            if (fabs(cn[j] - c[j]) > d) d = fabs(cn[j] - c[j]);
+            if (fabs(cn[j]) > m) m = fabs(cn[j]);
+            c[j] = cn[j];
+        }
+        if (d <= 1e-10*m)
+            break;
+    }
+    free(r);
+    free(ar);
+    free(w);
+    return (it > maxit) ? maxit : it;
+}
+
+// --- Data ---
+
+// Parametric function for x-coordinate of ellipse
+static double fx(double t, double a, double b, double th, double x0)
+{
+    // a, b: ellipse axes; th: rotation; x0: center x; t: parameter
+    return a*cos(th)*cos(t) - b*sin(th)*sin(t) + x0;
+}
+
+// Parametric function for y-coordinate of ellipse
+static double fy(double t, double a, double b, double th, double y0)
+{
+    // a, b: ellipse axes; th: rotation; y0: center y; t: parameter
+    return a*sin(th)*sin(t) + b*cos(th)*cos(t) + y0;
+}
+
+// Coefficients of the exact ellipse fx/fy in the form p0*x^2 + p1*y^2 + p2*x*y + p3*x + p4*y = 1
+static void ellipse_conic(double a, double b, double th, double x0, double y0, double p[5])
+{
+    // (x - x0, y - y0) = M*(cos t, sin t), so the ellipse is d^T*Q*d = 1 with Q = (M*M^T)^-1
+    double m11 = a*cos(th), m12 = -b*sin(th), m21 = b*cos(th), m22 = a*sin(th);
+    double s11 = m11*m11 + m12*m12, s12 = m11*m21 + m12*m22, s22 = m21*m21 + m22*m22;
+    double det = s11*s22 - s12*s12;
+    double q11 = s22/det, q12 = -s12/det, q22 = s11/det;
+    double k = 1.0 - (q11*x0*x0 + 2.0*q12*x0*y0 + q22*y0*y0);
+    p[0] = q11/k;
+    p[1] = q22/k;
+    p[2] = 2.0*q12/k;
+    p[3] = -2.0*(q11*x0 + q12*y0)/k;
+    p[4] = -2.0*(q22*y0 + q12*x0)/k;
+}
+
+// Uniform random number in [0, 1]
+static double rnd(void)
+{
+    double d = rand();
+    return d / RAND_MAX;
+}
+
+// Prints the coefficients c and the largest distance of the true curve (points xt, yt) from the fit
+static void report(char *name, const struct MODEL *mo, const double c[], const double xt[], const double yt[])
+{
+    double d = 0.0;
+    int k;
+    for (k=0; k<NTRUE; k++)
+        if (!(fabs(mo->resid(c, xt[k], yt[k])) <= d)) // Also catches NaN
+            d = fabs(mo->resid(c, xt[k], yt[k]));
+    printm(name, 1, mo->p, (double *) c);
+    printf(" max distance of the true curve %.4lf\n", d);
+}
+
+// Runs all estimators on one dataset and prints the coefficients next to the true ones
+// xt, yt: NTRUE points on the true curve, to measure how far each fit is from it
+static int compare(const struct MODEL *mo, const double x[], const double y[], long n, double thr,
+                   int nthreads, const double ctrue[], const double xt[], const double yt[])
+{
+    struct WLS ws;
+    double c[MODEL_PMAX], c0[MODEL_PMAX], *inl = malloc(sizeof(double)*n);
+    int p = mo->p, it;
+    long k;
+
+    if (!inl || wls_init(&ws, mo, n))
+        return -1;
+    printf("\n=== %s, %ld points ===\n", mo->name, n);
+    printm("true", 1, p, (double *) ctrue);
+    if (!wls_solve(&ws, x, y, NULL, n, c))
+        report("dgels (all points)", mo, c, xt, yt);
+    if (ransac(mo, &ws, x, y, n, thr, 0.999, 100000, nthreads, 12345u, c0, inl) < 0)
+        return -1;
+    report("RANSAC + refit on inliers", mo, c0, xt, yt);
+    // Gate for IRLS: points within gate*thr of the RANSAC fit
+    for (k=0; k<n; k++)
+        inl[k] = fabs(mo->resid(c0, x[k], y[k])) <= mo->gate*thr;
+    memcpy(c, c0, sizeof(c));
+    if ((it = irls(mo, &ws, x, y, inl, n, IRLS_HUBER, 50, c)) >= 0)
+    {
+        report("IRLS Huber from RANSAC", mo, c, xt, yt);
+        printf(" %d steps\n", it);
+    }
+    memcpy(c, c0, sizeof(c));
+    if ((it = irls(mo, &ws, x, y, inl, n, IRLS_TUKEY, 50, c)) >= 0)
+    {
+        report("IRLS Tukey from RANSAC", mo, c, xt, yt);
+        printf(" %d steps\n", it);
+    }
+    wls_free(&ws);
+    free(inl);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    double frac = (argc > 1) ? atof(argv[1]) : 0.3;
+    int nthreads = (argc > 2) ? atoi(argv[2]) : 4;
+    long n = 2000, k;
+    double xt[NTRUE], yt[NTRUE]; // Points on the true curve
+
+    if (!(frac >= 0.0 && frac < 1.0) || nthreads < 1)
+    {
+        fprintf(stderr, "usage: %s [outlier fraction(0..1)] [threads(>=1)]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    double *x = malloc(sizeof(double)*n), *y = malloc(sizeof(double)*n);
+    if (!x || !y)
+        return EXIT_FAILURE;
+    srand(clock()); // Seed RNG
+    printf("Outlier fraction %.2lf, %d threads\n", frac, nthreads);
+
+    // --- 1. Line of lab-4-1-calc: noise in [-1, 1], outliers anywhere in [0,10] x [-20, 20] ---
+    double a0 = 0.5, a1 = 0.5, ltrue[2] = { a0, a1 };
+    for (k=0; k<NTRUE; k++)
+    {
+        xt[k] = 10.0*k/(NTRUE - 1);
+        yt[k] = a1*xt[k] + a0;
+    }
+    for (k=0; k<n; k++)
+    {
+        x[k] = 10.0*k/(n - 1);
+        y[k] = a1*x[k] + a0 + 2*(-0.5 + rnd());
+        if (rnd() < frac)
+            y[k] = 40*(-0.5 + rnd());
+    }
+    if (compare(&line_model, x, y, n, 1.0, nthreads, ltrue, xt, yt))
+        return EXIT_FAILURE;
+
+    // --- 2. Ellipse of lab-4-2-calc-lib: noise in [-0.25, 0.25], outliers anywhere in [-3,7] x [-5,5] ---
+    double a = 2.0, b = 1.5, th = acos(-1.0)/8.0, x0 = 2.0, y0 = 0.0, ctrue[5];
+    ellipse_conic(a, b, th, x0, y0, ctrue);
+    for (k=0; k<NTRUE; k++)
+    {
+        xt[k] = fx(2.0*acos(-1.0)*k/NTRUE, a, b, th, x0);
+        yt[k] = fy(2.0*acos(-1.0)*k/NTRUE, a, b, th, y0);
+    }
+    for (k=0; k<n; k++)
+    {
+        double t = 2.0*acos(-1.0)*k/n;
+        x[k] = fx(t, a, b, th, x0) + 0.5*(-0.5 + rnd());
+        y[k] = fy(t, a, b, th, y0) + 0.5*(-0.5 + rnd());
+        if (rnd() < frac)
+        {
+            x[k] = x0 + 10*(-0.5 + rnd());
+            y[k] = y0 + 10*(-0.5 + rnd());
+        }
+    }
+    if (compare(&conic_model, x, y, n, 0.25, nthreads, ctrue, xt, yt))
+        return EXIT_FAILURE;
+
+    free(x);
+    free(y);
+    return EXIT_SUCCESS;
+}
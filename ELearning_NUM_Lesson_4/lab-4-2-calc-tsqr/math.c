@@ -0,0 +1,497 @@
+// math.c - Tall-skinny QR (TSQR) conic fit across threads and from disk
+// General Overview:
+// lab-4-2-calc-lib solves the conic fit p0*x^2 + p1*y^2 + p2*x*y + p3*x + p4*y = 1 with one LAPACKE_dgels
+// call on the whole (n+1) x 5 design matrix: a single thread walks the full matrix. The normal equations
+// (lab-4-2-calc-gram) parallelize easily but square the condition number. TSQR keeps the stability of QR
+// and needs almost no communication:
+//
+// - The rows of the augmented matrix [A 1] are split into one contiguous range per thread.
+// - Each thread walks its range in blocks of TSQR_BLOCK rows. A block is stacked under the thread's 6x6
+//   triangular factor R and refactored with LAPACKE_dgeqrf_work, so R is always the R factor of all rows
+//   the thread has seen. Only the block itself is ever in memory.
+// - The per-thread factors are combined in a binary tree: in round k, thread i (i a multiple of 2^(k+1))
+//   stacks its R over the R of thread i + 2^k and refactors the 12x6 matrix. After log2(threads) rounds
+//   thread 0 holds the R factor of the whole matrix.
+// - The fit follows from R(0:4,0:4)*p = R(0:4,5) by back substitution; |R(5,5)| is the residual norm.
+//
+// Data sources:
+// - Arrays x[], y[] in memory.
+// - Out-of-core: a binary file of (x, y) double pairs. Each thread reads its own blocks with pread(), so
+//   the file is streamed once and never held in memory.
+//
+// Main steps in main():
+//   1. Generate N noisy points on the ellipse of lab-4-2-calc-lib, and on the same ellipse moved to
+//      (1000, -500) with little noise, where the design matrix is ill-conditioned.
+//   2. For both, compare full dgels (reference), the normal equations and TSQR with 1..threads threads.
+//   3. Write the second dataset to tsqr_points.bin and fit it again out-of-core.
+//
+// Usage:
+//   ./math [N] [threads]
+//   defaults: 2000000 points, 4 threads
+
+#define _POSIX_C_SOURCE 200809L // For clock_gettime and pread
+
+#include <stdio.h>   // Standard I/O functions
+#include <stdlib.h>  // Standard library (for rand, srand, malloc, EXIT_SUCCESS)
+#include <string.h>  // For memcpy, memset
+#include <math.h>    // Math functions (cos, sin, acos, sqrt)
+#include <time.h>    // Time functions (for seeding and timing)
+#include <fcntl.h>   // For open
+#include <unistd.h>  // For pread, close, unlink
+#include <pthread.h> // For the worker threads
+#include <lapacke.h> // LAPACK C interface for linear algebra
+
+#define TSQR_BLOCK 1024 // Rows per block
+
+// Source of the points: arrays, or a file of (x, y) double pairs if fd >= 0
+struct TSQRSRC
+{
+    const double *x, *y;
+    int fd;
+};
+
+// One TSQR run, shared by all workers
+struct TSQRJOB
+{
+    struct TSQRSRC src;
+    long N;               // Number of points
+    int nthreads;
+    double *R;            // nthreads 6x6 factors, column-major
+    int *done;            // done[i]: R of thread i is final (after its own tree rounds)
+    int err;              // First LAPACK or read error
+    pthread_mutex_t lock; // Protects done and err
+    pthread_cond_t cond;  // Signalled when a thread finishes
+};
+
+struct TSQRARG
+{
+    struct TSQRJOB *job;
+    int id;
+};
+
+// Helper function to print a matrix with a name
+static void printm(char *name, int m, int n, double *pA)
+{
+    int i, j;
+    printf("\n %s\n", name); // Print matrix name
+    for (i=0; i<m; i++)
+    {
+        for (j=0; j<n; j++)
+            printf(" %12.8lf", pA[i*n+j]); // Print each element
+        printf("\n");
+    }
+}
+
+// Parametric function for x-coordinate of ellipse
+static double fx(double t, double a, double b, double th, double x0)
+{
+    // a, b: ellipse axes; th: rotation; x0: center x; t: parameter
+    return a*cos(th)*cos(t) - b*sin(th)*sin(t) + x0;
+}
+
+// Parametric function for y-coordinate of ellipse
+static double fy(double t, double a, double b, double th, double y0)
+{
+    // a, b: ellipse axes; th: rotation; y0: center y; t: parameter
+    return a*sin(th)*sin(t) + b*cos(th)*cos(t) + y0;
+}
+
+// Writes the m rows [x^2 y^2 xy x y 1] below the first 6 rows of the column-major matrix B (leading dimension ld)
+static void conic_rows(double *B, int ld, const double x[], const double y[], int m)
+{
+    int k;
+    for (k=0; k<m; k++)
+    {
+        B[0*ld+6+k] = x[k]*x[k];
+        B[1*ld+6+k] = y[k]*y[k];
+        B[2*ld+6+k] = x[k]*y[k];
+        B[3*ld+6+k] = x[k];
+        B[4*ld+6+k] = y[k];
+        B[5*ld+6+k] = 1.0;
+    }
+}
+
+// QR of the (6+m) x 6 matrix B whose first 6 rows are the 6x6 factor R; the new R is written back to R
+static lapack_int stack_qr(double *R, double *B, int m, double *tau, double *work, lapack_int lwork)
+{
+    int ld = 6 + m, i, j;
+    lapack_int info;
+    for (j=0; j<6; j++)
+        memcpy(B + j*ld, R + j*6, sizeof(double)*6);
+    info = LAPACKE_dgeqrf_work(LAPACK_COL_MAJOR, ld, 6, B, ld, tau, work, lwork);
+    if (info)
+        return info;
+    for (j=0; j<6; j++)
+        for (i=0; i<6; i++)
+            R[j*6+i] = (i <= j) ? B[j*ld+i] : 0.0;
+    return 0;
+}
+
+static void tsqr_error(struct TSQRJOB *job, int err)
+{
+    pthread_mutex_lock(&job->lock);
+    if (!job->err)
+        job->err = err;
+    pthread_mutex_unlock(&job->lock);
+}
+
+// Worker: QR of its own row range, block by block, then its part of the reduction tree
+static void *tsqr_worker(void *arg)
+{
+    struct TSQRARG *ta = arg;
+    struct TSQRJOB *job = ta->job;
+    int id = ta->id, T = job->nthreads;
+    long k0 = job->N*id/T, k1 = job->N*(id + 1)/T, k;
+    double *R = job->R + id*36;
+    double *B = malloc(sizeof(double)*(6 + TSQR_BLOCK)*6);
+    double *xy = malloc(sizeof(double)*2*TSQR_BLOCK);
+    double xb[TSQR_BLOCK], yb[TSQR_BLOCK], tau[6], wq;
+    double *work = NULL;
+    lapack_int lwork = 0;
+    int stride, i;
+
+    memset(R, 0, sizeof(double)*36);
+    if (!B || !xy || LAPACKE_dgeqrf_work(LAPACK_COL_MAJOR, 6 + TSQR_BLOCK, 6, B, 6 + TSQR_BLOCK, tau, &wq, -1)
+        || !(work = malloc(sizeof(double)*(lwork = (lapack_int) wq))))
+        tsqr_error(job, -1);
+    else
+        for (k=k0; k<k1; k+=TSQR_BLOCK)
+        {
+            int m = (k1 - k < TSQR_BLOCK) ? k1 - k : TSQR_BLOCK;
+            const double *x = xb, *y = yb;
+            if (job->src.fd < 0)
+            {
+                x = job->src.x + k;
+                y = job->src.y + k;
+            }
+            else
+            {
+                size_t want = sizeof(double)*2*m;
+                if (pread(job->src.fd, xy, want, (off_t) (sizeof(double)*2*k)) != (ssize_t) want)
+                {
+                    tsqr_error(job, -2);
+                    break;
+                }
+                for (i=0; i<m; i++)
+                {
+                    xb[i] = xy[2*i];
+                    yb[i] = xy[2*i+1];
+                }
+            }
+            conic_rows(B, 6 + m, x, y, m);
+            lapack_int info = stack_qr(R, B, m, tau, work, lwork);
+            if (info)
+            {
+                tsqr_error(job, (int) info);
+                break;
+            }
+        }
+
+    // Reduction tree: merge the R of thread id + stride into this one while id is a multiple of 2*stride
+    for (stride=1; id % (2*stride) == 0 && id + stride < T; stride*=2)
+    {
+        pthread_mutex_lock(&job->lock);
+        while (!job->done[id + stride])
+            pthread_cond_wait(&job->cond, &job->lock);
+        pthread_mutex_unlock(&job->lock);
+        if (work)
+        {
+            // Partner factor into rows 6..11 of the 12x6 matrix
+            for (i=0; i<6; i++)
+                memcpy(B + i*12 + 6, job->R + (id + stride)*36 + i*6, sizeof(double)*6);
+            lapack_int info = stack_qr(R, B, 6, tau, work, lwork);
+            if (info)
+                tsqr_error(job, (int) info);
+        }
+    }
+    pthread_mutex_lock(&job->lock);
+    job->done[id] = 1;
+    pthread_cond_broadcast(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+    free(B);
+    free(xy);
+    free(work);
+    return NULL;
+}
+
+// Conic fit of N points with nthreads threads
+// p: conic coefficients [x^2, y^2, xy, x, y], res: residual norm (may be NULL)
+// Returns 0, -1 on allocation failure, -2 on a read error, -3 if R is singular, or a LAPACK info
+static int tsqr_fit(struct TSQRSRC src, long N, int nthreads, double p[5], double *res)
+{
+    struct TSQRJOB job;
+    struct TSQRARG *args;
+    pthread_t *threads;
+    int i, k, err, started;
+
+    if (N < 5 || nthreads < 1)
+        return -1;
+    job.src = src;
+    job.N = N;
+    job.nthreads = nthreads;
+    job.err = 0;
+    job.R = malloc(sizeof(double)*36*nthreads);
+    job.done = calloc(nthreads, sizeof(int));
+    args = malloc(sizeof(struct TSQRARG)*nthreads);
+    threads = malloc(sizeof(pthread_t)*nthreads);
+    if (!job.R || !job.done || !args || !threads)
+    {
+        free(job.R);
+        free(job.done);
+        free(args);
+        free(threads);
+        return -1;
+    }
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.cond, NULL);
+    // Thread 0 is the calling thread
+    for (i=0; i<nthreads; i++)
+    {
+        args[i].job = &job;
+        args[i].id = i;
+    }
+    for (started=1; started<nthreads; started++)
+        if (pthread_create(&threads[started], NULL, tsqr_worker, &args[started]))
+            break;
+    // Workers that could not be started run in this thread, highest id first, so no tree partner is awaited
+    // before it has run
+    for (i=nthreads-1; i>=started; i--)
+        tsqr_worker(&args[i]);
+    tsqr_worker(&args[0]);
+    for (i=1; i<started; i++)
+        pthread_join(threads[i], NULL);
+    pthread_cond_destroy(&job.cond);
+    pthread_mutex_destroy(&job.lock);
+
+    err = job.err;
+    if (!err)
+    {
+        // Back substitution R(0:4,0:4)*p = R(0:4,5)
+        double *R = job.R;
+        for (i=4; i>=0; i--)
+        {
+            double t = R[5*6+i];
+            if (!(fabs(R[i*6+i]) > 1e-15*fabs(R[0])))
+            {
+                err = -3;
+                break;
+            }
+            for (k=i+1; k<5; k++)
+                t -= R[k*6+i]*p[k];
+            p[i] = t / R[i*6+i];
+        }
+        if (res)
+            *res = fabs(R[5*6+5]);
+    }
+    free(job.R);
+    free(job.done);
+    free(args);
+    free(threads);
+    return err;
+}
+
+// Reference: LAPACKE_dgels on the full N x 5 matrix
+static int dgels_fit(const double x[], const double y[], long N, double p[5])
+{
+    double *A = malloc(sizeof(double)*N*5), *B = malloc(sizeof(double)*N), wq, *work;
+    long k;
+    int i;
+    if (!A || !B)
+    {
+        free(A);
+        free(B);
+        return -1;
+    }
+    for (k=0; k<N; k++)
+    {
+        A[0*N+k] = x[k]*x[k];
+        A[1*N+k] = y[k]*y[k];
+        A[2*N+k] = x[k]*y[k];
+        A[3*N+k] = x[k];
+        A[4*N+k] = y[k];
+        B[k] = 1.0;
+    }
+    LAPACKE_dgels_work(LAPACK_COL_MAJOR, 'N', N, 5, 1, A, N, B, N, &wq, -1);
+    work = malloc(sizeof(double)*(size_t) wq);
+    int err = !work || LAPACKE_dgels_work(LAPACK_COL_MAJOR, 'N', N, 5, 1, A, N, B, N, work, (lapack_int) wq);
+    for (i=0; i<5 && !err; i++)
+        p[i] = B[i];
+    free(work);
+    free(A);
+    free(B);
+    return err ? -1 : 0;
+}
+
+// Normal equations (A^T*A) p = A^T*1, solved by Cholesky
+static int normal_fit(const double x[], const double y[], long N, double p[5])
+{
+    double G[25] = { 0 }, r[5] = { 0 }, L[25], z[5];
+    long k;
+    int i, j, l;
+    for (k=0; k<N; k++)
+    {
+        double a[5] = { x[k]*x[k], y[k]*y[k], x[k]*y[k], x[k], y[k] };
+        for (i=0; i<5; i++)
+        {
+            for (j=i; j<5; j++)
+                G[i*5+j] += a[i]*a[j];
+            r[i] += a[i];
+        }
+    }
+    for (j=0; j<5; j++)
+    {
+        double d = G[j*5+j];
+        for (l=0; l<j; l++)
+            d -= L[j*5+l]*L[j*5+l];
+        if (!(d > 0.0))
+            return -1;
+        L[j*5+j] = sqrt(d);
+        for (i=j+1; i<5; i++)
+        {
+            double t = G[j*5+i];
+            for (l=0; l<j; l++)
+                t -= L[i*5+l]*L[j*5+l];
+            L[i*5+j] = t / L[j*5+j];
+        }
+    }
+    for (i=0; i<5; i++)
+    {
+        double t = r[i];
+        for (l=0; l<i; l++)
+            t -= L[i*5+l]*z[l];
+        z[i] = t / L[i*5+i];
+    }
+    for (i=4; i>=0; i--)
+    {
+        double t = z[i];
+        for (l=i+1; l<5; l++)
+            t -= L[l*5+i]*p[l];
+        p[i] = t / L[i*5+i];
+    }
+    return 0;
+}
+
+// Largest relative difference of the coefficients
+static double reldiff(const double p[5], const double q[5])
+{
+    double d = 0.0, s = 0.0;
+    int i;
+    for (i=0; i<5; i++)
+    {
+        if (fabs(p[i] - q[i]) > d) d = fabs(p[i] - q[i]);
+        if (fabs(q[i]) > s) s = fabs(q[i]);
+    }
+    return d / s;
+}
+
+// Monotonic wall clock in seconds
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+    // --- 1. Set ellipse parameters ---
+    double a  = 2.0; // Major axis
+    double b  = 1.5; // Minor axis
+    double th = acos(-1.0)/8.0; // Rotation angle (pi/8)
+    long N = (argc > 1) ? atol(argv[1]) : 2000000;
+    int maxthreads = (argc > 2) ? atoi(argv[2]) : 4;
+    double cx[2] = { 2.0, 1000.0 }, cy[2] = { 0.0, -500.0 }, noise[2] = { 0.5, 0.01 };
+    double pref[5], p[5], res, t0;
+    long k;
+    int c, t;
+
+    if (N < 5 || maxthreads < 1)
+    {
+        fprintf(stderr, "usage: %s [N(>=5)] [threads(>=1)]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    double *x = malloc(sizeof(double)*N), *y = malloc(sizeof(double)*N);
+    if (!x || !y)
+        return EXIT_FAILURE;
+    srand(clock()); // Seed RNG
+
+    for (c=0; c<2; c++)
+    {
+        // Noisy ellipse points, noise in [-noise/2, noise/2]
+        for (k=0; k<N; k++)
+        {
+            double tp = 2.0*acos(-1.0)*k/N;
+            x[k] = fx(tp, a, b, th, cx[c]) + noise[c]*(-0.5 + (double) rand()/RAND_MAX);
+            y[k] = fy(tp, a, b, th, cy[c]) + noise[c]*(-0.5 + (double) rand()/RAND_MAX);
+        }
+        printf("\n=== Ellipse centered at (%.0lf, %.0lf), %ld points ===\n", cx[c], cy[c], N);
+
+        // --- 2. Reference, normal equations and TSQR ---
+        t0 = now_s();
+        if (dgels_fit(x, y, N, pref))
+        {
+            fprintf(stderr, "dgels failed\n");
+            return EXIT_FAILURE;
+        }
+        printf(" dgels (full matrix):    %.3lf s\n", now_s() - t0);
+        printm("p (dgels)", 1, 5, pref);
+        t0 = now_s();
+        if (normal_fit(x, y, N, p))
+            printf(" normal equations:       %.3lf s, Cholesky failed (A^T*A not positive definite)\n", now_s() - t0);
+        else
+            printf(" normal equations:       %.3lf s, relative difference to dgels %.3e\n", now_s() - t0, reldiff(p, pref));
+        struct TSQRSRC mem = { x, y, -1 };
+        for (t=1; t<=maxthreads; t*=2)
+        {
+            t0 = now_s();
+            int err = tsqr_fit(mem, N, t, p, &res);
+            if (err)
+            {
+                fprintf(stderr, "TSQR failed (%d)\n", err);
+                return EXIT_FAILURE;
+            }
+            printf(" TSQR %2d threads:        %.3lf s, relative difference to dgels %.3e, residual norm %.6lf\n",
+                   t, now_s() - t0, reldiff(p, pref), res);
+        }
+    }
+
+    // --- 3. Out-of-core: the second dataset from a file ---
+    FILE *fp = fopen("tsqr_points.bin", "wb");
+    if (!fp)
+    {
+        perror("Could not open tsqr_points.bin for writing");
+        return EXIT_FAILURE;
+    }
+    for (k=0; k<N; k++)
+    {
+        double xy[2] = { x[k], y[k] };
+        fwrite(xy, sizeof(double), 2, fp);
+    }
+    if (fclose(fp))
+    {
+        perror("Could not write tsqr_points.bin");
+        return EXIT_FAILURE;
+    }
+    free(x);
+    free(y);
+    struct TSQRSRC file = { NULL, NULL, open("tsqr_points.bin", O_RDONLY) };
+    if (file.fd < 0)
+    {
+        perror("Could not open tsqr_points.bin");
+        return EXIT_FAILURE;
+    }
+    t0 = now_s();
+    int err = tsqr_fit(file, N, maxthreads, p, &res);
+    close(file.fd);
+    unlink("tsqr_points.bin");
+    if (err)
+    {
+        fprintf(stderr, "TSQR from file failed (%d)\n", err);
+        return EXIT_FAILURE;
+    }
+    printf("\n TSQR from tsqr_points.bin, %d threads: %.3lf s, relative difference to dgels %.3e\n",
+           maxthreads, now_s() - t0, reldiff(p, pref));
+    printm("p (TSQR, out-of-core)", 1, 5, p);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,140 @@
+/*
+ * CONIC ANALYSIS
+ * ==============
+ * Closed-form classification and parameters of a conic section (see conic.h).
+ *
+ * MATHEMATICAL BACKGROUND:
+ * For a[0]*x² + a[1]*xy + a[2]*y² + a[3]*x + a[4]*y + a[5] = 0 let
+ *   Q = [a0 a1/2; a1/2 a2]          (quadratic part)
+ *   M = [a0 a1/2 a3/2; a1/2 a2 a4/2; a3/2 a4/2 a5]
+ * - det(M) = 0: degenerate (lines or a point)
+ * - 4*a0*a2 - a1² = 4*det(Q) > 0: ellipse (or no real point), < 0: hyperbola, = 0: parabola
+ * For ellipse and hyperbola the center solves grad F = 0, and with the conic value f at the
+ * center the curve is dᵀQd = -f around it. The eigenvalues l1 <= l2 of Q and the angle
+ * 0.5*atan2(a1, a0 - a2) of the eigenvector of l2 then give the semi-axes sqrt(|f/l|) and
+ * the rotation. For a parabola the same angle gives the axis, and rotating the linear part
+ * onto it leaves l*u² + d*u + e*v + a5 = 0, whose vertex and focal length follow directly.
+ */
+
+#include <math.h>               // Mathematical functions (sqrt, atan2, cos, sin, acos)
+
+#include "conic.h"
+
+#define CONIC_EPS 1e-12         // Relative tolerance for det(Q) = 0 and det(M) = 0
+
+// Value of p[0]*x² + p[1]*y² + p[2]*xy + p[3]*x + p[4]*y - 1, zero on the curve
+double conic_value(const double p[5], double x, double y)
+{
+	return p[0]*x*x + p[1]*y*y + p[2]*x*y + p[3]*x + p[4]*y - 1.0;
+}
+
+// p-form of fit.cpp: the general form with a = [p0, p2, p1, p3, p4, -1]
+enum CONIC_TYPE conic_analyze(const double p[5], struct CONIC *c)
+{
+	double a[6] = {p[0], p[2], p[1], p[3], p[4], -1.0};
+	return conic_analyze_general(a, c);
+}
+
+enum CONIC_TYPE conic_analyze_general(const double a[6], struct CONIC *c)
+{
+	double pi = acos(-1.0);
+	double A = a[0], B = a[1], C = a[2], D = a[3], E = a[4], F = a[5];
+	int i;
+
+	c->type = CONIC_DEGENERATE;
+	c->xc = c->yc = c->A = c->B = c->phi = 0.0;
+
+	// STEP 1: Scale of the coefficients for the tolerances
+	double sq = fabs(A) > fabs(B) ? fabs(A) : fabs(B);
+	if (fabs(C) > sq)
+		sq = fabs(C);
+	double sm = sq;
+	for (i=3; i<6; i++)
+		if (fabs(a[i]) > sm)
+			sm = fabs(a[i]);
+	if (sq == 0.0)
+		return c->type;        // No quadratic part: a line at most
+
+	// STEP 2: Degenerate if det(M) = 0
+	double detM = A*(C*F - 0.25*E*E) - 0.5*B*(0.5*B*F - 0.25*D*E) + 0.5*D*(0.25*B*E - 0.5*C*D);
+	if (fabs(detM) <= CONIC_EPS*sm*sm*sm)
+		return c->type;
+
+	double det = 4.0*A*C - B*B;
+	double psi;
+	if (fabs(det) <= CONIC_EPS*sq*sq)
+	{
+		// STEP 3: Parabola. With l = A + C > 0 and u along psi: l*u² + d*u + e*v + F = 0
+		if (A + C < 0.0)
+		{
+			A = -A; B = -B; C = -C; D = -D; E = -E; F = -F;
+		}
+		double l = A + C;
+		psi = 0.5*atan2(B, A - C);                      // Eigenvector of l
+		double d = D*cos(psi) + E*sin(psi);
+		double e = -D*sin(psi) + E*cos(psi);
+		double u0 = -d/(2.0*l);                         // Vertex, where v is extremal
+		double v0 = (0.25*d*d/l - F)/e;
+		c->type = CONIC_PARABOLA;
+		c->xc = u0*cos(psi) - v0*sin(psi);
+		c->yc = u0*sin(psi) + v0*cos(psi);
+		c->A = 0.25*fabs(e)/l;                          // v - v0 = -(l/e)*(u - u0)²
+		c->phi = psi + ((e < 0.0) ? 0.5*pi : -0.5*pi);
+		if (c->phi > pi)
+			c->phi -= 2.0*pi;
+		return c->type;
+	}
+
+	// STEP 4: Center and conic value there; the sign of a is chosen so that f < 0
+	double xc = (B*E - 2.0*C*D)/det;
+	double yc = (B*D - 2.0*A*E)/det;
+	double f = F + 0.5*(D*xc + E*yc);
+	if (f > 0.0)
+	{
+		A = -A; B = -B; C = -C; f = -f;
+	}
+	double mean = 0.5*(A + C), dev = 0.5*sqrt((A - C)*(A - C) + B*B);
+	double l1 = mean - dev, l2 = mean + dev;           // Eigenvalues of Q, l1 <= l2
+	psi = 0.5*atan2(B, A - C);                          // Eigenvector of l2
+	c->xc = xc;
+	c->yc = yc;
+	if (det > 0.0)
+	{
+		// STEP 5: Ellipse, dᵀQd = -f > 0 needs Q positive definite; the A axis is along l1
+		if (!(l1 > 0.0))
+			return c->type;    // No real point
+		c->type = CONIC_ELLIPSE;
+		c->A = sqrt(-f/l1);
+		c->B = sqrt(-f/l2);
+		c->phi = psi + 0.5*pi;
+	}
+	else
+	{
+		// STEP 6: Hyperbola, the transverse axis is along the positive eigenvalue l2
+		c->type = CONIC_HYPERBOLA;
+		c->A = sqrt(-f/l2);
+		c->B = sqrt(f/l1);
+		c->phi = psi;
+	}
+	if (c->phi > 0.5*pi)
+		c->phi -= pi;
+	return c->type;
+}
+
+int conic_points(const struct CONIC *c, int k, double x[], double y[])
+{
+	if (c->type != CONIC_ELLIPSE || k < 2)
+		return 0;
+	double cp = cos(c->phi), sp = sin(c->phi);
+	int i;
+	for (i=0; i<k-1; i++)
+	{
+		double t = 2.0*acos(-1.0)*i/(k-1);
+		double ct = cos(t), st = sin(t);
+		x[i] = c->xc + c->A*cp*ct - c->B*sp*st;
+		y[i] = c->yc + c->A*sp*ct + c->B*cp*st;
+	}
+	x[k-1] = x[0];
+	y[k-1] = y[0];
+	return k;
+}
@@ -0,0 +1,48 @@
+/*
+ * CONIC ANALYSIS
+ * ==============
+ * Classifies a conic section and computes its geometric parameters in closed form:
+ * center, semi-axes and rotation of an ellipse or hyperbola, vertex, focal length and
+ * axis of a parabola. A fitted ellipse can then be drawn from k points in O(k) instead of
+ * searching the plane for points with F(x,y) = 0.
+ *
+ * Two forms of the conic are accepted:
+ * - p[0]*x² + p[1]*y² + p[2]*xy + p[3]*x + p[4]*y = 1 (the least squares fit of fit.cpp)
+ * - a[0]*x² + a[1]*xy + a[2]*y² + a[3]*x + a[4]*y + a[5] = 0 (general form)
+ */
+
+#ifndef CONIC_H
+#define CONIC_H
+
+// Kind of conic section
+enum CONIC_TYPE
+{
+	CONIC_ELLIPSE,             // Real ellipse (circle included)
+	CONIC_HYPERBOLA,           // Hyperbola
+	CONIC_PARABOLA,            // Parabola
+	CONIC_DEGENERATE           // Line pair, single line, point or no real point
+};
+
+// Conic section in geometric form
+struct CONIC
+{
+	enum CONIC_TYPE type;
+	double xc, yc;             // Center (parabola: vertex)
+	double A, B;               // Ellipse: semi-axes, A >= B; hyperbola: transverse and conjugate
+	                           // semi-axis; parabola: A = focal length, B = 0
+	double phi;                // Angle of the A axis to the x axis, in (-π/2, π/2];
+	                           // parabola: direction it opens to, in (-π, π]
+};
+
+// Value of p[0]*x² + p[1]*y² + p[2]*xy + p[3]*x + p[4]*y - 1, zero on the curve
+double conic_value(const double p[5], double x, double y);
+
+// Classifies the conic and fills in c; returns c->type
+enum CONIC_TYPE conic_analyze(const double p[5], struct CONIC *c);
+enum CONIC_TYPE conic_analyze_general(const double a[6], struct CONIC *c);
+
+// k points of an ellipse at equal parameter steps, the last one equal to the first (closed curve)
+// Returns: k, or 0 if c is not an ellipse or k < 2
+int conic_points(const struct CONIC *c, int k, double x[], double y[]);
+
+#endif
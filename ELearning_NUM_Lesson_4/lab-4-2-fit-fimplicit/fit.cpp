@@ -1,29 +1,34 @@
 /*
- * IMPROVED ELLIPSE FITTING DEMONSTRATION PROGRAM WITH CONVEX HULL
- * =============================================================
+ * IMPROVED ELLIPSE FITTING DEMONSTRATION PROGRAM WITH MARCHING SQUARES
+ * ===================================================================
  * 
  * GENERAL OVERVIEW:
  * This program demonstrates IMPROVED curve fitting using the least squares method to fit an ellipse
  * to noisy data points. This version addresses some limitations of the basic "fit-fail" version
- * by implementing a convex hull algorithm for better curve visualization.
+ * by extracting the fitted implicit curve with marching squares for better curve visualization.
  * 
  * KEY IMPROVEMENTS OVER "fit-fail" VERSION:
- * 1. CONVEX HULL EXTRACTION: Uses Jarvis march (gift wrapping) algorithm to find the convex hull
- *    of the fitted curve points, providing a cleaner, more organized curve representation
- * 2. BETTER VISUALIZATION: The convex hull creates a proper closed curve instead of scattered points
- * 3. ROBUSTNESS: Less sensitive to grid artifacts and missing curve segments
- * 4. GEOMETRIC INSIGHT: Shows the outer boundary of the fitted conic section
+ * 1. CURVE EXTRACTION: Marching squares on an adaptive quadtree computes the exact crossings of
+ *    the fitted curve with grid edges, refining only cells the curve can pass through
+ * 2. BETTER VISUALIZATION: The crossings are joined into ordered polylines instead of scattered points
+ * 3. ROBUSTNESS: No tolerance band, so no grid artifacts or missing curve segments; hyperbolas
+ *    come out as separate branches instead of being wrapped by a hull
+ * 4. GEOMETRIC INSIGHT: Shows exactly which conic section the fit produced
  * 
  * PROGRAM TASKS:
  * 1. GENERATES SYNTHETIC DATA: Creates a parametric ellipse with known parameters
  * 2. ADDS NOISE: Simulates real-world measurement errors by adding random noise
  * 3. PERFORMS CURVE FITTING: Uses LAPACK's DGELS to solve the least squares problem
- * 4. EXTRACTS CURVE POINTS: Grid-based search for points on the fitted implicit curve
- * 5. COMPUTES CONVEX HULL: Applies Jarvis march algorithm to organize curve points
- * 6. VISUALIZES RESULTS: Uses FLTK to display:
+ * 4. EXTRACTS CURVE POINTS: An ellipse is drawn from its center, semi-axes and angle (conic.cpp);
+ *    other conics are traced by marching squares on an adaptive quadtree, in parallel over grid rows
+ * 5. ORDERS THE CURVE: Joins the crossings into polylines
+ * 6. DIRECT ELLIPSE FIT: Fits an ellipse-constrained conic (Fitzgibbon) and evaluates it from its
+ *    center, semi-axes and angle, without any grid search
+ * 7. VISUALIZES RESULTS: Uses FLTK to display:
  *    - Original ellipse (red line)
  *    - Noisy data points (blue circles) 
- *    - Fitted curve's convex hull (cyan line with circles)
+ *    - Fitted curve (cyan polylines)
+ *    - Direct ellipse fit (green line)
  * 
  * MATHEMATICAL BACKGROUND:
  * An ellipse can be represented by the implicit equation:
@@ -32,11 +37,14 @@
  * For fitting, we normalize by setting F = -1, giving:
  * Ax² + By² + Cxy + Dx + Ey = 1
  * 
- * The convex hull provides the outer boundary of all points satisfying this equation.
+ * This fit has no constraint: for noisy or partial data it may return a hyperbola or parabola,
+ * and only the extracted curve shows what it got. The direct ellipse
+ * fit adds the constraint 4AC - B² = 1 (for Ax² + Bxy + Cy² + ...), which only ellipses satisfy.
  * 
  * DEPENDENCIES:
  * - FLTK: For GUI and graphics rendering
  * - LAPACKE: For numerical linear algebra operations
+ * - conic.cpp/conic.h: Classification and closed-form parameters of conics
  * - Standard C math library: For trigonometric functions
  */
 
@@ -52,22 +60,33 @@
 #include <math.h>               // Mathematical functions (cos, sin, acos)
 #include <time.h>               // Time functions for random seed
 
+// C++ standard library
+#include <vector>               // Segment lists of the marching squares
+#include <unordered_map>        // Joining segments at shared grid edges
+#include <thread>               // Worker threads over grid rows
+#include <atomic>               // Shared row counter of the workers
+
 // LAPACK linear algebra library
 #include <lapacke.h>            // C interface to LAPACK for solving linear systems
 
+// Conic analysis of this lab (conic.cpp)
+#include "conic.h"              // Type, center, semi-axes and angle of a conic in closed form
+
 // Maximum number of data points that can be stored in graph arrays
 #define	GRAPH_MAX		1000
 
 /*
  * GRAPH STRUCTURE
  * ==============
- * This structure holds three sets of 2D coordinate data for visualization:
+ * This structure holds four sets of 2D coordinate data for visualization:
  * - Set 1 (x1[], y1[]): Original theoretical ellipse points (red line)
  * - Set 2 (x2[], y2[]): Noisy measured data points (blue circles)
- * - Set 3 (x3[], y3[]): Convex hull of fitted curve points (cyan line with circles)
+ * - Set 3 (x3[], y3[]): Ordered polylines of the fitted curve (cyan lines)
+ * - Set 4 (x4[], y4[]): Direct ellipse fit (green line)
  * 
- * NOTE: In this improved version, Set 3 represents the CONVEX HULL of the fitted
- * curve points, unlike the "fit-fail" version which shows raw scattered points.
+ * NOTE: In this improved version, Set 3 holds ORDERED POLYLINES of the fitted curve,
+ * one after the other and separated by a NAN entry, unlike the "fit-fail" version
+ * which shows raw scattered points.
  */
 struct GRAPH
 {
@@ -77,9 +96,12 @@ struct GRAPH
 	double x2[GRAPH_MAX+1];    // X coordinates for noisy data points
 	double y2[GRAPH_MAX+1];    // Y coordinates for noisy data points
 	int n2;                    // Number of noisy data points
-	double x3[GRAPH_MAX+1];    // X coordinates for convex hull of fitted curve
-	double y3[GRAPH_MAX+1];    // Y coordinates for convex hull of fitted curve
-	int n3;                    // Number of points in convex hull
+	double x3[GRAPH_MAX+1];    // X coordinates for fitted curve polylines
+	double y3[GRAPH_MAX+1];    // Y coordinates for fitted curve polylines
+	int n3;                    // Number of entries in the polylines, separators included
+	double x4[GRAPH_MAX+1];    // X coordinates for direct ellipse fit
+	double y4[GRAPH_MAX+1];    // Y coordinates for direct ellipse fit
+	int n4;                    // Number of points in direct ellipse fit
 };
 
 // Global instance of the graph data structure
@@ -92,7 +114,7 @@ static struct GRAPH Graph;
  * the ellipse fitting results. It handles all the graphics rendering including
  * coordinate system setup, axis drawing, and data visualization.
  * 
- * IMPROVEMENT OVER "fit-fail": This version displays a clean convex hull curve
+ * IMPROVEMENT OVER "fit-fail": This version displays the fitted curve as ordered polylines
  * instead of scattered, potentially disconnected curve points.
  */
 class GRAPHBOX : public Fl_Box
@@ -144,35 +166,36 @@ class GRAPHBOX : public Fl_Box
 			fl_end_line();
 		}
 
-		// STEP 4: Draw convex hull of fitted curve in CYAN with point markers
-		// IMPROVEMENT: Instead of scattered points, this shows a clean closed curve
+		// STEP 4: Draw polylines of fitted curve in CYAN
+		// IMPROVEMENT: Instead of scattered points, this shows the ordered curve
 		fl_color(fl_rgb_color(0, 255, 255));  // Set color to cyan
 
-		// Calculate screen coordinates for first point of convex hull
-		xk0 = x() + 100*Graph.x3[0];
-		yk0 = y() + h()/2 - 100*Graph.y3[0];
-
-		// Draw convex hull as connected line segments with point markers
+		// Draw each pair of consecutive points; a NAN entry ends one polyline
 		for (n = 1; n < Graph.n3; n++)
 		{
-			// Calculate screen coordinates for current point
+			if (isnan(Graph.x3[n-1]) || isnan(Graph.x3[n]))
+				continue;
+
+			// Calculate screen coordinates of both points
+			xk0 = x() + 100*Graph.x3[n-1];
+			yk0 = y() + h()/2 - 100*Graph.y3[n-1];
 			int xk1 = x() + 100*Graph.x3[n];
 			int yk1 = y() + h()/2 - 100*Graph.y3[n];
 
 			// Draw line segment
 			fl_line(xk0, yk0, xk1, yk1);
+		}
 
-			// Draw circle marker at current point
-			fl_begin_line();
-			fl_circle(xk1, yk1, 5);
-			fl_end_line();
+		// STEP 5: Draw direct ellipse fit in GREEN
+		fl_color(fl_rgb_color(0, 255, 0));    // Set color to green
 
-			// Update coordinates for next iteration
-			xk0 = xk1;
-			yk0 = yk1;
+		for (n = 1; n < Graph.n4; n++)
+		{
+			fl_line(x() + 100*Graph.x4[n-1], y() + h()/2 - 100*Graph.y4[n-1],
+			        x() + 100*Graph.x4[n],   y() + h()/2 - 100*Graph.y4[n]);
 		}
 
-		// STEP 5: Draw coordinate axes and labels in BLACK
+		// STEP 6: Draw coordinate axes and labels in BLACK
 		fl_color(fl_rgb_color(0, 0, 0));      // Set color to black
 		fl_font(FL_COURIER, 16);              // Set font for axis labels
 		char str[256];                        // Buffer for formatted text
@@ -208,83 +231,243 @@ class GRAPHBOX : public Fl_Box
 };
 
 /*
- * CONVEX HULL COMPUTATIONAL GEOMETRY FUNCTIONS
- * ===========================================
- * These functions implement the Jarvis March (Gift Wrapping) algorithm to compute
- * the convex hull of a set of 2D points. This is a KEY IMPROVEMENT over the "fit-fail"
- * version, which simply displayed scattered curve points without organization.
- * 
- * CONVEX HULL BENEFITS:
- * 1. Creates a clean, connected curve representation
- * 2. Eliminates interior points and grid artifacts
- * 3. Provides the outer boundary of the fitted conic section
- * 4. More robust to noise and missing curve segments
+ * IMPLICIT CURVE EXTRACTION: MARCHING SQUARES ON AN ADAPTIVE QUADTREE
+ * ==================================================================
+ * These functions find the curve F(X,Y) = p[0]*X² + p[1]*Y² + p[2]*X*Y + p[3]*X + p[4]*Y - 1 = 0
+ * in a square window and return it as ordered polylines. They replace a scan of every grid point
+ * for |F| < 0.01, which returns a band of unordered points whose width depends on the gradient,
+ * and needs a convex hull to be put in order (a hull that also wraps both branches of a hyperbola).
  * 
- * ALGORITHM: Jarvis March (Gift Wrapping)
- * - Time Complexity: O(nh) where n = points, h = hull vertices
- * - Space Complexity: O(1) additional space
- * - Advantage: Simple implementation, good for small hull sizes
+ * ALGORITHM:
+ * 1. QUADTREE: The window is split into MS_COARSE x MS_COARSE cells. A cell is divided into four
+ *    only while the curve can pass through it. F is quadratic with constant Hessian H, so for
+ *    |d| <= r (r = half the cell diagonal, c = cell center)
+ *        |F(c+d) - F(c)| <= |grad F(c)|*r + ||H||*r²/2,
+ *    and a cell with |F(c)| above this bound is dropped after one evaluation
+ * 2. MARCHING SQUARES: The cells left after MS_DEPTH divisions all lie on one fine lattice.
+ *    Every lattice edge with a sign change of F gets its crossing: along an edge F is a quadratic
+ *    in the edge parameter, so the crossing is exact. The two (or, at a saddle, four) crossings of
+ *    a cell are connected by segments; a saddle is decided by the sign of F at the cell center
+ * 3. PARALLEL ROWS: Worker threads take coarse rows from a shared counter; each row collects its
+ *    own segments, so the result does not depend on the number of threads
+ * 4. POLYLINES: Neighbouring cells share the crossing of their common lattice edge. Segments are
+ *    joined through these edges, open polylines (leaving the window) from a free end first,
+ *    then the closed loops
  */
 
-// Helper function: Calculate cross product to determine point orientation
-// Returns: > 0 if counterclockwise, < 0 if clockwise, = 0 if collinear
-static double rotation(double ax, double ay, double bx, double by, double cx, double cy)
+#define MS_COARSE 20    // Coarse cells per side of the window
+#define MS_DEPTH  3     // Quadtree levels below the coarse cells (fine cell = 1/160 of the window)
+
+// One marching squares segment between the crossings on two lattice edges
+struct MSSEG
+{
+	long long e[2];            // Lattice edge keys of both ends
+	double x[2], y[2];         // Crossings
+};
+
+// Extraction job shared by the worker threads
+struct MSJOB
 {
-	// Cross product: (B-A) × (C-B) = (by-ay)*(cx-bx) - (bx-ax)*(cy-by)
-	return (by - ay) * (cx - bx) - (bx - ax) * (cy - by);
+	const double *p;           // Conic coefficients
+	double x0, y0, h;          // Window corner and fine cell size
+	int N;                     // Fine cells per side
+	double Hn;                 // Spectral norm of the Hessian of F
+	std::atomic<int> row;      // Next coarse row
+	std::vector<MSSEG> seg[MS_COARSE]; // Segments per coarse row
+};
+
+// Value of F at lattice vertex (i,j)
+static double ms_value(const MSJOB *job, int i, int j)
+{
+	return conic_value(job->p, job->x0 + i*job->h, job->y0 + j*job->h);
 }
 
-// Main convex hull function using Jarvis March algorithm
-// Input: Sx[], Sy[] - arrays of input points, n - number of input points
-// Output: Hx[], Hy[] - arrays of hull vertices
-// Returns: number of vertices in convex hull
-static int convex(double Sx[], double Sy[], double Hx[], double Hy[], int n)
+// Exact crossing on the lattice edge from vertex (i,j) in direction dir (0: +X, 1: +Y)
+// F has opposite signs at both ends, fa at (i,j)
+static void ms_crossing(const MSJOB *job, int i, int j, int dir, double fa, double *X, double *Y)
 {
-	// STEP 1: Validate input - need at least 3 points for a meaningful hull
-	if (n < 3)		// set >= three points ?
-		return 0;
-	
-	// STEP 2: Find leftmost point (guaranteed to be on convex hull)
-	int l = 0;      // Index of leftmost point
-	int i;
-	for (i=1; i<n; i++)
-		if (Sx[i] < Sx[l])    // Compare X coordinates
-			l = i;
-	
-	// STEP 3: Jarvis March algorithm - "wrap" around the point set
-	int k = 0;      // Hull vertex counter
-	int p = l;      // Current hull point (start with leftmost)
-	
-	while (true)
+	const double *p = job->p;
+	double ax = job->x0 + i*job->h, ay = job->y0 + j*job->h;
+	double dx = dir ? 0.0 : job->h, dy = dir ? job->h : 0.0;
+
+	// F(a + t*d) = al*t² + be*t + fa, with the one root in [0, 1]
+	double al = p[0]*dx*dx + p[1]*dy*dy + p[2]*dx*dy;
+	double be = (2.0*p[0]*ax + p[2]*ay + p[3])*dx + (2.0*p[1]*ay + p[2]*ax + p[4])*dy;
+	double t;
+	double disc = be*be - 4.0*al*fa;
+	double q = -0.5*(be + (be < 0.0 ? -1.0 : 1.0)*sqrt(disc > 0.0 ? disc : 0.0));
+	double t1 = (q != 0.0) ? fa/q : 0.5;     // Roots fa/q and q/al (stable form)
+	double t2 = (al != 0.0) ? q/al : t1;
+	t = (fabs(t1 - 0.5) <= fabs(t2 - 0.5)) ? t1 : t2;
+	if (t < 0.0) t = 0.0;
+	if (t > 1.0) t = 1.0;
+	*X = ax + t*dx;
+	*Y = ay + t*dy;
+}
+
+// Key of the lattice edge from vertex (i,j) in direction dir
+static long long ms_key(const MSJOB *job, int i, int j, int dir)
+{
+	return 2*((long long) j*(job->N + 1) + i) + dir;
+}
+
+// Quadtree cell of size x size fine cells with lower left vertex (i,j): drop, divide or march
+static void ms_cell(const MSJOB *job, int i, int j, int size, std::vector<MSSEG> &out)
+{
+	const double *p = job->p;
+	double r = 0.5*sqrt(2.0)*size*job->h;
+	double cx = job->x0 + (i + 0.5*size)*job->h, cy = job->y0 + (j + 0.5*size)*job->h;
+	double gx = 2.0*p[0]*cx + p[2]*cy + p[3], gy = 2.0*p[1]*cy + p[2]*cx + p[4];
+	double fc = conic_value(p, cx, cy);
+
+	// STEP 1: No point of the curve in this cell (bound widened a little for rounding)
+	if (fabs(fc) > (sqrt(gx*gx + gy*gy)*r + 0.5*job->Hn*r*r)*(1.0 + 1e-9) + 1e-12)
+		return;
+	if (size > 1)
 	{
-		// STEP 3a: Find next hull vertex by testing all points
-		int q = (p + 1) % n;    // Initial candidate for next hull point
-		
-		// Test all points to find the one that makes the most counterclockwise turn
-		for (i=0; i<n; i++)
-			// If point i is more counterclockwise than current candidate q
-			if (rotation(Sx[p], Sy[p], Sx[i], Sy[i], Sx[q], Sy[q]) < 0)
-				q = i;	// Update candidate - point i is more "left" than q
-		
-		// STEP 3b: Add found hull vertex to result
-		Hx[k] = Sx[q];    // Store hull vertex coordinates
-		Hy[k] = Sy[q];
-		k++;              // Increment hull vertex count
-
-		// STEP 3c: Safety check to prevent infinite loops
-		if (k > n-1)
-			break;
-
-		// STEP 3d: Check if we've completed the hull (returned to start)
-		if (q == l)       // Back to leftmost point?
-			break;
-		
-		// STEP 3e: Move to next hull vertex for next iteration
-		p = q;
+		int hs = size/2;
+		ms_cell(job, i,    j,    hs, out);
+		ms_cell(job, i+hs, j,    hs, out);
+		ms_cell(job, i,    j+hs, hs, out);
+		ms_cell(job, i+hs, j+hs, hs, out);
+		return;
 	}
 
-	// Return number of vertices in convex hull
-	return k;
+	// STEP 2: Fine cell. Corners 0..3 counterclockwise from (i,j); edge k runs from corner k to k+1
+	double f[4] = {ms_value(job, i, j), ms_value(job, i+1, j), ms_value(job, i+1, j+1), ms_value(job, i, j+1)};
+	int    vi[4] = {i, i+1, i, i};         // Lattice edge of cell edge k: start vertex and direction
+	int    vj[4] = {j, j, j+1, j};
+	int    vd[4] = {0, 1, 0, 1};
+	double fa[4] = {f[0], f[1], f[3], f[0]}; // F at that start vertex
+	int e[4], ne = 0, k;
+	for (k=0; k<4; k++)
+		if ((f[k] > 0.0) != (f[(k+1)%4] > 0.0))
+			e[ne++] = k;
+	if (ne == 4)
+	{
+		// Saddle: if the center has the sign of corner 0, corners 1 and 3 are cut off
+		// (edges 0,1 and 2,3), otherwise corners 0 and 2 (edges 3,0 and 1,2)
+		if ((fc > 0.0) == (f[0] > 0.0))
+		{
+			e[0] = 0; e[1] = 1; e[2] = 2; e[3] = 3;
+		}
+		else
+		{
+			e[0] = 3; e[1] = 0; e[2] = 1; e[3] = 2;
+		}
+	}
+	for (k=0; k+1<ne; k+=2)
+	{
+		MSSEG sg;
+		for (int l=0; l<2; l++)
+		{
+			int m = e[k+l];
+			sg.e[l] = ms_key(job, vi[m], vj[m], vd[m]);
+			ms_crossing(job, vi[m], vj[m], vd[m], fa[m], &sg.x[l], &sg.y[l]);
+		}
+		out.push_back(sg);
+	}
+}
+
+// Worker thread: marches whole coarse rows until none are left
+static void ms_worker(MSJOB *job)
+{
+	int size = 1 << MS_DEPTH, r, c;
+	while ((r = job->row++) < MS_COARSE)
+		for (c=0; c<MS_COARSE; c++)
+			ms_cell(job, c*size, r*size, size, job->seg[r]);
+}
+
+// Extracts F(X,Y) = 0 of the conic p in the window [x0, x0+w] x [y0, y0+w]
+// Output: Px[], Py[] - polylines one after the other, each followed by a NAN entry;
+//         at most max entries are written
+// Returns: number of entries written
+static int march_conic(const double p[5], double x0, double y0, double w, double Px[], double Py[], int max)
+{
+	MSJOB job;
+	job.p = p;
+	job.x0 = x0;
+	job.y0 = y0;
+	job.N = MS_COARSE << MS_DEPTH;
+	job.h = w/job.N;
+	job.Hn = fabs(p[0] + p[1]) + sqrt((p[0] - p[1])*(p[0] - p[1]) + p[2]*p[2]);
+	job.row = 0;
+
+	// STEP 3: Coarse rows in parallel
+	int nthreads = (int) std::thread::hardware_concurrency();
+	if (nthreads < 1)
+		nthreads = 1;
+	if (nthreads > MS_COARSE)
+		nthreads = MS_COARSE;
+	std::vector<std::thread> workers;
+	for (int t=1; t<nthreads; t++)
+		workers.push_back(std::thread(ms_worker, &job));
+	ms_worker(&job);            // This thread works as well
+	for (size_t t=0; t<workers.size(); t++)
+		workers[t].join();
+
+	// STEP 4: Join the segments at their shared lattice edges
+	std::vector<MSSEG> seg;
+	for (int r=0; r<MS_COARSE; r++)
+		seg.insert(seg.end(), job.seg[r].begin(), job.seg[r].end());
+	std::unordered_map<long long, int> first, second; // Edge key -> segments ending there
+	for (size_t k=0; k<seg.size(); k++)
+		for (int l=0; l<2; l++)
+		{
+			if (first.count(seg[k].e[l]))
+				second[seg[k].e[l]] = (int) k;
+			else
+				first[seg[k].e[l]] = (int) k;
+		}
+	std::vector<char> used(seg.size(), 0);
+	int np = 0;
+	for (int pass=0; pass<2; pass++)
+		for (size_t k0=0; k0<seg.size(); k0++)
+		{
+			if (used[k0])
+				continue;
+			int l0 = 0;
+			if (pass == 0)
+			{
+				// Open polylines only: start at an end no other segment shares
+				if (!second.count(seg[k0].e[0]))
+					l0 = 0;
+				else if (!second.count(seg[k0].e[1]))
+					l0 = 1;
+				else
+					continue;
+			}
+			int k = (int) k0, l = l0;
+			if (np < max)
+			{
+				Px[np] = seg[k].x[l];
+				Py[np++] = seg[k].y[l];
+			}
+			while (k >= 0)
+			{
+				used[k] = 1;
+				long long key = seg[k].e[1-l];
+				if (np < max)
+				{
+					Px[np] = seg[k].x[1-l];
+					Py[np++] = seg[k].y[1-l];
+				}
+				// Continue with the other segment at this edge, if any
+				int next = first[key];
+				if (next == k)
+					next = second.count(key) ? second[key] : -1;
+				if (next < 0 || used[next])
+					break;
+				l = (seg[next].e[0] == key) ? 0 : 1;
+				k = next;
+			}
+			if (np < max)
+			{
+				Px[np] = NAN;
+				Py[np++] = NAN;
+			}
+		}
+	return np;
 }
 
 /*
@@ -320,13 +503,120 @@ static double fy(double t, double a, double b, double th, double y0)
 }
 
 /*
- * MAIN PROGRAM WITH CONVEX HULL ENHANCEMENT
- * =======================================
+ * DIRECT ELLIPSE FIT (Fitzgibbon, Pilu, Fisher; numerically stable form of Halir, Flusser)
+ * ======================================================================================
+ * Minimizes the algebraic error of the general conic
+ *   a0*x² + a1*xy + a2*y² + a3*x + a4*y + a5 = 0
+ * under the constraint 4*a0*a2 - a1² = 1, which only ellipses satisfy. With the 6x6 scatter
+ * matrix S = DᵀD (rows of D: [x², xy, y², x, y, 1]) this is the generalized eigenproblem
+ * S*a = λ*C*a, and exactly one eigenvector satisfies the constraint: the result is always an
+ * ellipse, whatever the data.
+ * 
+ * Steps:
+ * 1. Center and scale the data (mean 0, RMS distance sqrt(2) from it) so S is well conditioned
+ * 2. Accumulate S in one pass over the points; no design matrix is stored
+ * 3. Eliminate the linear part: with S = [S1 S2; S2ᵀ S3] and a = [q; l],
+ *    l = T*q for T = -S3⁻¹*S2ᵀ (DPOSV), which leaves the 3x3 problem
+ *    (S1 + S2*T)*q = λ*C1*q, C1 = [0 0 2; 0 -1 0; 2 0 0] (DGGEV)
+ * 4. Take the eigenvector with 4*a0*a2 - a1² > 0
+ * 5. Center, semi-axes and angle in closed form (conic.cpp), then undo the scaling of step 1
+ */
+
+// Direct ellipse fit of the m points (x[k], y[k]); e->type is CONIC_ELLIPSE on success
+// Returns 0, or -1 if the points do not determine an ellipse (m < 6, collinear or degenerate data)
+static int fit_ellipse(const double x[], const double y[], int m, struct CONIC *e)
+{
+	int i, j, k;
+
+	if (m < 6)
+		return -1;
+
+	// STEP 1: Mean and scale of the data
+	double mx = 0.0, my = 0.0, r2 = 0.0;
+	for (k=0; k<m; k++)
+	{
+		mx += x[k];
+		my += y[k];
+	}
+	mx /= m;
+	my /= m;
+	for (k=0; k<m; k++)
+		r2 += (x[k]-mx)*(x[k]-mx) + (y[k]-my)*(y[k]-my);
+	double s = sqrt(r2/(2.0*m));
+	if (!(s > 0.0))
+		return -1;
+
+	// STEP 2: Scatter matrix S = DᵀD of the scaled points
+	double S[6][6] = {{0.0}};
+	for (k=0; k<m; k++)
+	{
+		double u = (x[k]-mx)/s, v = (y[k]-my)/s;
+		double d[6] = {u*u, u*v, v*v, u, v, 1.0};
+		for (i=0; i<6; i++)
+			for (j=i; j<6; j++)
+				S[i][j] += d[i]*d[j];
+	}
+	for (i=1; i<6; i++)
+		for (j=0; j<i; j++)
+			S[i][j] = S[j][i];
+
+	// STEP 3: T = -S3⁻¹*S2ᵀ and the reduced 3x3 problem M*q = λ*C1*q with M = S1 + S2*T
+	double S3[3][3], T[3][3], M[3][3];
+	for (i=0; i<3; i++)
+		for (j=0; j<3; j++)
+		{
+			S3[i][j] = S[3+i][3+j];
+			T[i][j] = -S[j][3+i];
+		}
+	if (LAPACKE_dposv(LAPACK_ROW_MAJOR, 'U', 3, 3, (double *) S3, 3, (double *) T, 3))
+		return -1;             // S3 singular: all points on a line
+	for (i=0; i<3; i++)
+		for (j=0; j<3; j++)
+			M[i][j] = S[i][j] + S[i][3]*T[0][j] + S[i][4]*T[1][j] + S[i][5]*T[2][j];
+
+	double C1[3][3] = {{0.0, 0.0, 2.0}, {0.0, -1.0, 0.0}, {2.0, 0.0, 0.0}};
+	double alphar[3], alphai[3], beta[3], V[3][3];
+	if (LAPACKE_dggev(LAPACK_ROW_MAJOR, 'N', 'V', 3, (double *) M, 3, (double *) C1, 3,
+	                  alphar, alphai, beta, NULL, 1, (double *) V, 3))
+		return -1;
+
+	// STEP 4: Eigenvector (column of V) that satisfies the ellipse constraint; λ = qᵀMq/qᵀC1q
+	// is the algebraic error, so the smallest λ wins should noise let more than one through
+	int best = -1;
+	for (j=0; j<3; j++)
+	{
+		double c = 4.0*V[0][j]*V[2][j] - V[1][j]*V[1][j];
+		if (alphai[j] != 0.0 || beta[j] == 0.0 || !(c > 0.0))
+			continue;
+		if (best < 0 || alphar[j]/beta[j] < alphar[best]/beta[best])
+			best = j;
+	}
+	if (best < 0)
+		return -1;
+	double a[6];
+	for (i=0; i<3; i++)
+		a[i] = V[i][best];
+	for (i=0; i<3; i++)
+		a[3+i] = T[i][0]*a[0] + T[i][1]*a[1] + T[i][2]*a[2];
+
+	// STEP 5: Closed form in the scaled coordinates, then back to the data
+	if (conic_analyze_general(a, e) != CONIC_ELLIPSE)
+		return -1;             // Imaginary or degenerate ellipse
+	e->xc = mx + s*e->xc;
+	e->yc = my + s*e->yc;
+	e->A *= s;
+	e->B *= s;
+	return 0;
+}
+
+/*
+ * MAIN PROGRAM WITH MARCHING SQUARES ENHANCEMENT
+ * ============================================
  * This is the main function that orchestrates the IMPROVED ellipse fitting demonstration.
  * 
  * KEY DIFFERENCE FROM "fit-fail" VERSION:
- * After extracting curve points from the fitted implicit equation, this version computes
- * the convex hull of those points to create a clean, organized curve visualization.
+ * The fitted implicit equation is traced with marching squares, which returns the curve
+ * as ordered polylines through exact grid crossings.
  * This addresses the main limitation of the "fit-fail" version which showed scattered,
  * potentially disconnected curve points.
  * 
@@ -336,9 +626,9 @@ static double fy(double t, double a, double b, double th, double y0)
  * 3. Generate clean theoretical ellipse points
  * 4. Add random noise to simulate measurement errors
  * 5. Set up and solve least squares fitting problem using LAPACK
- * 6. Generate points on the fitted ellipse using grid search
- * 7. **NEW STEP**: Compute convex hull of fitted curve points
- * 8. Display all results graphically (including convex hull)
+ * 6. **NEW STEP**: Trace the fitted curve with marching squares (ordered polylines)
+ * 7. Direct ellipse fit, evaluated from its closed-form parameters
+ * 8. Display all results graphically (including the traced curve)
  * 9. Run the GUI event loop
  */
 int main(void)
@@ -431,52 +721,27 @@ int main(void)
 	// Extract fitted parameters from solution vector
 	double p[5] = {B[0], B[1], B[2], B[3], B[4]};   // p = [A, B, C, D, E]
 
-	// STEP 7: Generate points on fitted curve (same grid method as "fit-fail")
+	// STEP 7: Trace the fitted curve (**IMPROVEMENT** over the grid scan of "fit-fail")
 	//
-	// The fitted ellipse is defined by: p[0]*X² + p[1]*Y² + p[2]*X*Y + p[3]*X + p[4]*Y = 1
-	// We find points by scanning a grid and selecting points close to the curve
-	
-	double Sx[n+1];              // X coordinates of fitted curve points (before hull)
-	double Sy[n+1];              // Y coordinates of fitted curve points (before hull)
-
-	double D = 0.05;             // Grid spacing for curve extraction
-	double X, Y;                 // Grid scan variables
-	k = 0;                       // Counter for fitted curve points
-	
-	// Scan 2D grid to find points on fitted ellipse
-	for (X=-0.5; X<=4.5; X+=D)
-	{
-    	for (Y=-2.5; Y<=2.5; Y+=D)
-		{
-        	// Evaluate fitted ellipse equation at grid point (X,Y)
-        	double Z = p[0]*X*X + p[1]*Y*Y + p[2]*X*Y + p[3]*X + p[4]*Y - 1.0;
-        	
-        	// If Z ≈ 0, point is on the ellipse (within tolerance)
-        	if (Z*Z < 0.0001)        // Tolerance: |Z| < 0.01
-			{
-				Sx[k] = X;           // Store point on fitted ellipse
-				Sy[k] = Y;
-				k++;
-			}
-		}
-	}
-	int Sn = k;                  // Number of points found on fitted ellipse
-
-	// STEP 8: **NEW IMPROVEMENT** - Compute convex hull of fitted curve points
+	// The fitted conic is defined by: p[0]*X² + p[1]*Y² + p[2]*X*Y + p[3]*X + p[4]*Y = 1
+	// If it is an ellipse, its center, semi-axes and angle give the points directly (O(k) for
+	// k points, no search at all). Any other conic is traced with marching squares as ordered
+	// polylines in the window [-0.5, 4.5] x [-2.5, 2.5]. Both write straight into the graph
+	// structure (at most GRAPH_MAX+1 entries)
+	struct CONIC C;
+	if (conic_analyze(p, &C) == CONIC_ELLIPSE)
+		Graph.n3 = conic_points(&C, 2*n+1, Graph.x3, Graph.y3);
+	else
+		Graph.n3 = march_conic(p, -0.5, -2.5, 5.0, Graph.x3, Graph.y3, GRAPH_MAX+1);
+
+	// STEP 8: Direct ellipse fit
 	//
-	// This is the KEY DIFFERENCE from "fit-fail" version:
-	// Instead of displaying scattered curve points, we compute their convex hull
-	// to create a clean, organized curve representation
-	
-	double Hx[n+1];              // X coordinates of convex hull vertices
-	double Hy[n+1];              // Y coordinates of convex hull vertices
-
-	// Apply Jarvis March algorithm to find convex hull
-	int Hn = convex(Sx, Sy, Hx, Hy, Sn);
-
-	// Close the convex hull by connecting back to first vertex
-	Hx[Hn] = Hx[0];             // Add first vertex as last to close the curve
-	Hy[Hn] = Hy[0];
+	// Guaranteed to be an ellipse, so its points come straight from the parametric form
+	// with the fitted center, semi-axes and angle; no grid search and no hull are needed
+	struct CONIC E;
+	Graph.n4 = 0;
+	if (!fit_ellipse(x, y, n+1, &E))
+		Graph.n4 = conic_points(&E, n+1, Graph.x4, Graph.y4); // Closed curve of n+1 points
 
 	// STEP 9: Populate global graph structure for visualization
 	
@@ -496,15 +761,6 @@ int main(void)
 	}
 	Graph.n2 = k;               // Number of noisy data points
 
-	// Store convex hull vertices (cyan line with circles) - **IMPROVEMENT**
-	// This replaces the scattered curve points from "fit-fail" version
-	for (k=0; k<=Hn; k++)
-	{
-		Graph.x3[k] = Hx[k];     // Convex hull X coordinates
-		Graph.y3[k] = Hy[k];     // Convex hull Y coordinates
-	}
-	Graph.n3 = k;               // Number of convex hull vertices	
-
 	// STEP 10: Start GUI event loop (same as "fit-fail" version)
 	Fl::run();                  // Begin FLTK event processing (program runs until window closed)
 	return EXIT_SUCCESS;        // Program completed successfully